@@ -0,0 +1,123 @@
+#include "autoquirks.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PENALTY_CRASH 1000 // Invalid opcode, stack fault, code in the font area or a halt, plus a point per frame it came early
+#define PENALTY_BLANK 100 // Nothing on screen at the end
+#define PENALTY_FROZEN 100 // Screen stopped changing in the first half of the run
+#define PENALTY_BAD_I 10 // Per frame that ended with I past the address space
+
+#define KEY_PERIOD 16 // Frames from one key press to the next
+#define KEY_HOLD 4 // Frames a key stays down
+
+// Keys pressed in turn, the usual start and movement keys first
+static const uint8_t key_sequence[KEYS_NUM] = { 0x5, 0x4, 0x6, 0x8, 0x2, 0x7, 0x9, 0x1, 0x3, 0xA, 0x0, 0xB, 0xC, 0xD, 0xE, 0xF };
+
+typedef struct
+{
+    const uint8_t *rom;
+    size_t size;
+    RomPlatform platform;
+    uint32_t cpu_speed;
+    QuirkTrial *trial;
+} TrialTask;
+
+static bool isScreenBlank(const Chip8 *chip) {
+    const uint64_t *words = &chip->screen[0][0][0];
+    for (size_t i = 0; i < sizeof(chip->screen) / sizeof(uint64_t); ++i) {
+        if (words[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void runTrial(void *arg) {
+    TrialTask *task = arg;
+    QuirkTrial *trial = task->trial;
+    trial->penalty = UINT32_MAX;
+    Chip8 *chip = createChip8();
+    uint32_t *opcode_counts = calloc(OPCODE_KINDS, sizeof(uint32_t));
+    if (chip == NULL || opcode_counts == NULL || !setDecodeCache(chip, true)) {
+        free(opcode_counts);
+        destroyChip8(chip);
+        return;
+    }
+    chip->opcode_counts = opcode_counts; // Catches invalid opcodes
+    resetState(chip, 2);
+    setInstructions(chip, task->platform == PLATFORM_XOCHIP ? 2 : 1);
+    setQuirkFlags(chip, trial->quirks);
+    if (loadROMFromMemory(chip, task->rom, task->size)) {
+        const uint32_t frames = AUTO_QUIRKS_SECONDS * TIMER_SPEED;
+        uint32_t penalty = 0;
+        uint32_t last_change = 0;
+        bool crashed = false;
+        for (uint32_t frame = 0; frame < frames && !crashed; ++frame) {
+            uint8_t key = key_sequence[frame / KEY_PERIOD % KEYS_NUM];
+            uint32_t phase = frame % KEY_PERIOD;
+            chip->keys = phase < KEY_HOLD ? 1 << key : 0;
+            chip->key_released_this_cycle = phase == KEY_HOLD ? key : -1;
+            chip->dirty_rows = 0;
+            runFrame(chip, task->cpu_speed);
+            chip->message_title = NULL; // Nobody shows them
+            chip->message = NULL;
+            if (chip->dirty_rows != 0) {
+                last_change = frame;
+            }
+            if (chip->I >= addressSpace(chip)) {
+                penalty += PENALTY_BAD_I;
+            }
+            crashed = chip->halted || chip->counters.stack_faults != 0 || opcode_counts[OPCODE_KIND_INVALID] != 0 || chip->PC < PROGRAM_START;
+            if (crashed) {
+                penalty += PENALTY_CRASH + frames - frame;
+            }
+        }
+        if (!crashed && isScreenBlank(chip)) {
+            penalty += PENALTY_BLANK;
+        }
+        if (!crashed && last_change < frames / 2) {
+            penalty += PENALTY_FROZEN;
+        }
+        trial->penalty = penalty;
+    }
+    chip->opcode_counts = NULL;
+    free(opcode_counts);
+    destroyChip8(chip);
+}
+
+static uint8_t countBits(uint8_t bits) {
+    uint8_t count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        ++count;
+    }
+    return count;
+}
+
+uint8_t detectQuirks(ThreadPool *pool, const uint8_t *rom, size_t size, RomPlatform platform, uint32_t cpu_speed,
+    uint8_t preferred, QuirkTrial trials[QUIRK_COMBINATIONS]) {
+    QuirkTrial results[QUIRK_COMBINATIONS];
+    TrialTask tasks[QUIRK_COMBINATIONS];
+    for (uint8_t quirks = 0; quirks < QUIRK_COMBINATIONS; ++quirks) {
+        results[quirks] = (QuirkTrial){ quirks, UINT32_MAX };
+        tasks[quirks] = (TrialTask){ rom, size, platform, cpu_speed, &results[quirks] };
+        if (pool == NULL || !submitTask(pool, runTrial, &tasks[quirks])) {
+            runTrial(&tasks[quirks]);
+        }
+    }
+    if (pool != NULL) {
+        waitThreadPool(pool);
+    }
+
+    uint8_t best = preferred & (QUIRK_COMBINATIONS - 1);
+    for (uint8_t quirks = 0; quirks < QUIRK_COMBINATIONS; ++quirks) {
+        uint32_t penalty = results[quirks].penalty;
+        uint32_t best_penalty = results[best].penalty;
+        if (penalty < best_penalty || (penalty == best_penalty && countBits(quirks ^ preferred) < countBits(best ^ preferred))) {
+            best = quirks;
+        }
+    }
+    if (trials != NULL) {
+        memcpy(trials, results, sizeof(results));
+    }
+    return best;
+}
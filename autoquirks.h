@@ -0,0 +1,32 @@
+#ifndef AUTOQUIRKS_H
+#define AUTOQUIRKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "threadpool.h"
+#include "romlibrary.h"
+
+// Picks the quirks of a ROM by running it headless once per combination of QUIRK_* flags, all of
+// them side by side on a thread pool, with a fixed sequence of key presses to get past title
+// screens. Each run collects signs of a wrong guess (invalid opcodes, stack faults, code running
+// in the font area, I past the address space, a halt, a blank or frozen screen) and the combination
+// with the fewest wins. Quirks a ROM never exercises give identical runs, the tie goes to the
+// combination closest to the preferred one.
+
+#define AUTO_QUIRKS_SECONDS 3 // Emulated time of each run
+
+// Result of one combination, lower penalties are better
+typedef struct
+{
+    uint8_t quirks;
+    uint32_t penalty;
+} QuirkTrial;
+
+// Returns the best QUIRK_* flags for the ROM on `platform` at cpu_speed, `trials` (may be NULL) gets
+// all QUIRK_COMBINATIONS results. `pool` may be NULL to run them one after another, otherwise this
+// mustn't be called from one of its tasks.
+uint8_t detectQuirks(ThreadPool *pool, const uint8_t *rom, size_t size, RomPlatform platform, uint32_t cpu_speed,
+    uint8_t preferred, QuirkTrial trials[QUIRK_COMBINATIONS]);
+
+#endif
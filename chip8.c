@@ -0,0 +1,2064 @@
+#include "chip8.h"
+#include "jit.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#define DEFAULT_PITCH 64 // Plays the XO-CHIP audio pattern at 4000 Hz
+
+// 4x5 font
+static const uint8_t lowres_font_sprites[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// 8x10 font
+static const uint8_t hires_font_sprites[512] = {
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0
+    0x00, 0x00, 0x18, 0x00, 0x38, 0x00, 0x78, 0x00, 0x58, 0x00, 0x18, 0x00, 0x18, 0x00, 0x18, 0x00, 0x18, 0x00, 0x7E, 0x00, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 1
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0C, 0x00, 0x18, 0x00, 0x30, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 2
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0x03, 0x00, 0x1E, 0x00, 0x1E, 0x00, 0x03, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 3
+    0x00, 0x00, 0x06, 0x00, 0x0E, 0x00, 0x1E, 0x00, 0x36, 0x00, 0x66, 0x00, 0xC6, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x06, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 4
+    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0x03, 0x00, 0x03, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 5
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC0, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 6
+    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0C, 0x00, 0x18, 0x00, 0x30, 0x00, 0x60, 0x00, 0x60, 0x00, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 7
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 8
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7F, 0x00, 0x3F, 0x00, 0x07, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 9
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // A
+    0x00, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // B
+    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // C
+    0x00, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // D
+    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFE, 0x00, 0xFE, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // E
+    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFE, 0x00, 0xFE, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  // F
+};
+
+// Handlers of the pre-decoded interpreter
+enum {
+    OP_UNDECODED = 0,
+    OP_NOP, OP_HIRES_INIT,
+    OP_00E0, OP_00EE, OP_00CN, OP_00DN, OP_00FB, OP_00FC, OP_00FD, OP_00FE, OP_00FF,
+    OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_5XY2, OP_5XY3, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_F000, OP_FN01, OP_F002, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29, OP_FX30,
+    OP_FX33, OP_FX3A, OP_FX55, OP_FX65, OP_FX75, OP_FX85,
+    OP_COUNT
+};
+_Static_assert(OP_COUNT == OPCODE_KINDS, "opcode_counts is indexed by handler");
+_Static_assert(OP_NOP == OPCODE_KIND_INVALID, "invalid opcodes are decoded as OP_NOP");
+
+static const char *opcode_kind_names[OPCODE_KINDS] = {
+    "undecoded", "0NNN", "hires init",
+    "00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE", "00FF",
+    "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "5XY2", "5XY3", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "F000", "FN01", "F002", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30",
+    "FX33", "FX3A", "FX55", "FX65", "FX75", "FX85"
+};
+
+const char *opcodeKindName(uint8_t kind) {
+    return kind < OPCODE_KINDS ? opcode_kind_names[kind] : "?";
+}
+
+static inline void markHeatmap(Chip8 *chip, uint16_t addr, uint8_t channel) {
+    if (chip->memory_heatmap) {
+        chip->memory_heatmap->last_access[channel][addr & (addressSpace(chip) - 1)] = chip->memory_heatmap->ticks;
+    }
+}
+
+// Drops decoded slots that overlap [addr, addr + length), an instruction
+// starting one byte before addr covers it too. Also marks the pages as changed.
+static void invalidateCode(Chip8 *chip, uint16_t addr, uint32_t length) {
+    if (length == 0) {
+        return;
+    }
+    uint32_t last_page = (addr + length - 1) / MEMORY_PAGE_SIZE;
+    for (uint32_t page = addr / MEMORY_PAGE_SIZE; page <= last_page && page < 64; ++page) {
+        chip->dirty_pages |= 1ULL << page;
+    }
+    if (chip->jit) {
+        invalidateJit(chip, addr, length);
+    }
+    if (chip->code_map) {
+        for (uint32_t i = addr; i < (uint32_t)addr + length && i < MEMORY_SIZE; ++i) {
+            chip->code_modified |= chip->code_map[i];
+        }
+    }
+    if (chip->decoded == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i <= length; ++i) {
+        chip->decoded[(uint16_t)(addr + i - 1)].op = OP_UNDECODED;
+    }
+}
+
+static inline void writeMemory(Chip8 *chip, uint16_t addr, uint8_t value) {
+    addr &= addressSpace(chip) - 1;
+    chip->memory[addr] = value;
+    chip->dirty_pages |= 1ULL << (addr / MEMORY_PAGE_SIZE);
+    markHeatmap(chip, addr, HEATMAP_WRITE);
+    if (chip->jit) {
+        invalidateJit(chip, addr, 1);
+    }
+    if (chip->code_map && chip->code_map[addr]) {
+        chip->code_modified = true;
+    }
+    if (chip->decoded) {
+        chip->decoded[addr].op = OP_UNDECODED;
+        chip->decoded[(uint16_t)(addr - 1)].op = OP_UNDECODED;
+    }
+}
+
+Chip8 *createChip8(void) {
+#ifdef _WIN32
+    Chip8 *chip = _aligned_malloc(sizeof(Chip8), _Alignof(Chip8));
+#else
+    Chip8 *chip = aligned_alloc(_Alignof(Chip8), sizeof(Chip8));
+#endif
+    if (chip != NULL) {
+        initChip8(chip);
+    }
+    return chip;
+}
+
+void destroyChip8(Chip8 *chip) {
+    setJit(chip, false);
+    setDecodeCache(chip, false);
+    releaseChip8(chip);
+#ifdef _WIN32
+    _aligned_free(chip);
+#else
+    free(chip);
+#endif
+}
+
+void initChip8(Chip8 *chip) {
+    memset(chip, 0, sizeof(Chip8));
+    chip->memory = chip->legacy_memory;
+}
+
+void releaseChip8(Chip8 *chip) {
+    if (chip->xochip_instructions_set) {
+        memcpy(chip->legacy_memory, chip->xochip_memory, LEGACY_MEMORY_SIZE);
+        chip->xochip_instructions_set = false;
+    }
+    chip->memory = chip->legacy_memory;
+    free(chip->xochip_memory);
+    chip->xochip_memory = NULL;
+}
+
+// Gives the machine XO-CHIP's memory if it doesn't have it yet, the address space stays as it is
+static bool allocateXochipMemory(Chip8 *chip) {
+    if (chip->xochip_memory == NULL) {
+        chip->xochip_memory = malloc(MEMORY_SIZE);
+        if (chip->xochip_memory == NULL) {
+            chip->message_title = "ERROR";
+            chip->message = "Not enough memory\nfor XO-CHIP.";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool setDecodeCache(Chip8 *chip, bool enabled) {
+    if (!enabled) {
+        free(chip->decoded);
+        chip->decoded = NULL;
+        return true;
+    }
+    if (chip->decoded == NULL) {
+        chip->decoded = calloc(MEMORY_SIZE, sizeof(DecodedInstruction)); // OP_UNDECODED everywhere
+    }
+    return chip->decoded != NULL;
+}
+
+// Stack Implementation
+bool isStackEmpty(const Chip8 *chip) {
+    return chip->sp == 0;
+}
+
+bool isStackFull(const Chip8 *chip) {
+    return chip->sp == STACK_SIZE;
+}
+
+void pushToStack(Chip8 *chip, uint16_t value) {
+    if (isStackFull(chip)) {
+        ++chip->counters.stack_faults;
+        return;
+    }
+    chip->stack[chip->sp++] = value;
+}
+
+uint16_t popFromStack(Chip8 *chip) {
+    if (isStackEmpty(chip)) {
+        ++chip->counters.stack_faults;
+        return 0;
+    }
+    return chip->stack[--chip->sp];
+}
+
+bool loadROM(Chip8 *chip, const char *path) {
+    FILE *rom = fopen(path, "rb");
+    if (rom == NULL) {
+        chip->message_title = "ERROR";
+        chip->message = "Cound't open the file.";
+        return false;
+    }
+    fseek(rom, 0, SEEK_END);
+    size_t rom_size = ftell(rom);
+    fseek(rom, 0, SEEK_SET);
+    if (rom_size > addressSpace(chip) - PROGRAM_START) {
+        fclose(rom);
+        chip->message_title = "ERROR";
+        chip->message = rom_size <= MEMORY_SIZE - PROGRAM_START ? "ROM is too big,\nit needs XO-CHIP." : "ROM is too big.";
+        return false;
+    }
+    fread(chip->memory + PROGRAM_START, 1, rom_size, rom);
+    fclose(rom);
+    invalidateCode(chip, PROGRAM_START, rom_size);
+    chip->is_rom_loaded = true;
+    return true;
+}
+
+bool loadROMFromMemory(Chip8 *chip, const uint8_t *data, size_t size) {
+    if (size > addressSpace(chip) - PROGRAM_START) {
+        chip->message_title = "ERROR";
+        chip->message = size <= MEMORY_SIZE - PROGRAM_START ? "ROM is too big,\nit needs XO-CHIP." : "ROM is too big.";
+        return false;
+    }
+    memcpy(chip->memory + PROGRAM_START, data, size);
+    invalidateCode(chip, PROGRAM_START, size);
+    chip->is_rom_loaded = true;
+    return true;
+}
+
+// Save state layout, all numbers little-endian:
+// "CH8S", u16 version, u16 ROM path length, u32 FNV-1a of everything after these 12 bytes,
+// V[16], u16 I, u16 PC, sp, delay timer, sound timer, screen width, screen height, font type,
+// u16 flags (SAVE_FLAG_*), u32 CXNN generator state, u32 frame count, u16 stack[16], the first LEGACY_MEMORY_SIZE bytes of memory,
+// plane 0 screen rows (screen_w / 8 bytes each, MSB first),
+// with SAVE_FLAG_XOCHIP: selected planes, pitch, audio pattern loaded (0/1), audio pattern, the rest of memory, planes 1-3 rows,
+// with SAVE_FLAG_RPL (flag registers that aren't all 0): the flag registers,
+// ROM path without the terminating 0.
+// Other machines are stored exactly as before XO-CHIP and the flag registers, so their older states and movies stay valid.
+enum {
+    SAVE_FLAG_WAITING_FOR_KEY = 1 << 0,
+    SAVE_FLAG_ROM_LOADED = 1 << 1,
+    SAVE_FLAG_HALTED = 1 << 2,
+    SAVE_FLAG_SHIFT = 1 << 3,
+    SAVE_FLAG_OFFSET_JUMP = 1 << 4,
+    SAVE_FLAG_REG_MEM_LOAD = 1 << 5,
+    SAVE_FLAG_NO_RESET_VF = 1 << 6,
+    SAVE_FLAG_SUPERCHIP = 1 << 7,
+    SAVE_FLAG_XOCHIP = 1 << 8,
+    SAVE_FLAG_WRAP = 1 << 9,
+    SAVE_FLAG_RPL = 1 << 10
+};
+#define SAVE_HEADER_SIZE 12
+
+static uint32_t hashSaveState(const uint8_t *bytes, size_t count) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value & 0xFFFF);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+// XO-CHIP sound state of a machine that never ran F002 or FX3A
+static void resetAudio(Chip8 *chip) {
+    chip->audio_pattern_loaded = false;
+    chip->pitch = DEFAULT_PITCH;
+    memset(chip->audio_pattern, 0, sizeof(chip->audio_pattern));
+}
+
+static uint8_t *saveScreenPlane(const Chip8 *chip, uint8_t plane, uint8_t *p) {
+    for (uint8_t y = 0; y < chip->screen_h; ++y) {
+        for (uint8_t x = 0; x < chip->screen_w; x += 8) {
+            *p++ = (uint8_t)(chip->screen[plane][y][x >> 6] >> (56 - (x & 63)));
+        }
+    }
+    return p;
+}
+
+static const uint8_t *loadScreenPlane(Chip8 *chip, uint8_t plane, const uint8_t *p) {
+    for (uint8_t y = 0; y < chip->screen_h; ++y) {
+        for (uint8_t x = 0; x < chip->screen_w; x += 8) {
+            chip->screen[plane][y][x >> 6] |= (uint64_t)*p++ << (56 - (x & 63));
+        }
+    }
+    return p;
+}
+
+static bool hasFlagRegisters(const Chip8 *chip) {
+    for (uint8_t i = 0; i < FLAG_REGISTERS; ++i) {
+        if (chip->flag_registers[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t saveState(const Chip8 *chip, const char *rom_path, uint8_t *buffer) {
+    size_t path_length = rom_path ? strlen(rom_path) : 0;
+    if (path_length > SAVE_STATE_MAX_PATH) {
+        path_length = 0; // Resuming then only lacks the path for reloading
+    }
+    uint8_t *p = buffer;
+    memcpy(p, "CH8S", 4);
+    put16(p + 4, SAVE_STATE_VERSION);
+    put16(p + 6, (uint16_t)path_length);
+    p += SAVE_HEADER_SIZE;
+
+    memcpy(p, chip->V, 16); p += 16;
+    put16(p, chip->I); p += 2;
+    put16(p, chip->PC); p += 2;
+    *p++ = chip->sp;
+    *p++ = chip->delay_timer;
+    *p++ = chip->sound_timer;
+    *p++ = chip->screen_w;
+    *p++ = chip->screen_h;
+    *p++ = chip->currently_loaded_font_type;
+    uint16_t flags = (chip->waiting_for_key ? SAVE_FLAG_WAITING_FOR_KEY : 0)
+        | (chip->is_rom_loaded ? SAVE_FLAG_ROM_LOADED : 0)
+        | (chip->halted ? SAVE_FLAG_HALTED : 0)
+        | (chip->superchip_shift ? SAVE_FLAG_SHIFT : 0)
+        | (chip->superchip_offset_jump ? SAVE_FLAG_OFFSET_JUMP : 0)
+        | (chip->superchip_reg_mem_load ? SAVE_FLAG_REG_MEM_LOAD : 0)
+        | (chip->superchip_no_reset_vf_on_bit_ops ? SAVE_FLAG_NO_RESET_VF : 0)
+        | (chip->superchip_instructions_set ? SAVE_FLAG_SUPERCHIP : 0)
+        | (chip->xochip_instructions_set ? SAVE_FLAG_XOCHIP : 0)
+        | (chip->wrap_sprites ? SAVE_FLAG_WRAP : 0)
+        | (hasFlagRegisters(chip) ? SAVE_FLAG_RPL : 0);
+    put16(p, flags); p += 2;
+    put32(p, chip->rng_state); p += 4;
+    put32(p, chip->frame_count); p += 4;
+    for (uint8_t i = 0; i < STACK_SIZE; ++i) {
+        put16(p, chip->stack[i]); p += 2;
+    }
+    memcpy(p, chip->memory, LEGACY_MEMORY_SIZE); p += LEGACY_MEMORY_SIZE;
+    p = saveScreenPlane(chip, 0, p);
+    if (chip->xochip_instructions_set) {
+        *p++ = chip->planes;
+        *p++ = chip->pitch;
+        *p++ = chip->audio_pattern_loaded;
+        memcpy(p, chip->audio_pattern, AUDIO_PATTERN_SIZE); p += AUDIO_PATTERN_SIZE;
+        memcpy(p, chip->memory + LEGACY_MEMORY_SIZE, MEMORY_SIZE - LEGACY_MEMORY_SIZE); p += MEMORY_SIZE - LEGACY_MEMORY_SIZE;
+        for (uint8_t plane = 1; plane < SCREEN_PLANES; ++plane) {
+            p = saveScreenPlane(chip, plane, p);
+        }
+    }
+    if (flags & SAVE_FLAG_RPL) {
+        memcpy(p, chip->flag_registers, FLAG_REGISTERS); p += FLAG_REGISTERS;
+    }
+    if (path_length > 0) { // memcpy() mustn't get a NULL rom_path, even for 0 bytes
+        memcpy(p, rom_path, path_length); p += path_length;
+    }
+
+    size_t size = p - buffer;
+    put32(buffer + 8, hashSaveState(buffer + SAVE_HEADER_SIZE, size - SAVE_HEADER_SIZE));
+    return size;
+}
+
+bool loadState(Chip8 *chip, const uint8_t *buffer, size_t size, const char **rom_path, size_t *rom_path_length) {
+    if (size < SAVE_STATE_FIXED_SIZE || memcmp(buffer, "CH8S", 4) != 0) {
+        chip->message_title = "ERROR";
+        chip->message = "Not a save state.";
+        return false;
+    }
+    if (get16(buffer + 4) != SAVE_STATE_VERSION) {
+        chip->message_title = "ERROR";
+        chip->message = "Save state was made by\nan incompatible version.";
+        return false;
+    }
+    const uint8_t *p = buffer + SAVE_HEADER_SIZE;
+    uint8_t screen_w = p[16 + 4 + 3];
+    uint8_t screen_h = p[16 + 4 + 4];
+    uint16_t path_length = get16(buffer + 6);
+    bool xochip = get16(p + 16 + 4 + 6) & SAVE_FLAG_XOCHIP;
+    bool rpl = get16(p + 16 + 4 + 6) & SAVE_FLAG_RPL;
+    size_t screen_size = (size_t)screen_h * screen_w / 8 * (xochip ? SCREEN_PLANES : 1);
+    bool valid_screen = (screen_w == 64 && (screen_h == 32 || screen_h == 64)) || (screen_w == 128 && screen_h == 64);
+    if (!valid_screen || size != SAVE_STATE_FIXED_SIZE + (xochip ? SAVE_STATE_XOCHIP_SIZE : 0) + (rpl ? FLAG_REGISTERS : 0) + screen_size + path_length
+        || hashSaveState(p, size - SAVE_HEADER_SIZE) != get32(buffer + 8)
+        || p[16 + 4] > STACK_SIZE || get16(p + 16 + 2) >= (xochip ? MEMORY_SIZE : LEGACY_MEMORY_SIZE)) {
+        chip->message_title = "ERROR";
+        chip->message = "Save state is corrupted.";
+        return false;
+    }
+    if (xochip && !allocateXochipMemory(chip)) {
+        return false;
+    }
+
+    memcpy(chip->V, p, 16); p += 16;
+    chip->I = get16(p); p += 2;
+    chip->PC = get16(p); p += 2;
+    chip->sp = *p++;
+    chip->delay_timer = *p++;
+    chip->sound_timer = *p++;
+    chip->screen_w = *p++;
+    chip->screen_h = *p++;
+    chip->currently_loaded_font_type = *p++;
+    uint16_t flags = get16(p); p += 2;
+    chip->waiting_for_key = flags & SAVE_FLAG_WAITING_FOR_KEY;
+    chip->is_rom_loaded = flags & SAVE_FLAG_ROM_LOADED;
+    chip->halted = flags & SAVE_FLAG_HALTED;
+    chip->superchip_shift = flags & SAVE_FLAG_SHIFT;
+    chip->superchip_offset_jump = flags & SAVE_FLAG_OFFSET_JUMP;
+    chip->superchip_reg_mem_load = flags & SAVE_FLAG_REG_MEM_LOAD;
+    chip->superchip_no_reset_vf_on_bit_ops = flags & SAVE_FLAG_NO_RESET_VF;
+    chip->wrap_sprites = flags & SAVE_FLAG_WRAP;
+    chip->superchip_instructions_set = flags & SAVE_FLAG_SUPERCHIP;
+    bool was_xochip = chip->xochip_instructions_set;
+    chip->xochip_instructions_set = xochip;
+    chip->memory = xochip ? chip->xochip_memory : chip->legacy_memory; // Filled below, all of it
+    seedRandom(chip, get32(p)); p += 4;
+    chip->frame_count = get32(p); p += 4;
+    for (uint8_t i = 0; i < STACK_SIZE; ++i) {
+        chip->stack[i] = get16(p); p += 2;
+    }
+    memcpy(chip->memory, p, LEGACY_MEMORY_SIZE); p += LEGACY_MEMORY_SIZE;
+    memset(chip->screen, 0, sizeof(chip->screen));
+    p = loadScreenPlane(chip, 0, p);
+    chip->planes = 1;
+    resetAudio(chip);
+    if (xochip) {
+        chip->planes = *p++ & ((1 << SCREEN_PLANES) - 1);
+        chip->pitch = *p++;
+        chip->audio_pattern_loaded = *p++ != 0;
+        memcpy(chip->audio_pattern, p, AUDIO_PATTERN_SIZE); p += AUDIO_PATTERN_SIZE;
+        memcpy(chip->memory + LEGACY_MEMORY_SIZE, p, MEMORY_SIZE - LEGACY_MEMORY_SIZE); p += MEMORY_SIZE - LEGACY_MEMORY_SIZE;
+        for (uint8_t plane = 1; plane < SCREEN_PLANES; ++plane) {
+            p = loadScreenPlane(chip, plane, p);
+        }
+    }
+    memset(chip->flag_registers, 0, FLAG_REGISTERS);
+    if (rpl) {
+        memcpy(chip->flag_registers, p, FLAG_REGISTERS); p += FLAG_REGISTERS;
+    }
+    // Code decoded above LEGACY_MEMORY_SIZE is dropped when XO-CHIP is turned off
+    invalidateCode(chip, 0, xochip || was_xochip ? MEMORY_SIZE : LEGACY_MEMORY_SIZE);
+    chip->dirty_rows = UINT64_MAX;
+    chip->keys = 0;
+    chip->key_released_this_cycle = -1;
+    if (rom_path != NULL) {
+        *rom_path = (const char *)p;
+        *rom_path_length = path_length;
+    }
+    return true;
+}
+
+bool saveStateToFile(const Chip8 *chip, const char *rom_path, const char *path) {
+    uint8_t buffer[SAVE_STATE_MAX_SIZE];
+    size_t size = saveState(chip, rom_path, buffer);
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fwrite(buffer, 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+bool loadStateFromFile(Chip8 *chip, const char *path, char **rom_path) {
+    bool loaded = false;
+    const char *stored_path = NULL;
+    size_t stored_path_length = 0;
+#ifdef _WIN32
+    uint8_t buffer[SAVE_STATE_MAX_SIZE];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        chip->message_title = "ERROR";
+        chip->message = "Couldn't open the save state.";
+        return false;
+    }
+    size_t size = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    const uint8_t *data = buffer;
+#else
+    // Mapped instead of read, resuming a session shouldn't cost more than the page faults
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        if (fd >= 0) close(fd);
+        chip->message_title = "ERROR";
+        chip->message = "Couldn't open the save state.";
+        return false;
+    }
+    size_t size = info.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        chip->message_title = "ERROR";
+        chip->message = "Couldn't open the save state.";
+        return false;
+    }
+#endif
+    loaded = loadState(chip, data, size, &stored_path, &stored_path_length);
+    if (loaded && rom_path != NULL) {
+        char *copy = realloc(*rom_path, stored_path_length + 1);
+        if (copy != NULL) {
+            memcpy(copy, stored_path, stored_path_length);
+            copy[stored_path_length] = '\0';
+            *rom_path = copy;
+        }
+    }
+#ifndef _WIN32
+    munmap((void *)data, size);
+#endif
+    return loaded;
+}
+
+bool snapshotMachine(Chip8 *snapshot, const Chip8 *chip, uint64_t pages) {
+    if (chip->xochip_instructions_set && snapshot->xochip_memory == NULL) {
+        snapshot->xochip_memory = malloc(MEMORY_SIZE);
+        if (snapshot->xochip_memory == NULL) {
+            return false;
+        }
+    }
+    uint8_t *memory = chip->xochip_instructions_set ? snapshot->xochip_memory : snapshot->legacy_memory;
+    if (snapshot->memory != memory) {
+        snapshot->memory = memory;
+        pages = UINT64_MAX; // What the snapshot has there is from another time
+    }
+    memcpy(snapshot, chip, offsetof(Chip8, memory));
+    for (uint8_t page = 0; page < addressSpace(chip) / MEMORY_PAGE_SIZE; ++page) {
+        if ((pages >> page) & 1) {
+            memcpy(snapshot->memory + page * MEMORY_PAGE_SIZE, chip->memory + page * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+        }
+    }
+    return true;
+}
+
+void restoreMachine(Chip8 *chip, const Chip8 *snapshot, uint64_t pages) {
+    uint64_t dirty_rows = chip->dirty_rows;
+    uint64_t dirty_pages = chip->dirty_pages;
+    for (uint8_t y = 0; y < SCREEN_MAX_H; ++y) {
+        for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+            if (memcmp(chip->screen[plane][y], snapshot->screen[plane][y], sizeof(chip->screen[plane][y])) != 0) {
+                dirty_rows |= 1ULL << y;
+            }
+        }
+    }
+    memcpy(chip, snapshot, offsetof(Chip8, memory));
+    chip->dirty_rows = dirty_rows;
+    chip->dirty_pages = dirty_pages;
+    // Only the bytes from the first to the last difference are put back, pages usually hold code
+    // next to the data that changed and the compiled blocks would otherwise go with it
+    for (uint8_t page = 0; page < addressSpace(chip) / MEMORY_PAGE_SIZE; ++page) {
+        uint32_t start = page * MEMORY_PAGE_SIZE;
+        if (!((pages >> page) & 1) || memcmp(chip->memory + start, snapshot->memory + start, MEMORY_PAGE_SIZE) == 0) {
+            continue;
+        }
+        uint32_t first = start;
+        uint32_t end = start + MEMORY_PAGE_SIZE;
+        while (chip->memory[first] == snapshot->memory[first]) ++first;
+        while (chip->memory[end - 1] == snapshot->memory[end - 1]) --end;
+        memcpy(chip->memory + first, snapshot->memory + first, end - first);
+        invalidateCode(chip, (uint16_t)first, end - first);
+    }
+}
+
+// Instructions
+
+// Clears the planes set in `planes`
+static void clearPlanes(Chip8 *chip, uint8_t planes) {
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if ((planes >> plane) & 1) {
+            memset(chip->screen[plane], 0, sizeof(chip->screen[plane]));
+        }
+    }
+    ++chip->counters.clears;
+    chip->dirty_rows = UINT64_MAX;
+}
+
+// 00E0
+void clearScreen(Chip8 *chip) {
+    clearPlanes(chip, chip->planes);
+}
+
+// 00EE
+void returnFromSubRoutine(Chip8 *chip) {
+    chip->PC = popFromStack(chip);
+}
+
+// 00CN
+void scrollDisplayDownN(Chip8 *chip, uint8_t N) {
+    uint8_t screen_h = chip->screen_h;
+    if (N > screen_h) {
+        N = screen_h;
+    }
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if ((chip->planes >> plane) & 1) {
+            memmove(chip->screen[plane][N], chip->screen[plane][0], (screen_h - N) * sizeof(chip->screen[plane][0]));
+            memset(chip->screen[plane][0], 0, N * sizeof(chip->screen[plane][0]));
+        }
+    }
+    chip->dirty_rows = UINT64_MAX;
+    ++chip->counters.scrolls;
+}
+
+// 00DN
+void scrollDisplayUpN(Chip8 *chip, uint8_t N) {
+    uint8_t screen_h = chip->screen_h;
+    if (N > screen_h) {
+        N = screen_h;
+    }
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if ((chip->planes >> plane) & 1) {
+            memmove(chip->screen[plane][0], chip->screen[plane][N], (screen_h - N) * sizeof(chip->screen[plane][0]));
+            memset(chip->screen[plane][screen_h - N], 0, N * sizeof(chip->screen[plane][0]));
+        }
+    }
+    chip->dirty_rows = UINT64_MAX;
+    ++chip->counters.scrolls;
+}
+
+// Horizontal scrolls shift every row of a plane as one 128-bit value, pixel 0 being the top bit
+// of word 0. Two rows per instruction with AVX2, one with SSE2.
+// In 64-pixel modes the bits shifted into word 1 are masked off.
+
+static void scrollPlaneRight(uint64_t (*rows)[SCREEN_ROW_WORDS], uint8_t screen_h, uint64_t keep) {
+#if defined(__AVX2__)
+    __m256i mask = _mm256_set_epi64x(keep, UINT64_MAX, keep, UINT64_MAX);
+    for (uint8_t y = 0; y < screen_h; y += 2) {
+        __m256i *pair = (__m256i *)rows[y];
+        __m256i v = _mm256_load_si256(pair);
+        __m256i carry = _mm256_slli_si256(_mm256_slli_epi64(v, 60), 8);
+        _mm256_store_si256(pair, _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(v, 4), carry), mask));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i mask = _mm_set_epi64x(keep, UINT64_MAX);
+    for (uint8_t y = 0; y < screen_h; ++y) {
+        __m128i *row = (__m128i *)rows[y];
+        __m128i v = _mm_load_si128(row);
+        __m128i carry = _mm_slli_si128(_mm_slli_epi64(v, 60), 8);
+        _mm_store_si128(row, _mm_and_si128(_mm_or_si128(_mm_srli_epi64(v, 4), carry), mask));
+    }
+#else
+    for (uint8_t y = 0; y < screen_h; ++y) {
+        uint64_t *row = rows[y];
+        row[1] = ((row[1] >> 4) | (row[0] << 60)) & keep;
+        row[0] >>= 4;
+    }
+#endif
+}
+
+static void scrollPlaneLeft(uint64_t (*rows)[SCREEN_ROW_WORDS], uint8_t screen_h) {
+#if defined(__AVX2__)
+    for (uint8_t y = 0; y < screen_h; y += 2) {
+        __m256i *pair = (__m256i *)rows[y];
+        __m256i v = _mm256_load_si256(pair);
+        __m256i carry = _mm256_srli_si256(_mm256_srli_epi64(v, 60), 8);
+        _mm256_store_si256(pair, _mm256_or_si256(_mm256_slli_epi64(v, 4), carry));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (uint8_t y = 0; y < screen_h; ++y) {
+        __m128i *row = (__m128i *)rows[y];
+        __m128i v = _mm_load_si128(row);
+        __m128i carry = _mm_srli_si128(_mm_srli_epi64(v, 60), 8);
+        _mm_store_si128(row, _mm_or_si128(_mm_slli_epi64(v, 4), carry));
+    }
+#else
+    for (uint8_t y = 0; y < screen_h; ++y) {
+        uint64_t *row = rows[y];
+        row[0] = (row[0] << 4) | (row[1] >> 60);
+        row[1] <<= 4;
+    }
+#endif
+}
+
+// 00FB
+void scrollDisplayRight(Chip8 *chip) {
+    uint64_t keep = chip->screen_w > 64 ? UINT64_MAX : 0;
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if ((chip->planes >> plane) & 1) {
+            scrollPlaneRight(chip->screen[plane], chip->screen_h, keep);
+        }
+    }
+    chip->dirty_rows = UINT64_MAX;
+    ++chip->counters.scrolls;
+}
+
+// 00FC
+void scrollDisplayLeft(Chip8 *chip) {
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if ((chip->planes >> plane) & 1) {
+            scrollPlaneLeft(chip->screen[plane], chip->screen_h);
+        }
+    }
+    chip->dirty_rows = UINT64_MAX;
+    ++chip->counters.scrolls;
+}
+
+// 1NNN
+void jump(Chip8 *chip, uint16_t addr) {
+    chip->PC = addr & 0xFFF;
+}
+
+// 2NNN
+void execSubroutine(Chip8 *chip, uint16_t addr) {
+    pushToStack(chip, chip->PC);
+    chip->PC = addr;
+}
+
+// 3XNN
+void skipIfVxEqNN(Chip8 *chip, uint8_t reg_index, uint8_t num) {
+    if (chip->V[reg_index] == num) {
+        chip->PC += instructionSize(chip, chip->PC);
+    }
+}
+
+// 4XNN
+void skipIfVxNotEqNN(Chip8 *chip, uint8_t reg_index, uint8_t num) {
+    if (chip->V[reg_index] != num) {
+        chip->PC += instructionSize(chip, chip->PC);
+    }
+}
+
+// 5XY0
+void skipIfVxEqVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    if (chip->V[regx_index] == chip->V[regy_index]) {
+        chip->PC += instructionSize(chip, chip->PC);
+    }
+}
+
+// 5XY2
+// Stores VX to VY at I, in reverse order if X > Y, I stays unchanged
+void storeRegisterRange(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    int8_t step = regx_index <= regy_index ? 1 : -1;
+    uint8_t count = (regx_index <= regy_index ? regy_index - regx_index : regx_index - regy_index) + 1;
+    for (uint8_t i = 0; i < count; ++i) {
+        writeMemory(chip, chip->I + i, chip->V[regx_index + i * step]);
+    }
+}
+
+// 5XY3
+// Loads VX to VY from I, in reverse order if X > Y, I stays unchanged
+void loadRegisterRange(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    int8_t step = regx_index <= regy_index ? 1 : -1;
+    uint8_t count = (regx_index <= regy_index ? regy_index - regx_index : regx_index - regy_index) + 1;
+    for (uint8_t i = 0; i < count; ++i) {
+        chip->V[regx_index + i * step] = chip->memory[(chip->I + i) & (addressSpace(chip) - 1)];
+        markHeatmap(chip, chip->I + i, HEATMAP_READ);
+    }
+}
+
+// 6XNN
+void setVXNN(Chip8 *chip, uint8_t reg_index, uint8_t num) {
+    chip->V[reg_index] = num;
+}
+
+// 7XNN
+void addNNToVX(Chip8 *chip, uint8_t reg_index, uint8_t num) {
+    chip->V[reg_index] += num; // vF isn't changed in case of overflow
+}
+
+// 8XY0
+void setVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    chip->V[regx_index] = chip->V[regy_index];
+}
+
+// 8XY1
+void orVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    chip->V[regx_index] |= chip->V[regy_index];
+    if (!chip->superchip_no_reset_vf_on_bit_ops) {
+        chip->V[0xF] = 0;
+    }
+}
+
+// 8XY2
+void andVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    chip->V[regx_index] &= chip->V[regy_index];
+    if (!chip->superchip_no_reset_vf_on_bit_ops) {
+        chip->V[0xF] = 0;
+    }
+}
+
+// 8XY3
+void xorVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    chip->V[regx_index] ^= chip->V[regy_index];
+    if (!chip->superchip_no_reset_vf_on_bit_ops) {
+        chip->V[0xF] = 0;
+    }
+}
+
+// 8XY4
+void addVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    uint8_t *V = chip->V;
+    uint8_t vF;
+    if ((V[regx_index] + V[regy_index]) > 255) {
+        vF = 1;
+    } else {
+        vF = 0;
+    }
+    V[regx_index] += V[regy_index];
+    V[0xF] = vF;
+}
+
+// 8XY5
+void subtractVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    uint8_t *V = chip->V;
+    uint8_t vF;
+    if (V[regx_index] < V[regy_index]) {
+        vF = 0;
+    } else {
+        vF = 1;
+    }
+    V[regx_index] -= V[regy_index];
+    V[0xF] = vF;
+}
+
+// 8XY6
+void shiftVxRight(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    uint8_t *V = chip->V;
+    if (!chip->superchip_shift) {
+        V[regx_index] = V[regy_index];
+    }
+    uint8_t vF;
+    if (V[regx_index] & 0x1) {
+        vF = 1;
+    } else {
+        vF = 0;
+    }
+    V[regx_index] >>= 1;
+    V[0xF] = vF;
+}
+
+// 8XY7
+void subtractVyVx(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    uint8_t *V = chip->V;
+    uint8_t vF;
+    if (V[regy_index] < V[regx_index]) {
+        vF = 0;
+    } else {
+        vF = 1;
+    }
+    V[regx_index] = V[regy_index] - V[regx_index];
+    V[0xF] = vF;
+}
+
+// 8XYE
+void shiftVxLeft(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    uint8_t *V = chip->V;
+    if (!chip->superchip_shift) {
+        V[regx_index] = V[regy_index];
+    }
+    uint8_t vF;
+    if ((V[regx_index] & 0x80) >> 7) {
+        vF = 1;
+    } else {
+        vF = 0;
+    }
+    V[regx_index] <<= 1;
+    V[0xF] = vF;
+}
+
+// 9XY0
+void skipIfVXNotEqVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    if (chip->V[regx_index] != chip->V[regy_index]) {
+        chip->PC += instructionSize(chip, chip->PC);
+    }
+}
+
+// ANNN
+void setINNN(Chip8 *chip, uint16_t addr) {
+    chip->I = addr & 0xFFF;
+}
+
+// BNNN
+void offsetJump(Chip8 *chip, uint16_t addr) {
+    chip->PC = (addr + chip->V[0]) & (addressSpace(chip) - 1);
+}
+
+// BXNN (BNNN) superchip quirk behaviour
+// XNN address + VX register
+void offsetJumpSC(Chip8 *chip, uint8_t reg_index, uint8_t addr) {
+    chip->PC = ((reg_index << 8) + addr + chip->V[reg_index]) & (addressSpace(chip) - 1);
+}
+
+// CXNN
+void randomNNToVx(Chip8 *chip, uint8_t reg_index, uint8_t num) {
+    uint32_t x = chip->rng_state; // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip->rng_state = x;
+    chip->V[reg_index] = (x >> 24) & num;
+}
+
+void seedRandom(Chip8 *chip, uint32_t seed) {
+    chip->rng_state = seed != 0 ? seed : 0x9E3779B9; // xorshift never leaves 0
+}
+
+// Shifts sprite bits left (or right if the shift is negative), anything past 64 bits is dropped
+static inline uint64_t placeSpriteBits(uint64_t bits, int16_t shift) {
+    if (shift >= 64 || shift <= -64) {
+        return 0;
+    }
+    return shift >= 0 ? bits << shift : bits >> -shift;
+}
+
+// XORs a `width`-pixel sprite onto the rows of `plane` starting at y0, one packed row per line.
+// Pixels past the right and bottom edges are clipped, or with wrap_sprites drawn from the
+// other edge on, returns true on collision.
+static bool xorSprite(Chip8 *chip, uint8_t plane, const uint16_t *lines, uint8_t count, uint8_t width, uint16_t x0, uint16_t y0) {
+    int16_t shift0 = 64 - width - x0;
+    int16_t shift1 = chip->screen_w > 64 ? 128 - width - x0 : 64; // 64 drops everything
+    // The part past the right edge, placed as if the sprite started screen_w pixels further left
+    int16_t wrapped_shift0 = chip->wrap_sprites && x0 + width > chip->screen_w ? shift0 + chip->screen_w : 64;
+    uint64_t collision = 0;
+    for (uint8_t i = 0; i < count; ++i) {
+        uint8_t y = y0 + i;
+        if (y >= chip->screen_h) {
+            if (!chip->wrap_sprites) {
+                break;
+            }
+            y -= chip->screen_h;
+        }
+        uint64_t *row = chip->screen[plane][y];
+        uint64_t sprite0 = placeSpriteBits(lines[i], shift0) | placeSpriteBits(lines[i], wrapped_shift0);
+        uint64_t sprite1 = placeSpriteBits(lines[i], shift1);
+        collision |= (row[0] & sprite0) | (row[1] & sprite1);
+        row[0] ^= sprite0;
+        row[1] ^= sprite1;
+        chip->dirty_rows |= 1ULL << y;
+    }
+    return collision != 0;
+}
+
+// Draws `count` lines of a 8 or 16-pixel wide sprite on every selected plane, each plane
+// taking the next sprite's bytes from I on. Sets VF on a collision on any of them.
+static void drawSprite(Chip8 *chip, uint8_t regx_index, uint8_t regy_index, uint8_t count, uint8_t width) {
+    uint8_t *V = chip->V;
+    uint16_t x0 = V[regx_index] & (chip->screen_w - 1);
+    uint16_t y0 = V[regy_index] & (chip->screen_h - 1);
+    uint32_t mask = addressSpace(chip) - 1;
+    uint16_t addr = chip->I;
+    bool collision = false;
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+        if (!((chip->planes >> plane) & 1)) {
+            continue;
+        }
+        uint16_t lines[16];
+        for (uint8_t i = 0; i < count; ++i) {
+            if (width == 16) {
+                lines[i] = (chip->memory[addr & mask] << 8) | chip->memory[(addr + 1) & mask];
+                markHeatmap(chip, addr, HEATMAP_READ);
+                markHeatmap(chip, addr + 1, HEATMAP_READ);
+                addr += 2;
+            } else {
+                lines[i] = chip->memory[addr & mask];
+                markHeatmap(chip, addr, HEATMAP_READ);
+                addr += 1;
+            }
+        }
+        collision |= xorSprite(chip, plane, lines, count, width, x0, y0);
+    }
+    ++chip->counters.draws;
+    chip->counters.collisions += collision;
+    V[0xF] = collision;
+}
+
+// DXY0
+void drawHighRes(Chip8 *chip, uint8_t regx_index, uint8_t regy_index) {
+    drawSprite(chip, regx_index, regy_index, 16, 16);
+}
+
+// DXYN
+void draw(Chip8 *chip, uint8_t regx_index, uint8_t regy_index, uint8_t length) {
+    drawSprite(chip, regx_index, regy_index, length, 8);
+}
+
+// EX9E
+void skipIfKeyPressed(Chip8 *chip, uint8_t reg_index) {
+    if ((chip->keys >> (chip->V[reg_index] & 0xF)) & 1)
+        chip->PC += instructionSize(chip, chip->PC);
+}
+
+// EXA1
+void skipIfKeyNotPressed(Chip8 *chip, uint8_t reg_index) {
+    if (!((chip->keys >> (chip->V[reg_index] & 0xF)) & 1))
+        chip->PC += instructionSize(chip, chip->PC);
+}
+
+// F000 NNNN
+// Loads the 16-bit address following the instruction into I
+void setILong(Chip8 *chip) {
+    uint32_t mask = addressSpace(chip) - 1;
+    chip->I = (chip->memory[chip->PC & mask] << 8) | chip->memory[(chip->PC + 1) & mask];
+    markHeatmap(chip, chip->PC, HEATMAP_EXECUTE);
+    markHeatmap(chip, chip->PC + 1, HEATMAP_EXECUTE);
+    chip->PC += 2;
+}
+
+// FN01
+// Selects the planes drawn to, cleared and scrolled, bit N is plane N
+void selectPlanes(Chip8 *chip, uint8_t planes) {
+    chip->planes = planes & 0xF;
+}
+
+// F002
+// Loads the 16-byte (128 samples, 1 bit each) audio pattern from I
+void loadAudioPattern(Chip8 *chip) {
+    uint32_t mask = addressSpace(chip) - 1;
+    for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE; ++i) {
+        chip->audio_pattern[i] = chip->memory[(chip->I + i) & mask];
+        markHeatmap(chip, chip->I + i, HEATMAP_READ);
+    }
+    chip->audio_pattern_loaded = true;
+}
+
+// FX07
+void setVxToDTimer(Chip8 *chip, uint8_t reg_index) {
+    chip->V[reg_index] = chip->delay_timer;
+}
+
+// FX0A
+void getKey(Chip8 *chip, uint8_t reg_index) {
+    if (!chip->waiting_for_key) {
+        chip->waiting_for_key = true;
+    }
+    if (chip->key_released_this_cycle != -1) {
+        chip->V[reg_index] = chip->key_released_this_cycle;
+        chip->waiting_for_key = false;
+        chip->key_released_this_cycle = -1;
+    }
+    if (chip->waiting_for_key) {
+        chip->PC -= 2;
+    }
+}
+
+// FX15
+void setDTimerToVx(Chip8 *chip, uint8_t reg_index) {
+    chip->delay_timer = chip->V[reg_index];
+}
+
+// FX18
+void setSTimerToVx(Chip8 *chip, uint8_t reg_index) {
+    chip->sound_timer = chip->V[reg_index];
+}
+
+// FX1E
+void addToI(Chip8 *chip, uint8_t reg_index) {
+    uint8_t vF;
+    if (chip->I + chip->V[reg_index] > addressSpace(chip) - 1) {
+        vF = 1;
+    } else {
+        vF = 0;
+    }
+    chip->I += chip->V[reg_index];
+    chip->V[0xF] = vF;
+}
+
+// FX29
+void setIToLowResFontChar(Chip8 *chip, uint8_t reg_index) {
+    chip->I = FONT_MEM_LOC + (chip->V[reg_index] & 0xF) * 5;
+}
+
+// FX30
+void setIToHighResFontChar(Chip8 *chip, uint8_t reg_index) {
+    chip->I = FONT_MEM_LOC + (chip->V[reg_index] & 0xF) * 32;
+}
+
+// FX33
+void binCodedDecimalConversion(Chip8 *chip, uint8_t reg_index) {
+    uint8_t value = chip->V[reg_index];
+    writeMemory(chip, chip->I, value / 100);
+    writeMemory(chip, chip->I + 1, (value % 100) / 10);
+    writeMemory(chip, chip->I + 2, value % 10);
+}
+
+// FX3A
+void setPitch(Chip8 *chip, uint8_t reg_index) {
+    chip->pitch = chip->V[reg_index];
+}
+
+// FX55
+void storeRegistersInMemory(Chip8 *chip, uint8_t reg_index) {
+    for (uint8_t i = 0; i <= reg_index; ++i) {
+        writeMemory(chip, chip->I + i, chip->V[i]);
+    }
+    if (!chip->superchip_reg_mem_load) {
+        chip->I += reg_index + 1;
+    }
+}
+
+// FX65
+void loadRegistersFromMemory(Chip8 *chip, uint8_t reg_index) {
+    for (uint8_t i = 0; i <= reg_index; ++i) {
+        chip->V[i] = chip->memory[(chip->I + i) & (addressSpace(chip) - 1)];
+        markHeatmap(chip, chip->I + i, HEATMAP_READ);
+    }
+    if (!chip->superchip_reg_mem_load) {
+        chip->I += reg_index + 1;
+    }
+}
+
+// FX75
+// Saves V0-VX into the flag registers, the frontend persists them without holding up the machine
+void saveRegStateToLocalStorage(Chip8 *chip, uint8_t reg_index) {
+    memcpy(chip->flag_registers, chip->V, (reg_index & 0xF) + 1);
+}
+
+// FX85
+// Loads V0-VX from the flag registers, 0 for ones never saved
+void loadRegStateFromLocalStorage(Chip8 *chip, uint8_t reg_index) {
+    memcpy(chip->V, chip->flag_registers, (reg_index & 0xF) + 1);
+}
+
+// Type:
+// 0 - CHIP-8
+// 1 - SUPER-CHIP
+// 2 - XO-CHIP (CHIP-8 ones, except VF isn't reset by bit ops and sprites wrap around the screen edges)
+void setQuirks(Chip8 *chip, uint8_t type) {
+    setQuirkFlags(chip, platformQuirks(type));
+}
+
+uint8_t platformQuirks(uint8_t type) {
+    if (type == 1) {
+        return QUIRK_SHIFT | QUIRK_OFFSET_JUMP | QUIRK_REG_MEM_LOAD | QUIRK_NO_RESET_VF;
+    }
+    return type != 0 ? QUIRK_NO_RESET_VF | QUIRK_WRAP : 0;
+}
+
+void setQuirkFlags(Chip8 *chip, uint8_t quirks) {
+    chip->superchip_shift = quirks & QUIRK_SHIFT;
+    chip->superchip_offset_jump = quirks & QUIRK_OFFSET_JUMP;
+    chip->superchip_reg_mem_load = quirks & QUIRK_REG_MEM_LOAD;
+    chip->superchip_no_reset_vf_on_bit_ops = quirks & QUIRK_NO_RESET_VF;
+    chip->wrap_sprites = quirks & QUIRK_WRAP;
+}
+
+uint8_t quirkFlags(const Chip8 *chip) {
+    return (chip->superchip_shift ? QUIRK_SHIFT : 0)
+        | (chip->superchip_offset_jump ? QUIRK_OFFSET_JUMP : 0)
+        | (chip->superchip_reg_mem_load ? QUIRK_REG_MEM_LOAD : 0)
+        | (chip->superchip_no_reset_vf_on_bit_ops ? QUIRK_NO_RESET_VF : 0)
+        | (chip->wrap_sprites ? QUIRK_WRAP : 0);
+}
+
+// Set screen resolution
+// Type:
+// 0 or any number - 64x32
+// 1 - 64x64
+// 2 - 128x64
+void setScreenMode(Chip8 *chip, uint8_t type) {
+    switch (type) {
+        case 1:
+            chip->screen_w = 64;
+            chip->screen_h = 64;
+            break;
+        case 2:
+            chip->screen_w = 128;
+            chip->screen_h = 64;
+            break;
+        default: // default - CHIP-8
+            chip->screen_w = 64;
+            chip->screen_h = 32;
+            break;
+    }
+    clearPlanes(chip, (1 << SCREEN_PLANES) - 1);
+}
+
+// Activates SUPER-CHIP instructions
+// Type:
+// 0 - CHIP-8
+// 1 - SUPER-CHIP
+// 2 or any other - XO-CHIP (SUPER-CHIP ones included), 64 KB of memory and 4 planes
+bool setInstructions(Chip8 *chip, uint8_t type) {
+    bool xochip = type >= 2;
+    if (xochip && !chip->xochip_instructions_set) {
+        if (!allocateXochipMemory(chip)) {
+            return false;
+        }
+        // The first 4 KB move along, the rest starts out empty
+        memcpy(chip->xochip_memory, chip->legacy_memory, LEGACY_MEMORY_SIZE);
+        memset(chip->xochip_memory + LEGACY_MEMORY_SIZE, 0, MEMORY_SIZE - LEGACY_MEMORY_SIZE);
+        chip->memory = chip->xochip_memory;
+        invalidateCode(chip, LEGACY_MEMORY_SIZE, MEMORY_SIZE - LEGACY_MEMORY_SIZE);
+    } else if (chip->xochip_instructions_set && !xochip) {
+        // Nothing outside of XO-CHIP may see what was left above 4 KB or on the extra planes
+        memcpy(chip->legacy_memory, chip->xochip_memory, LEGACY_MEMORY_SIZE);
+        chip->memory = chip->legacy_memory;
+        invalidateCode(chip, LEGACY_MEMORY_SIZE, MEMORY_SIZE - LEGACY_MEMORY_SIZE);
+        clearPlanes(chip, ((1 << SCREEN_PLANES) - 1) & ~1);
+        resetAudio(chip);
+        chip->planes = 1;
+    }
+    chip->superchip_instructions_set = type != 0;
+    chip->xochip_instructions_set = xochip;
+    return true;
+}
+
+// Loads fonts into the memory at 0x000 - 0x09F/0x1FF (depending on size)
+// Type:
+// 0 - lowres (80 bytes)
+// 1 - hires (512 bytes)
+// any other number - set font mem space to 0
+void setFontType(Chip8 *chip, uint8_t type) {
+    memset(chip->memory + FONT_MEM_LOC, 0, PROGRAM_START - 1);
+    if (type == 0) {
+        chip->currently_loaded_font_type = 0;
+        memcpy(chip->memory + FONT_MEM_LOC, lowres_font_sprites, sizeof(lowres_font_sprites));
+    } else if (type == 1) {
+        chip->currently_loaded_font_type = 1;
+        memcpy(chip->memory + FONT_MEM_LOC, hires_font_sprites, sizeof(hires_font_sprites));
+    }
+    invalidateCode(chip, FONT_MEM_LOC, PROGRAM_START - 1);
+}
+
+// Reset program or machine to initial state
+// Type:
+// 0 - reset program
+// 1 - unload program
+// 2 or any number - reset machine (quirks included)
+void resetState(Chip8 *chip, uint8_t type) {
+    chip->I = PROGRAM_START;
+    chip->PC = PROGRAM_START;
+    chip->delay_timer = 0;
+    chip->sound_timer = 0;
+    chip->sp = 0;
+    memset(chip->stack, 0, sizeof(chip->stack));
+    if (chip->memory_heatmap) {
+        memset(chip->memory_heatmap, 0, sizeof(*chip->memory_heatmap));
+        chip->memory_heatmap->ticks = 1;
+    }
+    memset(chip->V, 0, 16);
+    chip->keys = 0;
+    chip->key_released_this_cycle = -1;
+    chip->waiting_for_key = false;
+    chip->halted = false;
+    chip->frame_count = 0;
+    chip->idle_cycles = 0;
+    if (type >= 1) {
+        chip->is_rom_loaded = false;
+        memset(chip->flag_registers, 0, FLAG_REGISTERS);
+        memset(chip->memory, 0, addressSpace(chip));
+        invalidateCode(chip, 0, MEMORY_SIZE);
+        setScreenMode(chip, 0);
+    }
+    if (type >= 2) {
+        setQuirks(chip, 0);
+        setInstructions(chip, 1);
+        seedRandom(chip, 0);
+        chip->message_title = NULL;
+        chip->message = NULL;
+    }
+    chip->planes = 1;
+    resetAudio(chip);
+    setFontType(chip, 0);
+    clearPlanes(chip, (1 << SCREEN_PLANES) - 1);
+}
+
+void tickTimers(Chip8 *chip) {
+    if (chip->memory_heatmap) {
+        ++chip->memory_heatmap->ticks;
+    }
+    if (chip->delay_timer > 0) {
+        --chip->delay_timer;
+    }
+    if (chip->sound_timer > 0) {
+        --chip->sound_timer;
+    }
+}
+
+#define IDLE_CHECK_INTERVAL 64 // Instructions between checks for an idle loop
+
+// Keys and timers only change between frames, so some loops can't be left before the next one:
+// a jump to itself, FX0A without a released key, EX9E/EXA1 jumping back to itself while the key
+// doesn't skip, and delay timer polls (FX07, 3XNN/4XNN on the same X, jump back) while the timer
+// doesn't match. Returns the instruction count of such a loop starting at `addr`, 0 otherwise.
+static uint8_t idleLoopLength(const Chip8 *chip, uint16_t addr) {
+    if (addr > LEGACY_MEMORY_SIZE - 6) { // Jumps can't reach past it
+        return 0;
+    }
+    const uint8_t *code = &chip->memory[addr];
+    uint16_t op0 = (code[0] << 8) | code[1];
+    uint16_t op1 = (code[2] << 8) | code[3];
+    uint16_t op2 = (code[4] << 8) | code[5];
+    uint16_t jump_back = 0x1000 | addr;
+    uint8_t x = (op0 >> 8) & 0xF;
+
+    if (op0 == jump_back) {
+        return 1;
+    }
+    if ((op0 & 0xF0FF) == 0xF00A) {
+        return chip->key_released_this_cycle == -1 ? 1 : 0;
+    }
+    if (op1 == jump_back) {
+        bool pressed = (chip->keys >> (chip->V[x] & 0xF)) & 1;
+        if (((op0 & 0xF0FF) == 0xE09E && !pressed) || ((op0 & 0xF0FF) == 0xE0A1 && pressed)) {
+            return 2;
+        }
+    }
+    if ((op0 & 0xF0FF) == 0xF007 && op2 == jump_back && ((op1 >> 8) & 0xF) == x) {
+        uint8_t nn = op1 & 0xFF;
+        if (((op1 & 0xF000) == 0x3000 && chip->delay_timer != nn)
+            || ((op1 & 0xF000) == 0x4000 && chip->delay_timer == nn)) {
+            return 3;
+        }
+    }
+    return 0;
+}
+
+// Leaves the machine where running `cycles` instructions of the idle loop at PC would
+static void skipIdleLoop(Chip8 *chip, uint8_t length, uint32_t cycles) {
+    uint16_t start = chip->PC;
+    uint16_t opcode = (chip->memory[start] << 8) | chip->memory[start + 1];
+    if ((opcode & 0xF0FF) == 0xF007) {
+        chip->V[(opcode >> 8) & 0xF] = chip->delay_timer;
+    } else if ((opcode & 0xF0FF) == 0xF00A) {
+        chip->waiting_for_key = true;
+    }
+    for (uint8_t i = 0; i < length && i < cycles; ++i) {
+        markHeatmap(chip, start + 2 * i, HEATMAP_EXECUTE);
+        markHeatmap(chip, start + 2 * i + 1, HEATMAP_EXECUTE);
+    }
+    chip->PC = start + 2 * (cycles % length);
+    chip->idle_cycles += cycles;
+}
+
+uint32_t runFrame(Chip8 *chip, uint32_t cpu_speed) {
+    uint64_t frame = chip->frame_count++;
+    uint32_t cycles = (uint32_t)((frame + 1) * cpu_speed / TIMER_SPEED - frame * cpu_speed / TIMER_SPEED);
+    ++chip->counters.frames;
+    // Opcode counts and profiles have to see every instruction
+    if (chip->opcode_counts != NULL || chip->profiler != NULL) {
+        runCycles(chip, cycles);
+    } else {
+        uint32_t left = cycles;
+        while (left > 0 && !chip->halted) {
+            uint8_t length = idleLoopLength(chip, chip->PC);
+            if (length > 0) {
+                skipIdleLoop(chip, length, left);
+                break;
+            }
+            // Inside a loop the registers it sets may not be current yet, walk to its start first
+            if (idleLoopLength(chip, chip->PC - 2) >= 2 || idleLoopLength(chip, chip->PC - 4) == 3) {
+                runCycles(chip, 1);
+                --left;
+                continue;
+            }
+            uint32_t chunk = left < IDLE_CHECK_INTERVAL ? left : IDLE_CHECK_INTERVAL;
+            runCycles(chip, chunk);
+            left -= chunk;
+        }
+    }
+    chip->counters.key_wait_frames += chip->waiting_for_key;
+    tickTimers(chip);
+    return cycles;
+}
+
+static void observeInstruction(Chip8 *chip, uint16_t addr);
+
+// Fetch / Decode / Execute Loop
+void stepOneСycle(Chip8 *chip) {
+    if (chip->halted) {
+        return;
+    }
+
+    // If end of the memory is reached
+    if (chip->PC >= addressSpace(chip) - 2) {
+        jump(chip, PROGRAM_START);
+        return;
+    }
+
+    // Fetch
+    uint8_t b1 = chip->memory[chip->PC++];
+    uint8_t nibble1 = b1 >> 4;
+    uint8_t nibble2 = b1 & 0xF;
+    uint8_t b2 = chip->memory[chip->PC++];
+    uint8_t nibble3 = b2 >> 4;
+    uint8_t nibble4 = b2 & 0xF;
+    uint16_t opcode = (b1 << 8) | b2;
+    uint16_t addr = (nibble2 << 8) | b2;
+
+    if (chip->memory_heatmap || chip->opcode_counts || chip->profiler) {
+        observeInstruction(chip, chip->PC - 2);
+    }
+
+    // Init 64x64 hires mode
+    if (chip->PC == (PROGRAM_START + 2) && opcode == 0x1260) {
+        setScreenMode(chip, 1);
+        jump(chip, 0x2C0);
+        return;
+    }
+
+    // Decode & Execute
+    switch (nibble1) {
+        case 0x0:
+            switch(opcode) {
+                case 0x00E0:
+                    clearScreen(chip); // 00E0
+                    break;
+                case 0x00EE:
+                    returnFromSubRoutine(chip); // 00EE
+                    break;
+                case 0x00FE:
+                    // lores mode
+                    if (chip->superchip_instructions_set) {
+                        setScreenMode(chip, 0); // 00FE
+                    }
+                    break;
+                case 0x00FB:
+                    if (chip->superchip_instructions_set) {
+                        scrollDisplayRight(chip); // 00FB
+                    }
+                    break;
+                case 0x00FC:
+                    if (chip->superchip_instructions_set) {
+                        scrollDisplayLeft(chip); // 00FC
+                    }
+                    break;
+                case 0x00FF:
+                    // hires mode
+                    if (chip->superchip_instructions_set) {
+                        setScreenMode(chip, 2); // 00FF
+                    }
+                    break;
+                case 0x00FD:
+                    if (chip->superchip_instructions_set) {
+                        chip->halted = true;
+                    }
+                    break;
+            }
+            if (b1 == 0x0 && nibble3 == 0xC && chip->superchip_instructions_set) {
+                scrollDisplayDownN(chip, nibble4); // 00CN
+            }
+            if (b1 == 0x0 && nibble3 == 0xD && chip->xochip_instructions_set) {
+                scrollDisplayUpN(chip, nibble4); // 00DN
+            }
+            break;
+        case 0x1:
+            jump(chip, addr); // 1NNN
+            break;
+        case 0x2:
+            execSubroutine(chip, addr); // 2NNN
+            break;
+        case 0x3:
+            skipIfVxEqNN(chip, nibble2, b2); // 3XNN
+            break;
+        case 0x4:
+            skipIfVxNotEqNN(chip, nibble2, b2); // 4XNN
+            break;
+        case 0x5:
+            if (nibble4 == 0) {
+                skipIfVxEqVy(chip, nibble2, nibble3); // 5XY0
+            } else if (nibble4 == 2 && chip->xochip_instructions_set) {
+                storeRegisterRange(chip, nibble2, nibble3); // 5XY2
+            } else if (nibble4 == 3 && chip->xochip_instructions_set) {
+                loadRegisterRange(chip, nibble2, nibble3); // 5XY3
+            }
+            break;
+        case 0x6:
+            setVXNN(chip, nibble2, b2); // 6XNN
+            break;
+        case 0x7:
+            addNNToVX(chip, nibble2, b2); // 7XNN
+            break;
+        case 0x8:
+            switch (nibble4) {
+                case 0x0:
+                    setVxVy(chip, nibble2, nibble3); // 8XY0
+                    break;
+                case 0x1:
+                    orVxVy(chip, nibble2, nibble3); // 8XY1
+                    break;
+                case 0x2:
+                    andVxVy(chip, nibble2, nibble3); // 8XY2
+                    break;
+                case 0x3:
+                    xorVxVy(chip, nibble2, nibble3); // 8XY3
+                    break;
+                case 0x4:
+                    addVxVy(chip, nibble2, nibble3); // 8XY4
+                    break;
+                case 0x5:
+                    subtractVxVy(chip, nibble2, nibble3); // 8XY5
+                    break;
+                case 0x6:
+                    shiftVxRight(chip, nibble2, nibble3); // 8XY6
+                    break;
+                case 0x7:
+                    subtractVyVx(chip, nibble2, nibble3); // 8XY7
+                    break;
+                case 0xE:
+                    shiftVxLeft(chip, nibble2, nibble3); // 8XYE
+                    break;
+            }
+            break;
+        case 0x9:
+            if (nibble4 == 0)
+                skipIfVXNotEqVy(chip, nibble2, nibble3); // 9XY0
+            break;
+        case 0xA:
+            setINNN(chip, addr); // ANNN
+            break;
+        case 0xB:
+            if (chip->superchip_offset_jump) {
+                offsetJumpSC(chip, nibble2, b2); // BXNN
+            } else {
+                offsetJump(chip, addr); // BNNN
+            }
+            break;
+        case 0xC:
+            randomNNToVx(chip, nibble2, b2); // CXNN
+            break;
+        case 0xD:
+            if (nibble4 == 0x0 && chip->superchip_instructions_set) {
+                drawHighRes(chip, nibble2, nibble3);
+            } else {
+                draw(chip, nibble2, nibble3, nibble4); // DXYN
+            }
+            break;
+        case 0xE:
+            switch(b2) {
+                case 0x9E:
+                    skipIfKeyPressed(chip, nibble2); // EX9E
+                    break;
+                case 0xA1:
+                    skipIfKeyNotPressed(chip, nibble2); // EXA1
+                    break;
+            }
+            break;
+        case 0xF:
+            switch(b2) {
+                case 0x00:
+                    if (nibble2 == 0 && chip->xochip_instructions_set) {
+                        setILong(chip); // F000 NNNN
+                    }
+                    break;
+                case 0x01:
+                    if (chip->xochip_instructions_set) {
+                        selectPlanes(chip, nibble2); // FN01
+                    }
+                    break;
+                case 0x02:
+                    if (nibble2 == 0 && chip->xochip_instructions_set) {
+                        loadAudioPattern(chip); // F002
+                    }
+                    break;
+                case 0x07:
+                    setVxToDTimer(chip, nibble2); // FX07
+                    break;
+                case 0x0A:
+                    getKey(chip, nibble2); // FX0A
+                    break;
+                case 0x15:
+                    setDTimerToVx(chip, nibble2); // FX15
+                    break;
+                case 0x18:
+                    setSTimerToVx(chip, nibble2); // FX18
+                    break;
+                case 0x1E:
+                    addToI(chip, nibble2); // FX1E
+                    break;
+                case 0x29:
+                    if (chip->currently_loaded_font_type != 0) {
+                        setFontType(chip, 0);
+                    }
+                    setIToLowResFontChar(chip, nibble2); // FX29
+                    break;
+                case 0x30:
+                    if (chip->superchip_instructions_set) {
+                        if (chip->currently_loaded_font_type == 0) {
+                            setFontType(chip, 1);
+                        }
+                        setIToHighResFontChar(chip, nibble2); // FX30
+                    }
+                    break;
+                case 0x33:
+                    binCodedDecimalConversion(chip, nibble2); // FX33
+                    break;
+                case 0x3A:
+                    if (chip->xochip_instructions_set) {
+                        setPitch(chip, nibble2); // FX3A
+                    }
+                    break;
+                case 0x55:
+                    storeRegistersInMemory(chip, nibble2); // FX55
+                    break;
+                case 0x65:
+                    loadRegistersFromMemory(chip, nibble2); // FX65
+                    break;
+                case 0x75:
+                    if (chip->superchip_instructions_set) {
+                        saveRegStateToLocalStorage(chip, nibble2); // FX75
+                    }
+                    break;
+                case 0x85:
+                    if (chip->superchip_instructions_set) {
+                        loadRegStateFromLocalStorage(chip, nibble2); // FX85
+                    }
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Splits the opcode at addr into a handler and operands once, so that runCycles
+// doesn't have to walk the nested switches of stepOneСycle every time.
+// Quirks and SUPER-CHIP flags are checked by the handlers, decoded slots stay valid when they change.
+static DecodedInstruction decodeInstruction(const Chip8 *chip, uint16_t addr) {
+    DecodedInstruction ins = { OP_NOP, 0, 0, 0 };
+    uint8_t b1 = chip->memory[addr];
+    uint8_t b2 = chip->memory[addr + 1];
+    uint16_t opcode = (b1 << 8) | b2;
+    ins.x = b1 & 0xF;
+    ins.y = b2 >> 4;
+    ins.nn = b2;
+    uint8_t n = b2 & 0xF;
+
+    if (addr == PROGRAM_START && opcode == 0x1260) {
+        ins.op = OP_HIRES_INIT;
+        return ins;
+    }
+
+    switch (b1 >> 4) {
+        case 0x0:
+            if (b1 != 0x0) {
+                break;
+            }
+            switch (b2) {
+                case 0xE0: ins.op = OP_00E0; break;
+                case 0xEE: ins.op = OP_00EE; break;
+                case 0xFB: ins.op = OP_00FB; break;
+                case 0xFC: ins.op = OP_00FC; break;
+                case 0xFD: ins.op = OP_00FD; break;
+                case 0xFE: ins.op = OP_00FE; break;
+                case 0xFF: ins.op = OP_00FF; break;
+                default:
+                    if (ins.y == 0xC) {
+                        ins.op = OP_00CN;
+                    } else if (ins.y == 0xD) {
+                        ins.op = OP_00DN;
+                    }
+                    break;
+            }
+            break;
+        case 0x1: ins.op = OP_1NNN; break;
+        case 0x2: ins.op = OP_2NNN; break;
+        case 0x3: ins.op = OP_3XNN; break;
+        case 0x4: ins.op = OP_4XNN; break;
+        case 0x5:
+            if (n == 0) ins.op = OP_5XY0;
+            else if (n == 2) ins.op = OP_5XY2;
+            else if (n == 3) ins.op = OP_5XY3;
+            break;
+        case 0x6: ins.op = OP_6XNN; break;
+        case 0x7: ins.op = OP_7XNN; break;
+        case 0x8:
+            switch (n) {
+                case 0x0: ins.op = OP_8XY0; break;
+                case 0x1: ins.op = OP_8XY1; break;
+                case 0x2: ins.op = OP_8XY2; break;
+                case 0x3: ins.op = OP_8XY3; break;
+                case 0x4: ins.op = OP_8XY4; break;
+                case 0x5: ins.op = OP_8XY5; break;
+                case 0x6: ins.op = OP_8XY6; break;
+                case 0x7: ins.op = OP_8XY7; break;
+                case 0xE: ins.op = OP_8XYE; break;
+            }
+            break;
+        case 0x9: if (n == 0) ins.op = OP_9XY0; break;
+        case 0xA: ins.op = OP_ANNN; break;
+        case 0xB: ins.op = OP_BNNN; break;
+        case 0xC: ins.op = OP_CXNN; break;
+        case 0xD: ins.op = OP_DXYN; break;
+        case 0xE:
+            if (b2 == 0x9E) ins.op = OP_EX9E;
+            else if (b2 == 0xA1) ins.op = OP_EXA1;
+            break;
+        case 0xF:
+            switch (b2) {
+                case 0x00: if (ins.x == 0) ins.op = OP_F000; break;
+                case 0x01: ins.op = OP_FN01; break;
+                case 0x02: if (ins.x == 0) ins.op = OP_F002; break;
+                case 0x07: ins.op = OP_FX07; break;
+                case 0x0A: ins.op = OP_FX0A; break;
+                case 0x15: ins.op = OP_FX15; break;
+                case 0x18: ins.op = OP_FX18; break;
+                case 0x1E: ins.op = OP_FX1E; break;
+                case 0x29: ins.op = OP_FX29; break;
+                case 0x30: ins.op = OP_FX30; break;
+                case 0x33: ins.op = OP_FX33; break;
+                case 0x3A: ins.op = OP_FX3A; break;
+                case 0x55: ins.op = OP_FX55; break;
+                case 0x65: ins.op = OP_FX65; break;
+                case 0x75: ins.op = OP_FX75; break;
+                case 0x85: ins.op = OP_FX85; break;
+            }
+            break;
+    }
+    return ins;
+}
+
+// Marks the heatmap and counts the instruction at addr, only called when one of them is on
+static void observeInstruction(Chip8 *chip, uint16_t addr) {
+    markHeatmap(chip, addr, HEATMAP_EXECUTE);
+    markHeatmap(chip, addr + 1, HEATMAP_EXECUTE);
+    if (chip->profiler) {
+        profileInstruction(chip->profiler, chip, addr);
+    }
+    if (chip->opcode_counts == NULL) {
+        return;
+    }
+    if (chip->decoded == NULL) {
+        ++chip->opcode_counts[decodeInstruction(chip, addr).op];
+        return;
+    }
+    if (chip->decoded[addr].op == OP_UNDECODED) {
+        chip->decoded[addr] = decodeInstruction(chip, addr);
+    }
+    ++chip->opcode_counts[chip->decoded[addr].op];
+}
+
+// Pre-decoded interpreter.
+// With GCC/Clang every handler ends with its own copy of the fetch and an indirect
+// `goto` (threaded code), so the branch predictor sees one dispatch site per handler.
+// Other compilers get the same handlers inside a plain switch.
+void runCycles(Chip8 *chip, uint32_t cycles) {
+    if (chip->halted) {
+        return;
+    }
+    if (chip->jit && chip->opcode_counts == NULL && chip->profiler == NULL) {
+        runJitCycles(chip, cycles);
+        return;
+    }
+    if (chip->decoded == NULL) {
+        while (cycles-- > 0 && !chip->halted) {
+            stepOneСycle(chip);
+        }
+        return;
+    }
+
+    DecodedInstruction *decoded = chip->decoded;
+    DecodedInstruction ins;
+    uint8_t *V = chip->V;
+    bool observed = chip->memory_heatmap || chip->opcode_counts || chip->profiler;
+    uint16_t pc = chip->PC; // Kept in a register, synced around helpers that use chip->PC
+    uint32_t memory_end = addressSpace(chip); // setInstructions() never runs in here
+
+#if defined(__GNUC__)
+    static const void *handlers[OP_COUNT] = {
+        &&op_undecoded, &&op_nop, &&op_hires_init,
+        &&op_00e0, &&op_00ee, &&op_00cn, &&op_00dn, &&op_00fb, &&op_00fc, &&op_00fd, &&op_00fe, &&op_00ff,
+        &&op_1nnn, &&op_2nnn, &&op_3xnn, &&op_4xnn, &&op_5xy0, &&op_5xy2, &&op_5xy3, &&op_6xnn, &&op_7xnn,
+        &&op_8xy0, &&op_8xy1, &&op_8xy2, &&op_8xy3, &&op_8xy4, &&op_8xy5, &&op_8xy6, &&op_8xy7, &&op_8xye,
+        &&op_9xy0, &&op_annn, &&op_bnnn, &&op_cxnn, &&op_dxyn, &&op_ex9e, &&op_exa1,
+        &&op_f000, &&op_fn01, &&op_f002, &&op_fx07, &&op_fx0a, &&op_fx15, &&op_fx18, &&op_fx1e, &&op_fx29, &&op_fx30,
+        &&op_fx33, &&op_fx3a, &&op_fx55, &&op_fx65, &&op_fx75, &&op_fx85
+    };
+    #define HANDLER(label, op) label:
+    #define DISPATCH() goto *handlers[ins.op]
+#else
+    #define HANDLER(label, op) case op:
+    #define DISPATCH() goto dispatch
+#endif
+
+    // Fetch, count the cycle and jump to the handler
+    #define NEXT()                                              \
+        do {                                                    \
+            if (cycles == 0) {                                  \
+                chip->PC = pc;                                  \
+                return;                                         \
+            }                                                   \
+            --cycles;                                           \
+            if (pc >= memory_end - 2) {                         \
+                pc = PROGRAM_START;                             \
+                continue;                                       \
+            }                                                   \
+            if (observed) {                                     \
+                observeInstruction(chip, pc);                   \
+            }                                                   \
+            ins = decoded[pc];                                  \
+            pc += 2;                                            \
+            DISPATCH();                                         \
+        } while (1)
+
+    // For helpers that read or change the program counter
+    #define CALL_WITH_PC(call)                                  \
+        do {                                                    \
+            chip->PC = pc;                                      \
+            call;                                               \
+            pc = chip->PC;                                      \
+        } while (0)
+
+    NEXT();
+
+#if !defined(__GNUC__)
+dispatch:
+    switch (ins.op) {
+#endif
+    HANDLER(op_undecoded, OP_UNDECODED)
+        ins = decodeInstruction(chip, pc - 2);
+        decoded[pc - 2] = ins;
+        DISPATCH();
+    HANDLER(op_nop, OP_NOP)
+        NEXT();
+    HANDLER(op_hires_init, OP_HIRES_INIT)
+        setScreenMode(chip, 1);
+        pc = 0x2C0;
+        NEXT();
+    HANDLER(op_00e0, OP_00E0)
+        clearScreen(chip);
+        NEXT();
+    HANDLER(op_00ee, OP_00EE)
+        pc = popFromStack(chip);
+        NEXT();
+    HANDLER(op_00cn, OP_00CN)
+        if (chip->superchip_instructions_set) {
+            scrollDisplayDownN(chip, ins.nn & 0xF);
+        }
+        NEXT();
+    HANDLER(op_00dn, OP_00DN)
+        if (chip->xochip_instructions_set) {
+            scrollDisplayUpN(chip, ins.nn & 0xF);
+        }
+        NEXT();
+    HANDLER(op_00fb, OP_00FB)
+        if (chip->superchip_instructions_set) {
+            scrollDisplayRight(chip);
+        }
+        NEXT();
+    HANDLER(op_00fc, OP_00FC)
+        if (chip->superchip_instructions_set) {
+            scrollDisplayLeft(chip);
+        }
+        NEXT();
+    HANDLER(op_00fd, OP_00FD)
+        if (chip->superchip_instructions_set) {
+            chip->halted = true;
+            chip->PC = pc;
+            return;
+        }
+        NEXT();
+    HANDLER(op_00fe, OP_00FE)
+        if (chip->superchip_instructions_set) {
+            setScreenMode(chip, 0);
+        }
+        NEXT();
+    HANDLER(op_00ff, OP_00FF)
+        if (chip->superchip_instructions_set) {
+            setScreenMode(chip, 2);
+        }
+        NEXT();
+    HANDLER(op_1nnn, OP_1NNN)
+        pc = (ins.x << 8) | ins.nn;
+        NEXT();
+    HANDLER(op_2nnn, OP_2NNN)
+        pushToStack(chip, pc);
+        pc = (ins.x << 8) | ins.nn;
+        NEXT();
+    HANDLER(op_3xnn, OP_3XNN)
+        if (V[ins.x] == ins.nn) {
+            pc += instructionSize(chip, pc);
+        }
+        NEXT();
+    HANDLER(op_4xnn, OP_4XNN)
+        if (V[ins.x] != ins.nn) {
+            pc += instructionSize(chip, pc);
+        }
+        NEXT();
+    HANDLER(op_5xy0, OP_5XY0)
+        if (V[ins.x] == V[ins.y]) {
+            pc += instructionSize(chip, pc);
+        }
+        NEXT();
+    HANDLER(op_5xy2, OP_5XY2)
+        if (chip->xochip_instructions_set) {
+            storeRegisterRange(chip, ins.x, ins.y);
+        }
+        NEXT();
+    HANDLER(op_5xy3, OP_5XY3)
+        if (chip->xochip_instructions_set) {
+            loadRegisterRange(chip, ins.x, ins.y);
+        }
+        NEXT();
+    HANDLER(op_6xnn, OP_6XNN)
+        V[ins.x] = ins.nn;
+        NEXT();
+    HANDLER(op_7xnn, OP_7XNN)
+        V[ins.x] += ins.nn;
+        NEXT();
+    HANDLER(op_8xy0, OP_8XY0)
+        V[ins.x] = V[ins.y];
+        NEXT();
+    HANDLER(op_8xy1, OP_8XY1)
+        orVxVy(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy2, OP_8XY2)
+        andVxVy(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy3, OP_8XY3)
+        xorVxVy(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy4, OP_8XY4)
+        addVxVy(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy5, OP_8XY5)
+        subtractVxVy(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy6, OP_8XY6)
+        shiftVxRight(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xy7, OP_8XY7)
+        subtractVyVx(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_8xye, OP_8XYE)
+        shiftVxLeft(chip, ins.x, ins.y);
+        NEXT();
+    HANDLER(op_9xy0, OP_9XY0)
+        if (V[ins.x] != V[ins.y]) {
+            pc += instructionSize(chip, pc);
+        }
+        NEXT();
+    HANDLER(op_annn, OP_ANNN)
+        chip->I = (ins.x << 8) | ins.nn;
+        NEXT();
+    HANDLER(op_bnnn, OP_BNNN)
+        if (chip->superchip_offset_jump) {
+            CALL_WITH_PC(offsetJumpSC(chip, ins.x, ins.nn));
+        } else {
+            CALL_WITH_PC(offsetJump(chip, (ins.x << 8) | ins.nn));
+        }
+        NEXT();
+    HANDLER(op_cxnn, OP_CXNN)
+        randomNNToVx(chip, ins.x, ins.nn);
+        NEXT();
+    HANDLER(op_dxyn, OP_DXYN)
+        if ((ins.nn & 0xF) == 0 && chip->superchip_instructions_set) {
+            drawHighRes(chip, ins.x, ins.y);
+        } else {
+            draw(chip, ins.x, ins.y, ins.nn & 0xF);
+        }
+        NEXT();
+    HANDLER(op_ex9e, OP_EX9E)
+        CALL_WITH_PC(skipIfKeyPressed(chip, ins.x));
+        NEXT();
+    HANDLER(op_exa1, OP_EXA1)
+        CALL_WITH_PC(skipIfKeyNotPressed(chip, ins.x));
+        NEXT();
+    HANDLER(op_f000, OP_F000)
+        if (chip->xochip_instructions_set) {
+            CALL_WITH_PC(setILong(chip));
+        }
+        NEXT();
+    HANDLER(op_fn01, OP_FN01)
+        if (chip->xochip_instructions_set) {
+            selectPlanes(chip, ins.x);
+        }
+        NEXT();
+    HANDLER(op_f002, OP_F002)
+        if (chip->xochip_instructions_set) {
+            loadAudioPattern(chip);
+        }
+        NEXT();
+    HANDLER(op_fx07, OP_FX07)
+        V[ins.x] = chip->delay_timer;
+        NEXT();
+    HANDLER(op_fx0a, OP_FX0A)
+        CALL_WITH_PC(getKey(chip, ins.x));
+        NEXT();
+    HANDLER(op_fx15, OP_FX15)
+        chip->delay_timer = V[ins.x];
+        NEXT();
+    HANDLER(op_fx18, OP_FX18)
+        chip->sound_timer = V[ins.x];
+        NEXT();
+    HANDLER(op_fx1e, OP_FX1E)
+        addToI(chip, ins.x);
+        NEXT();
+    HANDLER(op_fx29, OP_FX29)
+        if (chip->currently_loaded_font_type != 0) {
+            setFontType(chip, 0);
+        }
+        setIToLowResFontChar(chip, ins.x);
+        NEXT();
+    HANDLER(op_fx30, OP_FX30)
+        if (chip->superchip_instructions_set) {
+            if (chip->currently_loaded_font_type == 0) {
+                setFontType(chip, 1);
+            }
+            setIToHighResFontChar(chip, ins.x);
+        }
+        NEXT();
+    HANDLER(op_fx33, OP_FX33)
+        binCodedDecimalConversion(chip, ins.x);
+        NEXT();
+    HANDLER(op_fx3a, OP_FX3A)
+        if (chip->xochip_instructions_set) {
+            chip->pitch = V[ins.x];
+        }
+        NEXT();
+    HANDLER(op_fx55, OP_FX55)
+        storeRegistersInMemory(chip, ins.x);
+        NEXT();
+    HANDLER(op_fx65, OP_FX65)
+        loadRegistersFromMemory(chip, ins.x);
+        NEXT();
+    HANDLER(op_fx75, OP_FX75)
+        if (chip->superchip_instructions_set) {
+            saveRegStateToLocalStorage(chip, ins.x);
+        }
+        NEXT();
+    HANDLER(op_fx85, OP_FX85)
+        if (chip->superchip_instructions_set) {
+            loadRegStateFromLocalStorage(chip, ins.x);
+        }
+        NEXT();
+#if !defined(__GNUC__)
+    }
+#endif
+
+    #undef CALL_WITH_PC
+    #undef NEXT
+    #undef DISPATCH
+    #undef HANDLER
+}
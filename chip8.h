@@ -0,0 +1,291 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MEMORY_SIZE         65536 // XO-CHIP address space
+#define LEGACY_MEMORY_SIZE  4096 // CHIP-8 and SUPER-CHIP addresses wrap at this
+#define MEMORY_PAGE_SIZE    (MEMORY_SIZE / 64) // Unit of Chip8.dirty_pages
+#define STACK_SIZE          16
+#define TIMER_SPEED         60
+#define FONT_MEM_LOC        0x0
+#define PROGRAM_START       0x200
+#define KEYS_NUM            16
+#define SCREEN_MAX_W        128
+#define SCREEN_MAX_H        64
+#define SCREEN_ROW_WORDS    (SCREEN_MAX_W / 64)
+#define SCREEN_PLANES       4 // XO-CHIP bit planes, the others draw on plane 0 only
+#define AUDIO_PATTERN_SIZE  16 // Bytes of the XO-CHIP audio pattern, 128 1-bit samples
+#define FLAG_REGISTERS      16 // RPL user flags of FX75/FX85, SUPER-CHIP uses the first 8
+#define OPCODE_KINDS        53 // Entries of Chip8.opcode_counts, see opcodeKindName()
+#define OPCODE_KIND_INVALID 1 // Entry of 0NNN and of opcodes that aren't instructions
+
+// One pre-decoded instruction slot, see setDecodeCache()
+typedef struct
+{
+    uint8_t op; // Handler index, 0 - not decoded yet
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn; // Low byte of the opcode (N is nn & 0xF, NNN is x << 8 | nn)
+} DecodedInstruction;
+
+enum { HEATMAP_READ, HEATMAP_WRITE, HEATMAP_EXECUTE, HEATMAP_CHANNELS };
+
+// Optional record of memory accesses. Each byte keeps the tick of its last read,
+// write and execution (0 - never), so nothing has to fade in the background and
+// the frontend computes brightness only for the bytes it shows.
+typedef struct
+{
+    uint32_t ticks; // Timer ticks since reset, starts at 1 and advances in tickTimers()
+    uint32_t last_access[HEATMAP_CHANNELS][MEMORY_SIZE];
+} MemoryHeatmap;
+
+// Running totals for the metrics overlay, never reset or saved, readers take differences
+typedef struct
+{
+    uint64_t frames; // runFrame() calls
+    uint64_t draws; // DXYN and DXY0
+    uint64_t collisions; // Draws that erased a pixel
+    uint64_t clears; // 00E0 and resolution switches
+    uint64_t scrolls; // 00CN, 00DN, 00FB, 00FC
+    uint64_t key_wait_frames; // Frames that ended waiting in FX0A
+    uint64_t stack_faults; // Calls on a full stack and returns on an empty one
+} MachineCounters;
+
+// Quirks one by one, setQuirks() sets the combinations of the platforms
+enum
+{
+    QUIRK_SHIFT = 1 << 0,
+    QUIRK_OFFSET_JUMP = 1 << 1,
+    QUIRK_REG_MEM_LOAD = 1 << 2,
+    QUIRK_NO_RESET_VF = 1 << 3,
+    QUIRK_WRAP = 1 << 4,
+    QUIRK_COMBINATIONS = 1 << 5
+};
+
+// Complete state of one emulated machine, nothing in the core lives outside of it.
+// Registers and flags touched on every cycle are packed into the first cache line,
+// memory and screen start on their own lines.
+typedef struct
+{
+    uint8_t V[16]; // General-purpose varibale registers (0-F)
+    uint16_t I; // Index register (points to memory locations)
+    uint16_t PC; // Program Counter register
+    uint8_t sp; // Number of addresses on the stack
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t screen_w;
+    uint8_t screen_h;
+    uint8_t currently_loaded_font_type; // 0 - lowres, 1 - hires
+    uint8_t planes; // Bit N selects plane N for drawing, clearing and scrolling (FN01), 1 outside XO-CHIP
+    uint16_t keys; // Keypad state, bit N is set while key N is held
+    int8_t key_released_this_cycle; // Key released since the last poll (for FX0A), -1 if none
+    bool waiting_for_key;
+    bool is_rom_loaded;
+    bool halted; // Set by 00FD, nothing runs until resetState()
+    uint32_t rng_state; // xorshift32 state behind CXNN, never 0, see seedRandom()
+    uint32_t frame_count; // Frames run by runFrame() since resetState()
+
+    // Configuration variables related to quirks of superchip
+    bool superchip_shift;
+    bool superchip_offset_jump;
+    bool superchip_reg_mem_load;
+    bool superchip_no_reset_vf_on_bit_ops;
+    bool wrap_sprites; // Sprites continue on the other side of the screen instead of being clipped at its edges
+    bool superchip_instructions_set; // Additional instructions for superchip
+    bool xochip_instructions_set; // XO-CHIP on top of them, with all of MEMORY_SIZE addressable
+
+    // XO-CHIP sound: while the sound timer runs, the pattern is played at 4000 * 2 ^ ((pitch - 64) / 48)
+    // samples per second. Until F002 loads one the plain beep is used.
+    bool audio_pattern_loaded;
+    uint8_t pitch;
+    uint8_t audio_pattern[AUDIO_PATTERN_SIZE];
+
+    // Written by FX75 and read by FX85, nothing in the core keeps them past a ROM load.
+    // The frontend stores them per ROM, see flagstore.h.
+    uint8_t flag_registers[FLAG_REGISTERS];
+
+    MemoryHeatmap *memory_heatmap; // Optional, NULL if nobody displays it
+    DecodedInstruction *decoded; // Optional decode cache, one slot per memory address
+    struct JitCache *jit; // Optional x86-64 block compiler, see jit.h
+    const uint8_t *code_map; // Optional MEMORY_SIZE flags of bytes compiled ahead of time (tools/rom2c.c)
+    bool code_modified; // Set when the core writes a byte flagged in code_map
+    uint32_t *opcode_counts; // Optional OPCODE_KINDS counters of executed instructions, bypasses the JIT
+    struct Profiler *profiler; // Optional per-PC and per-subroutine cycle counts, see profiler.h, bypasses the JIT
+    uint64_t dirty_rows; // Bit y is set when screen row y changed, the frontend clears it after redrawing
+    uint64_t dirty_pages; // Bit N is set when a byte of memory page N (MEMORY_PAGE_SIZE bytes) changed, cleared by whoever copies memory out
+    uint64_t idle_cycles; // Instructions runFrame() accounted for without running them, see idleLoopLength()
+    MachineCounters counters;
+
+    uint16_t stack[STACK_SIZE]; // 16-bit stack of memory addresses
+
+    const char *message_title; // Set when the core wants to notify the user,
+    const char *message;       // frontend shows it and resets both to NULL
+
+    // One bit per pixel and plane, pixel x of row y is bit 63 - x % 64 of screen[plane][y][x / 64].
+    // Bits past screen_w and rows past screen_h are always 0.
+    _Alignas(64) uint64_t screen[SCREEN_PLANES][SCREEN_MAX_H][SCREEN_ROW_WORDS];
+
+    // Memory last, so that everything else can be copied without it. CHIP-8 and SUPER-CHIP keep their
+    // 4 KB inside the machine, XO-CHIP's 64 KB are allocated when it's turned on (see setInstructions()).
+    uint8_t *memory; // addressSpace() bytes, xochip_memory while XO-CHIP is on and legacy_memory otherwise
+    uint8_t *xochip_memory; // MEMORY_SIZE bytes once XO-CHIP was on, kept until releaseChip8()
+    _Alignas(64) uint8_t legacy_memory[LEGACY_MEMORY_SIZE];
+} Chip8;
+
+// Color index of a pixel, bit N is its bit in plane N (0 or 1 outside XO-CHIP)
+static inline uint8_t getPixel(const Chip8 *chip, uint8_t x, uint8_t y) {
+    uint8_t shift = 63 - (x & 63);
+    return ((chip->screen[0][y][x >> 6] >> shift) & 1)
+        | ((chip->screen[1][y][x >> 6] >> shift) & 1) << 1
+        | ((chip->screen[2][y][x >> 6] >> shift) & 1) << 2
+        | ((chip->screen[3][y][x >> 6] >> shift) & 1) << 3;
+}
+
+// Bytes the machine can address, the 12-bit CHIP-8 space unless XO-CHIP is on
+static inline uint32_t addressSpace(const Chip8 *chip) {
+    return chip->xochip_instructions_set ? MEMORY_SIZE : LEGACY_MEMORY_SIZE;
+}
+
+// Bytes of the instruction at addr, which is 4 only for XO-CHIP's F000 NNNN. Skips jump over all of it.
+static inline uint8_t instructionSize(const Chip8 *chip, uint16_t addr) {
+    return chip->xochip_instructions_set && chip->memory[addr] == 0xF0 && chip->memory[(uint16_t)(addr + 1)] == 0x00 ? 4 : 2;
+}
+
+// Allocates a zeroed, cache-aligned machine, resetState(chip, 2) is still needed
+Chip8 *createChip8(void);
+void destroyChip8(Chip8 *chip);
+// Same for a machine that lives somewhere else (static or inside another struct)
+void initChip8(Chip8 *chip);
+// Frees XO-CHIP's memory, the machine is left with its first 4 KB and XO-CHIP off
+void releaseChip8(Chip8 *chip);
+
+// Turns the pre-decoded interpreter on or off, returns false if allocation failed.
+// Memory writes done by the core invalidate the affected slots by themselves.
+bool setDecodeCache(Chip8 *chip, bool enabled);
+
+// Mnemonic of an opcode_counts entry ("DXYN", "FX33", ...)
+const char *opcodeKindName(uint8_t kind);
+
+bool isStackEmpty(const Chip8 *chip);
+bool isStackFull(const Chip8 *chip);
+void pushToStack(Chip8 *chip, uint16_t value);
+uint16_t popFromStack(Chip8 *chip);
+
+// ROMs have to fit the address space, so XO-CHIP has to be on before loading a big one
+bool loadROM(Chip8 *chip, const char *path);
+// Same as loadROM() for a ROM that's already in memory (embedded or generated)
+bool loadROMFromMemory(Chip8 *chip, const uint8_t *data, size_t size);
+
+#define SAVE_STATE_VERSION  2
+#define SAVE_STATE_MAX_PATH 1024
+#define SAVE_STATE_FIXED_SIZE (12 + 16 + 4 + 6 + 2 + 8 + 2 * STACK_SIZE + LEGACY_MEMORY_SIZE) // Without the screen and the path
+#define SAVE_STATE_XOCHIP_SIZE (3 + AUDIO_PATTERN_SIZE + MEMORY_SIZE - LEGACY_MEMORY_SIZE) // Added by XO-CHIP machines, without the other planes
+#define SAVE_STATE_MAX_SIZE (SAVE_STATE_FIXED_SIZE + SAVE_STATE_XOCHIP_SIZE + FLAG_REGISTERS + SCREEN_PLANES * SCREEN_MAX_W * SCREEN_MAX_H / 8 + SAVE_STATE_MAX_PATH)
+
+// Writes the whole machine in the versioned save state format (layout in chip8.c) and returns
+// its size, at most SAVE_STATE_MAX_SIZE. rom_path (may be NULL) is stored along for reloading.
+size_t saveState(const Chip8 *chip, const char *rom_path, uint8_t *buffer);
+// Restores a state written by saveState(). A state that's invalid or from another version
+// leaves the machine untouched and sets the message. rom_path may be NULL, otherwise it's
+// pointed at the stored path inside buffer, which isn't 0-terminated.
+bool loadState(Chip8 *chip, const uint8_t *buffer, size_t size, const char **rom_path, size_t *rom_path_length);
+bool saveStateToFile(const Chip8 *chip, const char *rom_path, const char *path);
+// The file is memory-mapped where possible. *rom_path (may be NULL) is reallocated to hold the stored path.
+bool loadStateFromFile(Chip8 *chip, const char *path, char **rom_path);
+
+// Copies the machine into `snapshot` for restoreMachine(), far cheaper than a save state. Memory is
+// only copied in `pages` (bit N - page N), the other pages have to match the last snapshot into it.
+// All of it is copied when the address space changed since then. The snapshot (initialized or zeroed)
+// gets memory for XO-CHIP as needed, false if that allocation failed. Free it with releaseChip8().
+bool snapshotMachine(Chip8 *snapshot, const Chip8 *chip, uint64_t pages);
+// Takes the machine back to `snapshot`, `pages` has to include every page written since it was taken
+// and the address space has to be the same.
+// Pages that differ lose their decoded and compiled code, changed rows and pages are added to the dirty ones.
+void restoreMachine(Chip8 *chip, const Chip8 *snapshot, uint64_t pages);
+
+// Instructions
+void clearScreen(Chip8 *chip);                                              // 00E0
+void returnFromSubRoutine(Chip8 *chip);                                     // 00EE
+void scrollDisplayDownN(Chip8 *chip, uint8_t N);                            // 00CN
+void scrollDisplayUpN(Chip8 *chip, uint8_t N);                              // 00DN
+void scrollDisplayRight(Chip8 *chip);                                       // 00FB
+void scrollDisplayLeft(Chip8 *chip);                                        // 00FC
+void jump(Chip8 *chip, uint16_t addr);                                      // 1NNN
+void execSubroutine(Chip8 *chip, uint16_t addr);                            // 2NNN
+void skipIfVxEqNN(Chip8 *chip, uint8_t reg_index, uint8_t num);             // 3XNN
+void skipIfVxNotEqNN(Chip8 *chip, uint8_t reg_index, uint8_t num);          // 4XNN
+void skipIfVxEqVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);     // 5XY0
+void storeRegisterRange(Chip8 *chip, uint8_t regx_index, uint8_t regy_index); // 5XY2
+void loadRegisterRange(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);  // 5XY3
+void setVXNN(Chip8 *chip, uint8_t reg_index, uint8_t num);                  // 6XNN
+void addNNToVX(Chip8 *chip, uint8_t reg_index, uint8_t num);                // 7XNN
+void setVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);          // 8XY0
+void orVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);           // 8XY1
+void andVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);          // 8XY2
+void xorVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);          // 8XY3
+void addVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);          // 8XY4
+void subtractVxVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);     // 8XY5
+void shiftVxRight(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);     // 8XY6
+void subtractVyVx(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);     // 8XY7
+void shiftVxLeft(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);      // 8XYE
+void skipIfVXNotEqVy(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);  // 9XY0
+void setINNN(Chip8 *chip, uint16_t addr);                                   // ANNN
+void offsetJump(Chip8 *chip, uint16_t addr);                                // BNNN
+void offsetJumpSC(Chip8 *chip, uint8_t reg_index, uint8_t addr);            // BXNN
+void randomNNToVx(Chip8 *chip, uint8_t reg_index, uint8_t num);             // CXNN
+void drawHighRes(Chip8 *chip, uint8_t regx_index, uint8_t regy_index);      // DXY0
+void draw(Chip8 *chip, uint8_t regx_index, uint8_t regy_index, uint8_t length); // DXYN
+void skipIfKeyPressed(Chip8 *chip, uint8_t reg_index);                      // EX9E
+void skipIfKeyNotPressed(Chip8 *chip, uint8_t reg_index);                   // EXA1
+void setILong(Chip8 *chip);                                                 // F000 NNNN
+void selectPlanes(Chip8 *chip, uint8_t planes);                             // FN01
+void loadAudioPattern(Chip8 *chip);                                         // F002
+void setVxToDTimer(Chip8 *chip, uint8_t reg_index);                         // FX07
+void getKey(Chip8 *chip, uint8_t reg_index);                                // FX0A
+void setDTimerToVx(Chip8 *chip, uint8_t reg_index);                         // FX15
+void setSTimerToVx(Chip8 *chip, uint8_t reg_index);                         // FX18
+void addToI(Chip8 *chip, uint8_t reg_index);                                // FX1E
+void setIToLowResFontChar(Chip8 *chip, uint8_t reg_index);                  // FX29
+void setIToHighResFontChar(Chip8 *chip, uint8_t reg_index);                 // FX30
+void binCodedDecimalConversion(Chip8 *chip, uint8_t reg_index);             // FX33
+void setPitch(Chip8 *chip, uint8_t reg_index);                              // FX3A
+void storeRegistersInMemory(Chip8 *chip, uint8_t reg_index);                // FX55
+void loadRegistersFromMemory(Chip8 *chip, uint8_t reg_index);               // FX65
+void saveRegStateToLocalStorage(Chip8 *chip, uint8_t reg_index);            // FX75
+void loadRegStateFromLocalStorage(Chip8 *chip, uint8_t reg_index);          // FX85
+
+void setQuirks(Chip8 *chip, uint8_t type);
+// QUIRK_* flags setQuirks(chip, type) sets
+uint8_t platformQuirks(uint8_t type);
+void setQuirkFlags(Chip8 *chip, uint8_t quirks);
+uint8_t quirkFlags(const Chip8 *chip);
+void setScreenMode(Chip8 *chip, uint8_t type);
+// Returns false and keeps the instructions if XO-CHIP's memory couldn't be allocated (the message is set)
+bool setInstructions(Chip8 *chip, uint8_t type);
+void setFontType(Chip8 *chip, uint8_t type);
+void resetState(Chip8 *chip, uint8_t type);
+// CXNN draws from a per-machine generator, the same seed gives the same numbers.
+// resetState(chip, 2) seeds it with a fixed value.
+void seedRandom(Chip8 *chip, uint32_t seed);
+
+// Decrements delay and sound timers, call TIMER_SPEED times per second
+void tickTimers(Chip8 *chip);
+
+// Fetch / Decode / Execute Loop
+void stepOneСycle(Chip8 *chip);
+
+// Executes the given number of instructions, through the JIT or the decode cache if enabled
+void runCycles(Chip8 *chip, uint32_t cycles);
+
+// Runs one TIMER_SPEED-th of a second at cpu_speed instructions per second: the instructions
+// (the remainder of cpu_speed / TIMER_SPEED spread over the frames by frame_count) and one timer tick.
+// Depends on nothing but the machine, so the same state and keys always give the same frame.
+// Idle loops waiting for a key or the delay timer are skipped to the end of the frame (not while
+// opcode_counts or a profiler is attached), leaving the machine exactly where running them would have.
+// Returns the number of instructions.
+uint32_t runFrame(Chip8 *chip, uint32_t cpu_speed);
+
+#endif
@@ -0,0 +1,426 @@
+#define _DEFAULT_SOURCE // clock_gettime(), nanosleep()
+#include "emuthread.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TURBO_SLICE 0.008 // Seconds of turbo emulation between published frames
+#define MAX_LAG_FRAMES 6 // Frames the scheduler catches up on before giving up on them
+#define IPS_WINDOW 0.5 // Seconds the IPS readout is averaged over
+#define FRAME_FRESH 4 // Set in `middle` while the reader hasn't taken that frame
+
+struct EmuThread
+{
+    EmuFrame frames[3];
+    // Triple buffer: the thread fills frames[back], the reader holds frames[front] and
+    // `middle` is the newest finished one. Each side swaps its frame with the middle one.
+    _Atomic uint8_t middle;
+    uint8_t back;
+    uint8_t front;
+
+    Chip8 *chip;
+    RewindBuffer *rewind;
+    Movie *movie;
+    pthread_t thread;
+    pthread_mutex_t lock; // Held while the machine runs
+    _Atomic uint32_t lock_waiters;
+    _Atomic bool stopping;
+
+    _Atomic uint32_t cpu_speed;
+    _Atomic bool turbo;
+    _Atomic bool paused;
+    _Atomic uint32_t pending_steps;
+    _Atomic bool rewinding;
+    _Atomic uint16_t keys_held;
+    _Atomic uint16_t keys_released;
+    _Atomic uint16_t heatmap_start;
+    uint64_t stale_pages[3]; // Memory pages each frame is missing, see Chip8.dirty_pages
+
+    _Atomic uint8_t run_ahead;
+    Chip8 snapshot; // Machine to go back to after running ahead
+    uint64_t snapshot_stale; // Memory pages the snapshot is missing
+    double snapshot_time; // Host time spent on snapshots and restores in the current IPS window
+    double restore_time;
+    uint32_t snapshots;
+    double snapshot_seconds; // Averages over the last IPS window
+    double restore_seconds;
+
+    double emulation_seconds;
+    uint64_t timer_underruns;
+    uint32_t published; // Frames published so far
+    _Atomic uint32_t sound_state; // Low 8 bits: sound timer, the rest: `published` when it was stored
+    _Atomic uint32_t audio_pattern[AUDIO_PATTERN_SIZE / 4];
+    _Atomic uint16_t audio_pitch; // Low 8 bits: pitch, bit 8: the pattern was loaded
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepFor(double seconds) {
+    struct timespec ts = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&ts, NULL);
+}
+
+// Memory is only copied a page at a time where it changed since the frame was last filled.
+// Returns false if the frame couldn't get memory for XO-CHIP.
+static bool copyMachine(EmuThread *emu, EmuFrame *frame) {
+    Chip8 *chip = emu->chip;
+    for (uint8_t i = 0; i < 3; ++i) {
+        emu->stale_pages[i] |= chip->dirty_pages;
+    }
+    emu->snapshot_stale |= chip->dirty_pages;
+    chip->dirty_pages = 0;
+    uint64_t *stale = &emu->stale_pages[frame - emu->frames];
+    if (!snapshotMachine(&frame->chip, chip, *stale)) {
+        return false;
+    }
+    *stale = 0;
+
+    MemoryHeatmap *heatmap = chip->memory_heatmap;
+    uint16_t start = atomic_load_explicit(&emu->heatmap_start, memory_order_relaxed);
+    if (start > MEMORY_SIZE - EMU_HEATMAP_WINDOW) {
+        start = MEMORY_SIZE - EMU_HEATMAP_WINDOW;
+    }
+    frame->heatmap_start = start;
+    frame->heatmap_ticks = heatmap ? heatmap->ticks : 0;
+    for (uint8_t channel = 0; channel < HEATMAP_CHANNELS; ++channel) {
+        if (heatmap != NULL) {
+            memcpy(frame->heatmap_window[channel], heatmap->last_access[channel] + start, sizeof(frame->heatmap_window[channel]));
+        } else {
+            memset(frame->heatmap_window[channel], 0, sizeof(frame->heatmap_window[channel]));
+        }
+    }
+
+    for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE / 4; ++i) {
+        const uint8_t *bytes = chip->audio_pattern + i * 4;
+        uint32_t word = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+        atomic_store_explicit(&emu->audio_pattern[i], word, memory_order_relaxed);
+    }
+    atomic_store_explicit(&emu->audio_pitch, chip->pitch | chip->audio_pattern_loaded << 8, memory_order_relaxed);
+    return true;
+}
+
+// Copies the machine into the back frame and swaps it with the middle one. If the reader
+// skipped the frame that comes back, its dirty rows are kept for the next one.
+// Returns false if the frame couldn't be copied, the reader keeps the previous one then.
+static bool publishFrame(EmuThread *emu, double ips, uint8_t run_ahead) {
+    EmuFrame *frame = &emu->frames[emu->back];
+    uint64_t dirty_rows = frame->dirty_rows | emu->chip->dirty_rows;
+    if (!copyMachine(emu, frame)) {
+        return false;
+    }
+    frame->dirty_rows = dirty_rows;
+    frame->ips = ips;
+    frame->emulation_seconds = emu->emulation_seconds;
+    frame->timer_underruns = emu->timer_underruns;
+    frame->rewind_frames = emu->rewind ? rewindFrameCount(emu->rewind) : 0;
+    frame->rewind_bytes = emu->rewind ? rewindBytesUsed(emu->rewind) : 0;
+    frame->movie_status = movieStatus(emu->movie);
+    frame->movie_frame = emu->movie ? movieFramesDone(emu->movie) : 0;
+    frame->run_ahead = run_ahead;
+    frame->snapshot_seconds = emu->snapshot_seconds;
+    frame->restore_seconds = emu->restore_seconds;
+    emu->chip->dirty_rows = 0;
+    ++emu->published;
+    atomic_store_explicit(&emu->sound_state, (emu->published << 8) | emu->chip->sound_timer, memory_order_relaxed);
+
+    uint8_t old = atomic_exchange_explicit(&emu->middle, emu->back | FRAME_FRESH, memory_order_acq_rel);
+    emu->back = old & 3;
+    if (!(old & FRAME_FRESH)) {
+        emu->frames[emu->back].dirty_rows = 0;
+    }
+    return true;
+}
+
+static void takeKeys(EmuThread *emu) {
+    uint16_t released = atomic_exchange_explicit(&emu->keys_released, 0, memory_order_relaxed);
+    emu->chip->keys = atomic_load_explicit(&emu->keys_held, memory_order_relaxed);
+    emu->chip->key_released_this_cycle = -1;
+    for (int8_t i = 0; i < KEYS_NUM; ++i) {
+        if ((released >> i) & 1) {
+            emu->chip->key_released_this_cycle = i;
+        }
+    }
+}
+
+static bool movieRunning(const EmuThread *emu) {
+    MovieStatus status = movieStatus(emu->movie);
+    return status == MOVIE_RECORDING || status == MOVIE_PLAYING;
+}
+
+// One runFrame() with the keys from the frontend, or from the movie being played
+static uint32_t emulateFrame(EmuThread *emu, uint32_t cpu_speed) {
+    takeKeys(emu);
+    if (movieRunning(emu)) {
+        movieFrame(emu->movie, emu->chip, &cpu_speed);
+    }
+    return runFrame(emu->chip, cpu_speed);
+}
+
+// Runs one frame, or as many as fit in TURBO_SLICE, returns the number of instructions
+static uint64_t runSlice(EmuThread *emu) {
+    Chip8 *chip = emu->chip;
+    uint32_t cpu_speed = atomic_load_explicit(&emu->cpu_speed, memory_order_relaxed);
+    uint64_t executed = 0;
+    if (atomic_load_explicit(&emu->paused, memory_order_relaxed)) {
+        if (movieRunning(emu)) {
+            return 0; // Single steps don't belong to any frame, a movie can only wait
+        }
+        takeKeys(emu);
+        for (uint32_t steps = atomic_exchange(&emu->pending_steps, 0); steps > 0; --steps) {
+            stepOneСycle(chip);
+            ++executed;
+        }
+        tickTimers(chip);
+    } else if (atomic_load_explicit(&emu->turbo, memory_order_relaxed)) {
+        double deadline = now() + TURBO_SLICE;
+        do {
+            for (uint8_t i = 0; i < 16 && !chip->halted; ++i) { // The clock isn't read after every frame
+                executed += emulateFrame(emu, cpu_speed);
+            }
+        } while (!chip->halted && chip->message == NULL && now() < deadline);
+    } else {
+        executed = emulateFrame(emu, cpu_speed);
+    }
+    return executed;
+}
+
+// Publishes the machine `frames` frames from now, as far as the keys held now tell, and takes it back.
+// The heatmap, opcode counts and profiler are left out of those frames, and counters, flags, halts
+// and messages from them never reach the frontend, they may never happen.
+static void runAhead(EmuThread *emu, uint8_t frames, double ips) {
+    Chip8 *chip = emu->chip;
+    Chip8 *snapshot = &emu->snapshot;
+    double start = now();
+    if (!snapshotMachine(snapshot, chip, emu->snapshot_stale | chip->dirty_pages)) {
+        publishFrame(emu, ips, 0); // No memory for an XO-CHIP snapshot, the machine just doesn't run ahead
+        return;
+    }
+    emu->snapshot_time += now() - start;
+
+    uint32_t cpu_speed = atomic_load_explicit(&emu->cpu_speed, memory_order_relaxed);
+    chip->memory_heatmap = NULL;
+    chip->opcode_counts = NULL;
+    chip->profiler = NULL;
+    chip->key_released_this_cycle = -1; // The current frame took the release
+    for (uint8_t i = 0; i < frames && !chip->halted; ++i) {
+        runFrame(chip, cpu_speed);
+    }
+    chip->memory_heatmap = snapshot->memory_heatmap;
+    chip->opcode_counts = snapshot->opcode_counts;
+    chip->profiler = snapshot->profiler;
+    chip->counters = snapshot->counters;
+    memcpy(chip->flag_registers, snapshot->flag_registers, FLAG_REGISTERS);
+    chip->halted = snapshot->halted; // A 00FD or an error up ahead may never happen either
+    chip->message_title = snapshot->message_title;
+    chip->message = snapshot->message;
+    uint64_t written = chip->dirty_pages;
+    publishFrame(emu, ips, frames);
+
+    start = now();
+    restoreMachine(chip, snapshot, written);
+    emu->snapshot_stale = 0; // Memory is back to the snapshot's
+    emu->restore_time += now() - start;
+    ++emu->snapshots;
+}
+
+static void *emulationMain(void *arg) {
+    EmuThread *emu = arg;
+    double next_frame = now();
+    double ips_window_start = next_frame;
+    uint64_t ips_window_instructions = 0;
+    double ips = 0.0;
+
+    while (!atomic_load(&emu->stopping)) {
+        pthread_mutex_lock(&emu->lock);
+        double slice_start = now();
+        bool rewinding = emu->rewind != NULL && atomic_load_explicit(&emu->rewinding, memory_order_relaxed) && !movieRunning(emu);
+        if (rewinding) {
+            rewindFrame(emu->rewind, emu->chip);
+        } else {
+            uint64_t executed = runSlice(emu);
+            ips_window_instructions += executed;
+            if (emu->rewind != NULL && executed > 0 && emu->chip->is_rom_loaded) {
+                captureRewindFrame(emu->rewind, emu->chip);
+            }
+        }
+        double current_time = now();
+        emu->emulation_seconds += current_time - slice_start;
+        if (current_time - ips_window_start >= IPS_WINDOW) {
+            ips = ips_window_instructions / (current_time - ips_window_start);
+            ips_window_start = current_time;
+            ips_window_instructions = 0;
+            emu->snapshot_seconds = emu->snapshots ? emu->snapshot_time / emu->snapshots : 0.0;
+            emu->restore_seconds = emu->snapshots ? emu->restore_time / emu->snapshots : 0.0;
+            emu->snapshot_time = 0.0;
+            emu->restore_time = 0.0;
+            emu->snapshots = 0;
+        }
+        uint8_t run_ahead = atomic_load_explicit(&emu->run_ahead, memory_order_relaxed);
+        if (run_ahead > 0 && !rewinding && !atomic_load_explicit(&emu->paused, memory_order_relaxed)
+            && !atomic_load_explicit(&emu->turbo, memory_order_relaxed) && movieStatus(emu->movie) != MOVIE_PLAYING
+            && emu->chip->is_rom_loaded && !emu->chip->halted) {
+            runAhead(emu, run_ahead, ips);
+        } else {
+            publishFrame(emu, ips, 0);
+        }
+        pthread_mutex_unlock(&emu->lock);
+
+        // Mutexes aren't fair, without this a turbo run could keep the frontend out indefinitely
+        while (atomic_load(&emu->lock_waiters) > 0) {
+            sched_yield();
+        }
+
+        if (atomic_load_explicit(&emu->turbo, memory_order_relaxed) && !atomic_load_explicit(&emu->paused, memory_order_relaxed)) {
+            next_frame = now();
+            continue;
+        }
+        next_frame += 1.0 / TIMER_SPEED;
+        double wait = next_frame - now();
+        if (wait > 0) {
+            sleepFor(wait);
+        } else if (wait < -(double)MAX_LAG_FRAMES / TIMER_SPEED) {
+            emu->timer_underruns += (uint64_t)(-wait * TIMER_SPEED);
+            next_frame = now(); // Suspended or far too slow, drop the frames instead of rushing through them
+        } else if (wait < -0.5 / TIMER_SPEED) {
+            ++emu->timer_underruns;
+        }
+    }
+    return NULL;
+}
+
+// The frames and the snapshot may have XO-CHIP memory of their own
+static void freeEmuThread(EmuThread *emu) {
+    for (uint8_t i = 0; i < 3; ++i) {
+        releaseChip8(&emu->frames[i].chip);
+    }
+    releaseChip8(&emu->snapshot);
+#ifdef _WIN32
+    _aligned_free(emu);
+#else
+    free(emu);
+#endif
+}
+
+EmuThread *startEmuThread(Chip8 *chip, RewindBuffer *rewind) {
+#ifdef _WIN32
+    EmuThread *emu = _aligned_malloc(sizeof(EmuThread), _Alignof(EmuThread));
+#else
+    EmuThread *emu = aligned_alloc(_Alignof(EmuThread), sizeof(EmuThread));
+#endif
+    if (emu == NULL) {
+        return NULL;
+    }
+    memset(emu, 0, sizeof(EmuThread));
+    emu->chip = chip;
+    emu->rewind = rewind;
+    emu->front = 0;
+    atomic_init(&emu->middle, 1);
+    emu->back = 2;
+    for (uint8_t i = 0; i < 3; ++i) {
+        initChip8(&emu->frames[i].chip);
+    }
+    initChip8(&emu->snapshot);
+    memset(emu->stale_pages, 0xFF, sizeof(emu->stale_pages));
+    emu->snapshot_stale = UINT64_MAX;
+    pthread_mutex_init(&emu->lock, NULL);
+    // The reader always has a complete frame, even before the first one is emulated
+    if (!publishFrame(emu, 0.0, 0) || pthread_create(&emu->thread, NULL, emulationMain, emu) != 0) {
+        pthread_mutex_destroy(&emu->lock);
+        freeEmuThread(emu);
+        return NULL;
+    }
+    return emu;
+}
+
+void stopEmuThread(EmuThread *emu) {
+    if (emu == NULL) {
+        return;
+    }
+    atomic_store(&emu->stopping, true);
+    pthread_join(emu->thread, NULL);
+    pthread_mutex_destroy(&emu->lock);
+    freeEmuThread(emu);
+}
+
+void lockEmuThread(EmuThread *emu) {
+    atomic_fetch_add(&emu->lock_waiters, 1);
+    pthread_mutex_lock(&emu->lock);
+    atomic_fetch_sub(&emu->lock_waiters, 1);
+}
+
+void unlockEmuThread(EmuThread *emu) {
+    pthread_mutex_unlock(&emu->lock);
+}
+
+void setEmuSpeed(EmuThread *emu, uint32_t cpu_speed) {
+    atomic_store_explicit(&emu->cpu_speed, cpu_speed, memory_order_relaxed);
+}
+
+void setEmuTurbo(EmuThread *emu, bool turbo) {
+    atomic_store_explicit(&emu->turbo, turbo, memory_order_relaxed);
+}
+
+void setEmuPaused(EmuThread *emu, bool paused) {
+    atomic_store_explicit(&emu->paused, paused, memory_order_relaxed);
+}
+
+void stepEmuThread(EmuThread *emu) {
+    atomic_fetch_add(&emu->pending_steps, 1);
+}
+
+void setEmuMovie(EmuThread *emu, Movie *movie) {
+    emu->movie = movie;
+}
+
+void setEmuRunAhead(EmuThread *emu, uint8_t frames) {
+    atomic_store_explicit(&emu->run_ahead, frames < EMU_MAX_RUN_AHEAD ? frames : EMU_MAX_RUN_AHEAD, memory_order_relaxed);
+}
+
+void setEmuRewinding(EmuThread *emu, bool rewinding) {
+    atomic_store_explicit(&emu->rewinding, rewinding, memory_order_relaxed);
+}
+
+void setEmuKeys(EmuThread *emu, uint16_t held, uint16_t released) {
+    atomic_store_explicit(&emu->keys_held, held, memory_order_relaxed);
+    if (released != 0) {
+        atomic_fetch_or_explicit(&emu->keys_released, released, memory_order_relaxed);
+    }
+}
+
+void setEmuHeatmapWindow(EmuThread *emu, uint16_t start) {
+    atomic_store_explicit(&emu->heatmap_start, start, memory_order_relaxed);
+}
+
+uint8_t readEmuSoundTimer(EmuThread *emu, uint32_t *frame) {
+    uint32_t state = atomic_load_explicit(&emu->sound_state, memory_order_relaxed);
+    *frame = state >> 8;
+    return state & 0xFF;
+}
+
+bool readEmuAudioPattern(EmuThread *emu, uint8_t pattern[AUDIO_PATTERN_SIZE], uint8_t *pitch) {
+    uint16_t state = atomic_load_explicit(&emu->audio_pitch, memory_order_relaxed);
+    *pitch = state & 0xFF;
+    for (uint8_t i = 0; i < AUDIO_PATTERN_SIZE / 4; ++i) {
+        uint32_t word = atomic_load_explicit(&emu->audio_pattern[i], memory_order_relaxed);
+        for (uint8_t j = 0; j < 4; ++j) {
+            pattern[i * 4 + j] = word >> (j * 8);
+        }
+    }
+    return state >> 8;
+}
+
+const EmuFrame *acquireEmuFrame(EmuThread *emu, bool *is_new) {
+    *is_new = atomic_load_explicit(&emu->middle, memory_order_relaxed) & FRAME_FRESH;
+    if (*is_new) {
+        emu->front = atomic_exchange_explicit(&emu->middle, emu->front, memory_order_acq_rel) & 3;
+    }
+    return &emu->frames[emu->front];
+}
@@ -0,0 +1,83 @@
+#ifndef EMUTHREAD_H
+#define EMUTHREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "rewind.h"
+#include "movie.h"
+
+// Runs a Chip8 on its own thread, TIMER_SPEED frames per second of cpu_speed / TIMER_SPEED
+// instructions and one timer tick each, independently of how long the frontend takes to draw.
+// Finished frames go through a triple buffer, so reading the newest one never waits for the
+// emulation and the emulation never waits for the reader.
+
+#define EMU_HEATMAP_WINDOW 1024 // Bytes of the heatmap copied into every frame
+#define EMU_MAX_RUN_AHEAD 4 // Frames setEmuRunAhead() accepts at most
+
+// Copy of the machine after an emulated frame
+typedef struct
+{
+    Chip8 chip; // Has its own memory, other pointers inside it belong to the running machine and mustn't be followed
+    // Part of chip.memory_heatmap starting at heatmap_start (see setEmuHeatmapWindow()), zeroed if the machine has none
+    uint32_t heatmap_ticks;
+    uint16_t heatmap_start;
+    uint32_t heatmap_window[HEATMAP_CHANNELS][EMU_HEATMAP_WINDOW];
+    uint64_t dirty_rows; // Screen rows changed since the previous frame the reader got
+    double ips; // Instructions executed per second of real time
+    double emulation_seconds; // Host time spent emulating since the thread started
+    uint64_t timer_underruns; // Frames that started over half a frame late or were dropped to catch up
+    uint32_t rewind_frames; // Frames held by the rewind buffer
+    size_t rewind_bytes;
+    MovieStatus movie_status;
+    uint32_t movie_frame; // Frames recorded or played
+    uint8_t run_ahead; // Frames chip is ahead of the actual machine, see setEmuRunAhead()
+    // Average host time of one snapshotMachine() and one restoreMachine() while running ahead, 0 if it didn't lately
+    double snapshot_seconds;
+    double restore_seconds;
+} EmuFrame;
+
+typedef struct EmuThread EmuThread;
+
+// Starts emulating `chip`, which has to outlive the thread, as does `rewind` (optional, may be NULL),
+// which gets every frame that ran instructions. Returns NULL on failure.
+EmuThread *startEmuThread(Chip8 *chip, RewindBuffer *rewind);
+void stopEmuThread(EmuThread *emu);
+
+// Anything else touching the machine or the rewind buffer (loading ROMs, resets, quirks, JIT) has to happen
+// between these two, the emulation waits for at most one frame
+void lockEmuThread(EmuThread *emu);
+void unlockEmuThread(EmuThread *emu);
+
+void setEmuSpeed(EmuThread *emu, uint32_t cpu_speed);
+// Turbo runs frames back to back as fast as the host allows, timers still tick once per frame
+void setEmuTurbo(EmuThread *emu, bool turbo);
+// Records or plays `movie` (may be NULL) from the next frame on, needs lockEmuThread().
+// Rewinding and single steps are ignored while it runs. The movie stays owned by the caller.
+void setEmuMovie(EmuThread *emu, Movie *movie);
+// Paused machines only tick timers and run the instructions requested by stepEmuThread()
+void setEmuPaused(EmuThread *emu, bool paused);
+void stepEmuThread(EmuThread *emu);
+// While set, every frame steps one captured frame back instead of running
+void setEmuRewinding(EmuThread *emu, bool rewinding);
+// Each frame, snapshots the machine, emulates `frames` more with the keys held now and publishes those
+// instead, then restores it. The screen answers input that many frames sooner. The extra frames aren't
+// recorded, rewound, counted or profiled. Runs only at normal speed, not paused, rewinding or playing a movie.
+void setEmuRunAhead(EmuThread *emu, uint8_t frames);
+// Bit N of `held` is set while key N is down, `released` keys are kept until the next frame takes them
+void setEmuKeys(EmuThread *emu, uint16_t held, uint16_t released);
+// First address of the heatmap window copied into frames from the next one on
+void setEmuHeatmapWindow(EmuThread *emu, uint16_t start);
+
+// Sound timer after the newest emulated frame, safe to call from any thread (meant for the audio
+// callback, which shouldn't wait for the frontend to pick the frame up). `frame` changes with every frame.
+uint8_t readEmuSoundTimer(EmuThread *emu, uint32_t *frame);
+// XO-CHIP audio pattern and pitch after the newest frame, also for the audio callback.
+// Returns false if the machine never loaded a pattern. A pattern changing meanwhile may come out torn.
+bool readEmuAudioPattern(EmuThread *emu, uint8_t pattern[AUDIO_PATTERN_SIZE], uint8_t *pitch);
+
+// Newest finished frame, `is_new` tells if it wasn't returned before.
+// Never blocks, the frame stays valid until the next call.
+const EmuFrame *acquireEmuFrame(EmuThread *emu, bool *is_new);
+
+#endif
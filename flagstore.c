@@ -0,0 +1,169 @@
+#include "flagstore.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define MAX_PATH_LENGTH 4096
+
+typedef struct
+{
+    uint64_t hash;
+    uint8_t flags[FLAG_REGISTERS];
+    bool dirty; // Not written yet
+} RomFlags;
+
+struct FlagStore
+{
+    char *directory;
+    pthread_t thread;
+    pthread_mutex_t lock; // Guards everything below
+    pthread_cond_t changed;
+    RomFlags *roms;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t dirty_count;
+    bool stopping;
+};
+
+static void flagsPath(const FlagStore *store, uint64_t hash, char *path) {
+    snprintf(path, MAX_PATH_LENGTH, "%s/%016llx.rpl", store->directory, (unsigned long long)hash);
+}
+
+static void writeFlags(const FlagStore *store, uint64_t hash, const uint8_t flags[FLAG_REGISTERS]) {
+#ifdef _WIN32
+    _mkdir(store->directory);
+#else
+    mkdir(store->directory, 0777);
+#endif
+    char path[MAX_PATH_LENGTH];
+    flagsPath(store, hash, path);
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        fwrite(flags, 1, FLAG_REGISTERS, file);
+        fclose(file);
+    }
+}
+
+// Writes dirty entries one at a time without holding the lock during the I/O, so storing never waits for the disk
+static void *writerMain(void *arg) {
+    FlagStore *store = arg;
+    pthread_mutex_lock(&store->lock);
+    while (true) {
+        while (store->dirty_count == 0 && !store->stopping) {
+            pthread_cond_wait(&store->changed, &store->lock);
+        }
+        if (store->dirty_count == 0) {
+            break;
+        }
+        for (uint32_t i = 0; i < store->count; ++i) {
+            if (!store->roms[i].dirty) {
+                continue;
+            }
+            RomFlags rom = store->roms[i];
+            store->roms[i].dirty = false;
+            --store->dirty_count;
+            pthread_mutex_unlock(&store->lock);
+            writeFlags(store, rom.hash, rom.flags);
+            pthread_mutex_lock(&store->lock);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+FlagStore *createFlagStore(const char *directory) {
+    FlagStore *store = calloc(1, sizeof(FlagStore));
+    if (store == NULL) {
+        return NULL;
+    }
+    store->directory = malloc(strlen(directory) + 1);
+    if (store->directory == NULL) {
+        free(store);
+        return NULL;
+    }
+    strcpy(store->directory, directory);
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->changed, NULL);
+    if (pthread_create(&store->thread, NULL, writerMain, store) != 0) {
+        pthread_cond_destroy(&store->changed);
+        pthread_mutex_destroy(&store->lock);
+        free(store->directory);
+        free(store);
+        return NULL;
+    }
+    return store;
+}
+
+void destroyFlagStore(FlagStore *store) {
+    if (store == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&store->lock);
+    store->stopping = true;
+    pthread_cond_signal(&store->changed);
+    pthread_mutex_unlock(&store->lock);
+    pthread_join(store->thread, NULL);
+    pthread_cond_destroy(&store->changed);
+    pthread_mutex_destroy(&store->lock);
+    free(store->roms);
+    free(store->directory);
+    free(store);
+}
+
+// Entry of the ROM, read from its file when it's first needed. Needs the lock, NULL if out of memory.
+static RomFlags *findRomFlags(FlagStore *store, uint64_t hash) {
+    for (uint32_t i = 0; i < store->count; ++i) {
+        if (store->roms[i].hash == hash) {
+            return &store->roms[i];
+        }
+    }
+    if (store->count == store->capacity) {
+        uint32_t capacity = store->capacity ? store->capacity * 2 : 16;
+        RomFlags *roms = realloc(store->roms, capacity * sizeof(RomFlags));
+        if (roms == NULL) {
+            return NULL;
+        }
+        store->roms = roms;
+        store->capacity = capacity;
+    }
+    RomFlags *rom = &store->roms[store->count++];
+    *rom = (RomFlags){ .hash = hash };
+    char path[MAX_PATH_LENGTH];
+    flagsPath(store, hash, path);
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        fread(rom->flags, 1, FLAG_REGISTERS, file); // A short file leaves the rest at 0
+        fclose(file);
+    }
+    return rom;
+}
+
+void loadRomFlags(FlagStore *store, uint64_t hash, uint8_t flags[FLAG_REGISTERS]) {
+    pthread_mutex_lock(&store->lock);
+    const RomFlags *rom = findRomFlags(store, hash);
+    if (rom != NULL)
+        memcpy(flags, rom->flags, FLAG_REGISTERS);
+    else
+        memset(flags, 0, FLAG_REGISTERS);
+    pthread_mutex_unlock(&store->lock);
+}
+
+void storeRomFlags(FlagStore *store, uint64_t hash, const uint8_t flags[FLAG_REGISTERS]) {
+    pthread_mutex_lock(&store->lock);
+    RomFlags *rom = findRomFlags(store, hash);
+    if (rom != NULL && memcmp(rom->flags, flags, FLAG_REGISTERS) != 0) {
+        memcpy(rom->flags, flags, FLAG_REGISTERS);
+        if (!rom->dirty) {
+            rom->dirty = true;
+            ++store->dirty_count;
+        }
+        pthread_cond_signal(&store->changed);
+    }
+    pthread_mutex_unlock(&store->lock);
+}
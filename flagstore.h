@@ -0,0 +1,25 @@
+#ifndef FLAGSTORE_H
+#define FLAGSTORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// RPL user flags (FX75/FX85) of every ROM, kept in memory by ROM hash and written to one small
+// file per ROM by a background thread. A game saving its high score inside its main loop never
+// waits for the disk, and games don't overwrite each other's flags.
+
+typedef struct FlagStore FlagStore;
+
+// Starts the writer, files go to `directory`, which is created when the first one is written.
+// Returns NULL on failure.
+FlagStore *createFlagStore(const char *directory);
+// Writes whatever is still pending and stops the writer
+void destroyFlagStore(FlagStore *store);
+
+// Flags of the ROM, from memory or its file, zeros if it never stored any
+void loadRomFlags(FlagStore *store, uint64_t hash, uint8_t flags[FLAG_REGISTERS]);
+// Keeps the flags and, if they changed, has them written in the background
+void storeRomFlags(FlagStore *store, uint64_t hash, const uint8_t flags[FLAG_REGISTERS]);
+
+#endif
@@ -0,0 +1,867 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS with -std=c17
+#include "jit.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE           (1 << 20)
+#define JIT_MAX_BLOCK_LENGTH    64 // Instructions
+#define JIT_MAX_BLOCK_BYTES     (JIT_MAX_BLOCK_LENGTH * 4 + 2) // All of them F000 NNNN, plus the skip lookahead
+#define JIT_MAX_BLOCK_CODE      (JIT_MAX_BLOCK_LENGTH * 128 + 128) // Bytes of machine code, worst case
+
+// Runs compiled code starting at `block` until the budget of instructions runs out
+// or an exit that isn't linked yet is reached.
+// Returns the remaining budget in the low half and the code offset of the exit
+// that can be linked to the block at chip->PC in the high half (0 - none).
+typedef uint64_t (*JitEnterFn)(Chip8 *chip, uint32_t budget, const uint8_t *block);
+
+typedef struct
+{
+    uint8_t *code; // NULL - not compiled
+    uint8_t length; // Instructions in the block
+    uint16_t size; // Bytes of memory it was compiled from, counted from its start
+} JitBlock;
+
+struct JitCache
+{
+    uint8_t *code; // JIT_CODE_SIZE bytes of executable memory, starts with the stubs
+    size_t code_used;
+    size_t stubs_size;
+    uint8_t *exit; // Restores registers and returns from JitEnterFn, rax is the result
+    uint8_t *unlinked; // Returns the budget without an exit to link, dropped blocks jump here
+    uint32_t generation; // Incremented on every flush, older code pointers are gone
+    uint8_t quirks; // Flags the blocks were compiled with, see quirkSignature()
+    uint8_t uncompilable[MEMORY_SIZE]; // Addresses the interpreter always handles
+    uint8_t covered[MEMORY_SIZE]; // Bytes that may belong to a compiled block
+    JitBlock blocks[MEMORY_SIZE];
+};
+
+// x86-64 emitter
+// Inside compiled code rbx holds the Chip8 pointer and r12d the remaining budget,
+// eax and ecx are scratch. Helpers are called with the platform ABI.
+
+#ifdef _WIN32
+static const uint8_t arg_mov_imm[3][2] = { { 0xBA }, { 0x41, 0xB8 }, { 0x41, 0xB9 } }; // edx, r8d, r9d
+static const uint8_t arg_mov_imm_len[3] = { 1, 2, 2 };
+#define MOV_ARG0_RBX    0x48, 0x89, 0xD9 // mov rcx, rbx
+#define ENTER_ARGS      0x48, 0x89, 0xCB, /* mov rbx, rcx */ 0x41, 0x89, 0xD4, /* mov r12d, edx */ 0x41, 0xFF, 0xE0 /* jmp r8 */
+#else
+static const uint8_t arg_mov_imm[3][2] = { { 0xBE }, { 0xBA }, { 0xB9 } }; // esi, edx, ecx
+static const uint8_t arg_mov_imm_len[3] = { 1, 1, 1 };
+#define MOV_ARG0_RBX    0x48, 0x89, 0xDF // mov rdi, rbx
+#define ENTER_ARGS      0x48, 0x89, 0xFB, /* mov rbx, rdi */ 0x41, 0x89, 0xF4, /* mov r12d, esi */ 0xFF, 0xE2 /* jmp rdx */
+#endif
+
+#define REG_AL 0
+#define REG_CL 1
+
+#define OFFSET_V(index) ((int32_t)(offsetof(Chip8, V) + (index)))
+#define OFFSET_PC       ((int32_t)offsetof(Chip8, PC))
+#define OFFSET_I        ((int32_t)offsetof(Chip8, I))
+#define OFFSET_DT       ((int32_t)offsetof(Chip8, delay_timer))
+#define OFFSET_ST       ((int32_t)offsetof(Chip8, sound_timer))
+#define OFFSET_KEYS     ((int32_t)offsetof(Chip8, keys))
+#define OFFSET_PITCH    ((int32_t)offsetof(Chip8, pitch))
+#define OFFSET_HEATMAP  ((int32_t)offsetof(Chip8, memory_heatmap))
+
+typedef struct
+{
+    uint8_t *p;
+    const struct JitCache *jit;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t value) {
+    *e->p++ = value;
+}
+
+static void emit16(Emitter *e, uint16_t value) {
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static void emit32(Emitter *e, uint32_t value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit64(Emitter *e, uint64_t value) {
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+static void emitBytes(Emitter *e, const uint8_t *bytes, size_t count) {
+    memcpy(e->p, bytes, count);
+    e->p += count;
+}
+
+static void patchRel32(uint8_t *field, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (field + 4));
+    memcpy(field, &rel, 4);
+}
+
+// Emits a short conditional jump, returns its offset byte for patchJcc()
+static uint8_t *emitJcc(Emitter *e, uint8_t jcc) {
+    emit8(e, jcc);
+    emit8(e, 0);
+    return e->p - 1;
+}
+
+// Points the jump at the current position
+static void patchJcc(Emitter *e, uint8_t *rel8) {
+    *rel8 = (uint8_t)(e->p - (rel8 + 1));
+}
+
+static void emitJmp(Emitter *e, const uint8_t *target) {
+    emit8(e, 0xE9); // jmp rel32
+    emit32(e, 0);
+    patchRel32(e->p - 4, target);
+}
+
+// <opcode> reg, [rbx + disp32]
+static void emitRbxOp(Emitter *e, uint8_t opcode, uint8_t reg, int32_t disp) {
+    emit8(e, opcode);
+    emit8(e, 0x80 | (reg << 3) | 3);
+    emit32(e, (uint32_t)disp);
+}
+
+static void emitLoadByte(Emitter *e, uint8_t reg, int32_t disp) {
+    emitRbxOp(e, 0x8A, reg, disp); // mov reg8, [rbx + disp]
+}
+
+static void emitStoreByte(Emitter *e, uint8_t reg, int32_t disp) {
+    emitRbxOp(e, 0x88, reg, disp); // mov [rbx + disp], reg8
+}
+
+static void emitStoreByteImm(Emitter *e, int32_t disp, uint8_t value) {
+    emitRbxOp(e, 0xC6, 0, disp); // mov byte [rbx + disp], imm8
+    emit8(e, value);
+}
+
+static void emitStoreWordImm(Emitter *e, int32_t disp, uint16_t value) {
+    emit8(e, 0x66);
+    emitRbxOp(e, 0xC7, 0, disp); // mov word [rbx + disp], imm16
+    emit16(e, value);
+}
+
+static void emitSetPC(Emitter *e, uint16_t pc) {
+    emitStoreWordImm(e, OFFSET_PC, pc);
+}
+
+// helper(chip, a, b, c)
+static void emitCall(Emitter *e, const void *helper, uint32_t a, uint32_t b, uint32_t c) {
+    static const uint8_t mov_arg0[] = { MOV_ARG0_RBX };
+    emitBytes(e, mov_arg0, sizeof(mov_arg0));
+    uint32_t args[3] = { a, b, c };
+    for (uint8_t i = 0; i < 3; ++i) {
+        emitBytes(e, arg_mov_imm[i], arg_mov_imm_len[i]);
+        emit32(e, args[i]);
+    }
+    emit8(e, 0x48);
+    emit8(e, 0xB8); // mov rax, imm64
+    emit64(e, (uint64_t)(uintptr_t)helper);
+    emit8(e, 0xFF);
+    emit8(e, 0xD0); // call rax
+}
+
+// Leaves compiled code, chip->PC has to be stored already
+static void emitExit(Emitter *e) {
+    emitJmp(e, e->jit->unlinked);
+}
+
+// Leaves compiled code through a jump that runJitCycles() can later point
+// straight at the block for the PC stored right before
+static void emitLinkableExit(Emitter *e) {
+    static const uint8_t budget[] = { 0x44, 0x89, 0xE0 }; // mov eax, r12d
+    emit8(e, 0xE9);
+    emit32(e, 0); // jmp rel32, falls through until linked
+    uint32_t site = (uint32_t)(e->p - 4 - e->jit->code);
+    emitBytes(e, budget, sizeof(budget));
+    emit8(e, 0x48);
+    emit8(e, 0xB9); // mov rcx, imm64
+    emit64(e, (uint64_t)site << 32);
+    emit8(e, 0x48);
+    emit8(e, 0x09);
+    emit8(e, 0xC8); // or rax, rcx
+    emitJmp(e, e->jit->exit);
+}
+
+// JitEnterFn, exit and unlinked stubs at the start of the code buffer
+static void emitStubs(struct JitCache *jit) {
+    static const uint8_t enter[] = {
+        0x53,                   // push rbx
+        0x41, 0x54,             // push r12
+        0x48, 0x83, 0xEC, 0x28, // sub rsp, 40 (Win64 shadow space, keeps the stack aligned)
+        ENTER_ARGS
+    };
+    static const uint8_t leave[] = {
+        0x48, 0x83, 0xC4, 0x28, // add rsp, 40
+        0x41, 0x5C,             // pop r12
+        0x5B,                   // pop rbx
+        0xC3                    // ret
+    };
+    static const uint8_t budget[] = { 0x44, 0x89, 0xE0 }; // mov eax, r12d
+
+    Emitter e = { jit->code, jit };
+    emitBytes(&e, enter, sizeof(enter));
+    jit->exit = e.p;
+    emitBytes(&e, leave, sizeof(leave));
+    jit->unlinked = e.p;
+    emitBytes(&e, budget, sizeof(budget));
+    emitJmp(&e, jit->exit);
+    jit->stubs_size = e.p - jit->code;
+}
+
+static uint8_t quirkSignature(const Chip8 *chip) {
+    return chip->superchip_shift
+        | chip->superchip_offset_jump << 1
+        | chip->superchip_reg_mem_load << 2
+        | chip->superchip_no_reset_vf_on_bit_ops << 3
+        | chip->superchip_instructions_set << 4
+        | chip->xochip_instructions_set << 5;
+}
+
+static void flushJit(struct JitCache *jit) {
+    jit->code_used = jit->stubs_size;
+    ++jit->generation;
+    memset(jit->uncompilable, 0, sizeof(jit->uncompilable));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+}
+
+bool setJit(Chip8 *chip, bool enabled) {
+    struct JitCache *jit = chip->jit;
+    if (!enabled) {
+        if (jit != NULL) {
+#ifdef _WIN32
+            VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+            munmap(jit->code, JIT_CODE_SIZE);
+#endif
+            free(jit);
+            chip->jit = NULL;
+        }
+        return true;
+    }
+    if (jit != NULL) {
+        return true;
+    }
+
+    jit = calloc(1, sizeof(struct JitCache));
+    if (jit == NULL) {
+        return false;
+    }
+#ifdef _WIN32
+    jit->code = VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        jit->code = NULL;
+    }
+#endif
+    if (jit->code == NULL) {
+        free(jit);
+        return false;
+    }
+    emitStubs(jit);
+    flushJit(jit);
+    jit->quirks = quirkSignature(chip);
+    chip->jit = jit;
+    return true;
+}
+
+// Blocks that were linked to a dropped block end up in the unlinked stub
+static void dropBlock(struct JitCache *jit, JitBlock *block) {
+    Emitter e = { block->code, jit };
+    emitJmp(&e, jit->unlinked);
+    block->code = NULL;
+}
+
+void invalidateJit(Chip8 *chip, uint16_t addr, uint32_t length) {
+    struct JitCache *jit = chip->jit;
+    if (jit == NULL) {
+        return;
+    }
+    for (uint32_t i = addr; i < (uint32_t)addr + length && i < MEMORY_SIZE; ++i) {
+        jit->uncompilable[i] = 0;
+        if (i > 0) {
+            jit->uncompilable[i - 1] = 0;
+        }
+        if (!jit->covered[i]) {
+            continue;
+        }
+        jit->covered[i] = 0;
+        // A block starting at `start` covers [start, start + size)
+        int32_t first = (int32_t)i - JIT_MAX_BLOCK_BYTES + 1;
+        for (int32_t start = first < 0 ? 0 : first; start <= (int32_t)i; ++start) {
+            JitBlock *block = &jit->blocks[start];
+            if (block->code != NULL && start + block->size > (int32_t)i) {
+                dropBlock(jit, block);
+            }
+        }
+    }
+}
+
+// Helpers for opcodes that aren't worth inlining, all take the same arguments
+
+static void helperMarkHeatmap(Chip8 *chip, uint32_t addr, uint32_t length, uint32_t c) {
+    (void)c;
+    MemoryHeatmap *heatmap = chip->memory_heatmap;
+    for (uint32_t i = addr; i < addr + length; ++i) {
+        heatmap->last_access[HEATMAP_EXECUTE][i] = heatmap->ticks;
+    }
+}
+
+static void helperClearScreen(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    clearScreen(chip);
+}
+
+static void helperReturn(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    returnFromSubRoutine(chip);
+}
+
+static void helperScrollDown(Chip8 *chip, uint32_t n, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    scrollDisplayDownN(chip, n);
+}
+
+static void helperScrollUp(Chip8 *chip, uint32_t n, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    scrollDisplayUpN(chip, n);
+}
+
+static void helperScrollRight(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    scrollDisplayRight(chip);
+}
+
+static void helperScrollLeft(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    scrollDisplayLeft(chip);
+}
+
+static void helperHalt(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    chip->halted = true;
+}
+
+static void helperScreenMode(Chip8 *chip, uint32_t mode, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    setScreenMode(chip, mode);
+}
+
+static void helperPush(Chip8 *chip, uint32_t return_addr, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    pushToStack(chip, return_addr);
+}
+
+static void helperOffsetJump(Chip8 *chip, uint32_t addr, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    offsetJump(chip, addr);
+}
+
+static void helperOffsetJumpSC(Chip8 *chip, uint32_t x, uint32_t nn, uint32_t c) {
+    (void)c;
+    offsetJumpSC(chip, x, nn);
+}
+
+static void helperRandom(Chip8 *chip, uint32_t x, uint32_t nn, uint32_t c) {
+    (void)c;
+    randomNNToVx(chip, x, nn);
+}
+
+static void helperDraw(Chip8 *chip, uint32_t x, uint32_t y, uint32_t n) {
+    draw(chip, x, y, n);
+}
+
+static void helperDrawHighRes(Chip8 *chip, uint32_t x, uint32_t y, uint32_t c) {
+    (void)c;
+    drawHighRes(chip, x, y);
+}
+
+static void helperStoreRange(Chip8 *chip, uint32_t x, uint32_t y, uint32_t c) {
+    (void)c;
+    storeRegisterRange(chip, x, y);
+}
+
+static void helperLoadRange(Chip8 *chip, uint32_t x, uint32_t y, uint32_t c) {
+    (void)c;
+    loadRegisterRange(chip, x, y);
+}
+
+static void helperSelectPlanes(Chip8 *chip, uint32_t planes, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    selectPlanes(chip, planes);
+}
+
+static void helperAudioPattern(Chip8 *chip, uint32_t a, uint32_t b, uint32_t c) {
+    (void)a; (void)b; (void)c;
+    loadAudioPattern(chip);
+}
+
+static void helperGetKey(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    getKey(chip, x);
+}
+
+static void helperAddToI(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    addToI(chip, x);
+}
+
+static void helperLowResFont(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    if (chip->currently_loaded_font_type != 0) {
+        setFontType(chip, 0);
+    }
+    setIToLowResFontChar(chip, x);
+}
+
+static void helperHighResFont(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    if (chip->currently_loaded_font_type == 0) {
+        setFontType(chip, 1);
+    }
+    setIToHighResFontChar(chip, x);
+}
+
+static void helperBCD(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    binCodedDecimalConversion(chip, x);
+}
+
+static void helperStore(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    storeRegistersInMemory(chip, x);
+}
+
+static void helperLoad(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    loadRegistersFromMemory(chip, x);
+}
+
+static void helperSaveFlags(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    saveRegStateToLocalStorage(chip, x);
+}
+
+static void helperLoadFlags(Chip8 *chip, uint32_t x, uint32_t b, uint32_t c) {
+    (void)b; (void)c;
+    loadRegStateFromLocalStorage(chip, x);
+}
+
+// Ends the block with both outcomes of a skip, flags of the condition have to be set already.
+// `jcc` is taken when the next instruction is skipped.
+static void emitSkip(Emitter *e, const Chip8 *chip, uint8_t jcc, uint16_t next) {
+    uint8_t *skip = emitJcc(e, jcc);
+    emitSetPC(e, next);
+    emitLinkableExit(e);
+    patchJcc(e, skip);
+    emitSetPC(e, next + instructionSize(chip, next));
+    emitLinkableExit(e);
+}
+
+// EX9E / EXA1, sets carry when the key in Vx is held
+static void emitKeyTest(Emitter *e, uint8_t x) {
+    emit8(e, 0x0F);
+    emitRbxOp(e, 0xB6, REG_AL, OFFSET_V(x)); // movzx eax, byte [V + x]
+    emit8(e, 0x83);
+    emit8(e, 0xE0);
+    emit8(e, 0x0F); // and eax, 0xF
+    emit8(e, 0x0F);
+    emitRbxOp(e, 0xB7, REG_CL, OFFSET_KEYS); // movzx ecx, word [keys]
+    emit8(e, 0x0F);
+    emit8(e, 0xA3);
+    emit8(e, 0xC1); // bt ecx, eax
+}
+
+// Emits one instruction, returns true if it ended the block.
+// Instructions that end the block store PC and leave compiled code themselves.
+static bool emitInstruction(Emitter *e, const Chip8 *chip, uint16_t addr) {
+    uint8_t b1 = chip->memory[addr];
+    uint8_t b2 = chip->memory[addr + 1];
+    uint16_t opcode = (b1 << 8) | b2;
+    uint8_t x = b1 & 0xF;
+    uint8_t y = b2 >> 4;
+    uint8_t n = b2 & 0xF;
+    uint16_t nnn = opcode & 0xFFF;
+    uint16_t next = addr + 2;
+    bool sc = chip->superchip_instructions_set;
+    bool xo = chip->xochip_instructions_set;
+
+    switch (b1 >> 4) {
+        case 0x0:
+            if (b1 != 0x0) {
+                return false;
+            }
+            switch (b2) {
+                case 0xE0:
+                    emitCall(e, helperClearScreen, 0, 0, 0);
+                    return false;
+                case 0xEE:
+                    emitCall(e, helperReturn, 0, 0, 0);
+                    emitExit(e);
+                    return true;
+                case 0xFB:
+                    if (sc) emitCall(e, helperScrollRight, 0, 0, 0);
+                    return false;
+                case 0xFC:
+                    if (sc) emitCall(e, helperScrollLeft, 0, 0, 0);
+                    return false;
+                case 0xFD:
+                    if (!sc) {
+                        return false;
+                    }
+                    emitCall(e, helperHalt, 0, 0, 0);
+                    emitSetPC(e, next);
+                    emitExit(e);
+                    return true;
+                case 0xFE:
+                    if (sc) emitCall(e, helperScreenMode, 0, 0, 0);
+                    return false;
+                case 0xFF:
+                    if (sc) emitCall(e, helperScreenMode, 2, 0, 0);
+                    return false;
+            }
+            if (y == 0xC && sc) {
+                emitCall(e, helperScrollDown, n, 0, 0);
+            } else if (y == 0xD && xo) {
+                emitCall(e, helperScrollUp, n, 0, 0);
+            }
+            return false;
+        case 0x1:
+            emitSetPC(e, nnn);
+            emitLinkableExit(e);
+            return true;
+        case 0x2:
+            emitCall(e, helperPush, next, 0, 0);
+            emitSetPC(e, nnn);
+            emitLinkableExit(e);
+            return true;
+        case 0x3:
+        case 0x4:
+            emitRbxOp(e, 0x80, 7, OFFSET_V(x)); // cmp byte [V + x], nn
+            emit8(e, b2);
+            emitSkip(e, chip, (b1 >> 4) == 0x3 ? 0x74 : 0x75, next); // je / jne
+            return true;
+        case 0x5:
+        case 0x9:
+            if ((b1 >> 4) == 0x5 && n == 2 && xo) {
+                emitCall(e, helperStoreRange, x, y, 0); // Can overwrite code, like FX55
+                emitSetPC(e, next);
+                emitExit(e);
+                return true;
+            }
+            if ((b1 >> 4) == 0x5 && n == 3 && xo) {
+                emitCall(e, helperLoadRange, x, y, 0);
+                return false;
+            }
+            if (n != 0) {
+                return false;
+            }
+            emitLoadByte(e, REG_AL, OFFSET_V(x));
+            emitRbxOp(e, 0x3A, REG_AL, OFFSET_V(y)); // cmp al, [V + y]
+            emitSkip(e, chip, (b1 >> 4) == 0x5 ? 0x74 : 0x75, next);
+            return true;
+        case 0x6:
+            emitStoreByteImm(e, OFFSET_V(x), b2);
+            return false;
+        case 0x7:
+            emitRbxOp(e, 0x80, 0, OFFSET_V(x)); // add byte [V + x], nn
+            emit8(e, b2);
+            return false;
+        case 0x8:
+            switch (n) {
+                case 0x0:
+                    emitLoadByte(e, REG_AL, OFFSET_V(y));
+                    emitStoreByte(e, REG_AL, OFFSET_V(x));
+                    return false;
+                case 0x1:
+                case 0x2:
+                case 0x3: {
+                    static const uint8_t ops[4] = { 0, 0x0A, 0x22, 0x32 }; // or, and, xor al, [m]
+                    emitLoadByte(e, REG_AL, OFFSET_V(x));
+                    emitRbxOp(e, ops[n], REG_AL, OFFSET_V(y));
+                    emitStoreByte(e, REG_AL, OFFSET_V(x));
+                    if (!chip->superchip_no_reset_vf_on_bit_ops) {
+                        emitStoreByteImm(e, OFFSET_V(0xF), 0);
+                    }
+                    return false;
+                }
+                case 0x4:
+                case 0x5:
+                case 0x7: {
+                    uint8_t first = n == 0x7 ? y : x;
+                    uint8_t second = n == 0x7 ? x : y;
+                    emitLoadByte(e, REG_AL, OFFSET_V(first));
+                    emitRbxOp(e, n == 0x4 ? 0x02 : 0x2A, REG_AL, OFFSET_V(second)); // add / sub al, [m]
+                    emit8(e, 0x0F);
+                    emit8(e, n == 0x4 ? 0x92 : 0x93); // setc / setnc
+                    emit8(e, 0xC1); // cl
+                    emitStoreByte(e, REG_AL, OFFSET_V(x));
+                    emitStoreByte(e, REG_CL, OFFSET_V(0xF));
+                    return false;
+                }
+                case 0x6:
+                case 0xE:
+                    emitLoadByte(e, REG_AL, OFFSET_V(chip->superchip_shift ? x : y));
+                    emit8(e, 0xD0);
+                    emit8(e, n == 0x6 ? 0xE8 : 0xE0); // shr / shl al, 1
+                    emit8(e, 0x0F);
+                    emit8(e, 0x92);
+                    emit8(e, 0xC1); // setc cl
+                    emitStoreByte(e, REG_AL, OFFSET_V(x));
+                    emitStoreByte(e, REG_CL, OFFSET_V(0xF));
+                    return false;
+            }
+            return false;
+        case 0xA:
+            emitStoreWordImm(e, OFFSET_I, nnn);
+            return false;
+        case 0xB:
+            if (chip->superchip_offset_jump) {
+                emitCall(e, helperOffsetJumpSC, x, b2, 0);
+            } else {
+                emitCall(e, helperOffsetJump, nnn, 0, 0);
+            }
+            emitExit(e);
+            return true;
+        case 0xC:
+            emitCall(e, helperRandom, x, b2, 0);
+            return false;
+        case 0xD:
+            if (n == 0 && sc) {
+                emitCall(e, helperDrawHighRes, x, y, 0);
+            } else {
+                emitCall(e, helperDraw, x, y, n);
+            }
+            return false;
+        case 0xE:
+            if (b2 != 0x9E && b2 != 0xA1) {
+                return false;
+            }
+            emitKeyTest(e, x);
+            emitSkip(e, chip, b2 == 0x9E ? 0x72 : 0x73, next); // jc / jnc
+            return true;
+        case 0xF:
+            switch (b2) {
+                case 0x00:
+                    if (x == 0 && xo) { // compileBlock() steps over NNNN
+                        emitStoreWordImm(e, OFFSET_I, (chip->memory[next] << 8) | chip->memory[(uint16_t)(next + 1)]);
+                    }
+                    return false;
+                case 0x01:
+                    if (xo) emitCall(e, helperSelectPlanes, x, 0, 0);
+                    return false;
+                case 0x02:
+                    if (x == 0 && xo) emitCall(e, helperAudioPattern, 0, 0, 0);
+                    return false;
+                case 0x07:
+                    emitLoadByte(e, REG_AL, OFFSET_DT);
+                    emitStoreByte(e, REG_AL, OFFSET_V(x));
+                    return false;
+                case 0x0A:
+                    emitSetPC(e, next);
+                    emitCall(e, helperGetKey, x, 0, 0);
+                    emitExit(e);
+                    return true;
+                case 0x15:
+                case 0x18:
+                    emitLoadByte(e, REG_AL, OFFSET_V(x));
+                    emitStoreByte(e, REG_AL, b2 == 0x15 ? OFFSET_DT : OFFSET_ST);
+                    return false;
+                case 0x1E:
+                    emitCall(e, helperAddToI, x, 0, 0);
+                    return false;
+                // Font loads and memory stores can overwrite code, the block ends after them
+                case 0x29:
+                    emitCall(e, helperLowResFont, x, 0, 0);
+                    emitSetPC(e, next);
+                    emitExit(e);
+                    return true;
+                case 0x30:
+                    if (!sc) return false;
+                    emitCall(e, helperHighResFont, x, 0, 0);
+                    emitSetPC(e, next);
+                    emitExit(e);
+                    return true;
+                case 0x33:
+                    emitCall(e, helperBCD, x, 0, 0);
+                    emitSetPC(e, next);
+                    emitExit(e);
+                    return true;
+                case 0x3A:
+                    if (xo) {
+                        emitLoadByte(e, REG_AL, OFFSET_V(x));
+                        emitStoreByte(e, REG_AL, OFFSET_PITCH);
+                    }
+                    return false;
+                case 0x55:
+                    emitCall(e, helperStore, x, 0, 0);
+                    emitSetPC(e, next);
+                    emitExit(e);
+                    return true;
+                case 0x65:
+                    emitCall(e, helperLoad, x, 0, 0);
+                    return false;
+                case 0x75:
+                    if (sc) emitCall(e, helperSaveFlags, x, 0, 0);
+                    return false;
+                case 0x85:
+                    if (sc) emitCall(e, helperLoadFlags, x, 0, 0);
+                    return false;
+            }
+            return false;
+    }
+    return false;
+}
+
+static bool isHiresInit(const Chip8 *chip, uint16_t addr) {
+    return addr == PROGRAM_START && chip->memory[addr] == 0x12 && chip->memory[addr + 1] == 0x60;
+}
+
+static JitBlock *compileBlock(Chip8 *chip, uint16_t start) {
+    struct JitCache *jit = chip->jit;
+    uint32_t end = addressSpace(chip);
+    // Hires init at PROGRAM_START and the wrap at the end of memory stay with the interpreter
+    if (start >= end - 2 || isHiresInit(chip, start)) {
+        jit->uncompilable[start] = 1;
+        return NULL;
+    }
+    if (jit->code_used + JIT_MAX_BLOCK_CODE > JIT_CODE_SIZE) {
+        flushJit(jit);
+    }
+
+    Emitter e = { jit->code + jit->code_used, jit };
+    uint8_t *entry = e.p;
+
+    // Leave if the budget can't cover the whole block, the interpreter takes over at its start.
+    // Length is patched in once the block is done.
+    emit8(&e, 0x41);
+    emit8(&e, 0x81);
+    emit8(&e, 0xFC);
+    uint8_t *cmp_length = e.p;
+    emit32(&e, 0); // cmp r12d, length
+    uint8_t *enough = emitJcc(&e, 0x73); // jae
+    emitSetPC(&e, start); // Blocks linked to this one have set it already, the dispatcher hasn't
+    emitExit(&e);
+    patchJcc(&e, enough);
+    emit8(&e, 0x41);
+    emit8(&e, 0x81);
+    emit8(&e, 0xEC);
+    uint8_t *sub_length = e.p;
+    emit32(&e, 0); // sub r12d, length
+
+    emit8(&e, 0x48);
+    emitRbxOp(&e, 0x8B, REG_AL, OFFSET_HEATMAP); // mov rax, [rbx + heatmap]
+    emit8(&e, 0x48);
+    emit8(&e, 0x85);
+    emit8(&e, 0xC0); // test rax, rax
+    uint8_t *no_heatmap = emitJcc(&e, 0x74); // jz
+    uint8_t *heatmap_length = e.p + 3 + arg_mov_imm_len[0] + 4 + arg_mov_imm_len[1];
+    emitCall(&e, helperMarkHeatmap, start, 0, 0);
+    patchJcc(&e, no_heatmap);
+
+    uint32_t addr = start;
+    uint8_t length = 0;
+    bool ended = false;
+    while (!ended && length < JIT_MAX_BLOCK_LENGTH && addr < end - 2 && !isHiresInit(chip, addr)) {
+        ended = emitInstruction(&e, chip, addr);
+        addr += instructionSize(chip, addr);
+        ++length;
+    }
+    if (!ended) {
+        emitSetPC(&e, addr);
+        emitLinkableExit(&e);
+    }
+    // A skip ending the block also depends on the size of the instruction after it, which only varies with XO-CHIP
+    uint32_t size = addr - start + (chip->xochip_instructions_set ? 2 : 0);
+    if (start + size > MEMORY_SIZE) {
+        size = MEMORY_SIZE - start;
+    }
+
+    uint32_t length32 = length;
+    uint32_t heatmap_bytes = addr - start;
+    memcpy(cmp_length, &length32, 4);
+    memcpy(sub_length, &length32, 4);
+    memcpy(heatmap_length, &heatmap_bytes, 4);
+    jit->code_used += e.p - entry;
+
+    memset(jit->covered + start, 1, size);
+    JitBlock *block = &jit->blocks[start];
+    block->code = entry;
+    block->length = length;
+    block->size = size;
+    return block;
+}
+
+// Finds or compiles the block at addr, NULL if the interpreter has to run it
+static JitBlock *lookupBlock(Chip8 *chip, uint16_t addr) {
+    struct JitCache *jit = chip->jit;
+    if (addr >= addressSpace(chip) - 2 || jit->uncompilable[addr]) {
+        return NULL;
+    }
+    JitBlock *block = &jit->blocks[addr];
+    if (block->code != NULL) {
+        return block;
+    }
+    return compileBlock(chip, addr);
+}
+
+void runJitCycles(Chip8 *chip, uint32_t cycles) {
+    struct JitCache *jit = chip->jit;
+    JitEnterFn enter = (JitEnterFn)(void *)jit->code;
+    uint8_t quirks = quirkSignature(chip);
+    if (quirks != jit->quirks) {
+        flushJit(jit);
+        jit->quirks = quirks;
+    }
+
+    while (cycles > 0 && !chip->halted) {
+        JitBlock *block = lookupBlock(chip, chip->PC);
+        if (block == NULL || block->length > cycles) {
+            stepOneСycle(chip);
+            --cycles;
+            continue;
+        }
+
+        uint64_t result = enter(chip, cycles, block->code);
+        cycles = (uint32_t)result;
+        uint32_t site = (uint32_t)(result >> 32);
+        if (site == 0) {
+            continue;
+        }
+        // Chain the exit to the block it leads to, unless compiling it flushed the cache
+        uint32_t generation = jit->generation;
+        JitBlock *target = lookupBlock(chip, chip->PC);
+        if (target != NULL && jit->generation == generation) {
+            patchRel32(jit->code + site, target->code);
+        }
+    }
+}
+
+#else
+
+bool setJit(Chip8 *chip, bool enabled) {
+    (void)chip;
+    return !enabled;
+}
+
+void runJitCycles(Chip8 *chip, uint32_t cycles) {
+    runCycles(chip, cycles);
+}
+
+void invalidateJit(Chip8 *chip, uint16_t addr, uint32_t length) {
+    (void)chip; (void)addr; (void)length;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chip8.h"
+
+// Basic-block compiler to x86-64 machine code.
+// A straight run of opcodes up to the next jump, call, return, skip or FX0A becomes
+// one native function keyed by its start address. Quirk flags are baked into the
+// code, so the blocks are dropped whenever the flags change.
+// Anything that can't be compiled is executed by the interpreter.
+
+// Turns the JIT on or off, returns false if it's not supported on this platform
+bool setJit(Chip8 *chip, bool enabled);
+
+// Executes the given number of instructions through compiled blocks
+void runJitCycles(Chip8 *chip, uint32_t cycles);
+
+// Drops compiled blocks that overlap [addr, addr + length)
+void invalidateJit(Chip8 *chip, uint16_t addr, uint32_t length);
+
+#endif
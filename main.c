@@ -6,36 +6,74 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
-
-#define MAX_STACK_SIZE      4096
-#define TIMER_SPEED         60
-#define FONT_MEM_LOC        0x0
-#define PROGRAM_START       0x200
-#define KEYS_NUM            16
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "jit.h"
+#include "emuthread.h"
+#include "rewind.h"
+#include "movie.h"
+#include "profiler.h"
+#include "metrics.h"
+#include "romlibrary.h"
+#include "autoquirks.h"
+#include "threadpool.h"
+#include "flagstore.h"
+#include "postfx.h"
+
+#define REWIND_SECONDS 600
+#define REWIND_CAPACITY (4 << 20) // Bytes of compressed history, ~10 minutes of a typical game
 
 // Emulator related
-uint16_t cpu_speed; // Instructions per second
-uint8_t memory[4096];
-uint8_t V[16]; // General-purpose varibale registers (0-F)
-uint16_t I; // Index register (points to memory locations)
-uint16_t PC; // Program Counter register
-uint8_t delay_timer; // Delay timer
-uint8_t sound_timer; // Sound timer
-uint8_t screen_w;
-uint8_t screen_h;
-uint8_t screen[128 * 64] = {0};
-uint8_t currently_loaded_font_type; // 0 - lowres, 1 - hires
-bool is_rom_loaded;
+Chip8 chip; // Runs on the emulation thread, see lockMachine()
+EmuThread *emulation;
+RewindBuffer *rewind_buffer; // Touched only with lockMachine(), NULL if it couldn't be allocated
+Movie *movie; // Movie being recorded or played, touched only with lockMachine()
+const EmuFrame *emu_frame; // Newest finished frame, everything drawn comes from it
+const Chip8 *view; // Machine state of emu_frame
+uint32_t cpu_speed; // Instructions per second
+#define MAX_CPU_SPEED 1000000 // Highest cpu_speed the mouse wheel sets, every frame runs under the machine lock
+bool turbo_mode; // Runs emulated frames back to back, cpu_speed only sets the instructions per frame
+uint8_t run_ahead; // Frames the screen is emulated ahead of the machine to hide input lag, see setEmuRunAhead()
 bool step_by_step_mode;
 bool step_one_instruction;
 char *rom_file_path;
 const char rom_file_path_default_message[17] = "ROM isn't loaded";
+uint8_t save_slot; // Slot of the save and load hotkeys, 0-9
+#define SESSION_FILE "session.c8s" // Machine left on exit, resumed on the next start
+#define MOVIE_FILE "movie.c8m" // Where F8 records and what F10 plays
+#define PROFILE_FILE "profile.folded" // Call paths of the last profile, for flame graph tools
+#define PROFILE_ROWS 8 // Hot spots and subroutines shown while profiling
+Profiler *profiler; // Attached to chip while P profiles, touched only with lockMachine()
+ProfileHotSpot profile_hot_spots[PROFILE_ROWS]; // Copied out of the profiler twice a second for drawing
+ProfileSubroutine profile_subroutines[PROFILE_ROWS];
+uint32_t profile_hot_spot_count;
+uint32_t profile_subroutine_count;
+uint64_t profile_cycles;
+double profile_refresh_time;
+#define METRICS_CSV_FILE "metrics.csv" // F4 writes the metrics here, SHIFT+F4 to METRICS_JSON_FILE
+#define METRICS_JSON_FILE "metrics.json"
+#define METRICS_EXPORT_INTERVAL 1.0 // Seconds per exported row
+MetricsLog *metrics; // One sample per frontend frame, NULL if it couldn't be allocated
+double frame_start_time; // GetTime() when the current frontend frame started
+double render_seconds; // Time the frontend spent on its last frame before presenting it
+#define ROM_LIBRARY_FILE "romlibrary.idx" // Index of ROMS_DIRECTORY and the directories given on the command line
+#define ROMS_DIRECTORY "ROMs"
+RomLibrary *rom_library; // Profiles applied to dropped ROMs, NULL if it couldn't be allocated
+ThreadPool *quirk_pool; // Runs detectQuirks() the first time a ROM is dropped, NULL if it couldn't be started
+#define FLAGS_DIRECTORY "flags" // FX75 flags of every ROM, one file per ROM hash
+FlagStore *flag_store; // NULL if its writer couldn't be started, the flags then last until the ROM changes
+uint64_t flags_rom_hash; // ROM the machine's flags are stored for, 0 - none
+uint64_t flags_since_frame; // chip.counters.frames when it was set, older frames may be from another ROM
+uint8_t stored_flags[FLAG_REGISTERS]; // Flags last handed to flag_store
 
 // Screen, display, UI related
-uint8_t memory_heatmap[4096];
+MemoryHeatmap memory_heatmap;
+uint64_t display_dirty_rows; // Rows changed in the frames received since the last texture update
 uint16_t d_x; // Display x pos
 uint16_t d_y; // Display y pos
-int16_t memory_heatmap_start = 0;
+int32_t memory_heatmap_start = 0;
 bool fullscreen_mode;
 char quirks_button_text[3];
 int16_t d_margin;
@@ -57,6 +95,29 @@ Color style_colors[12] = {
 };
 bool dark_mode;
 bool show_debug_info;
+char notice_text[48]; // Short confirmation shown in the corner until notice_until
+double notice_until;
+#define IDLE_DELAY 1.0 // Seconds drawn after the screen last could change on its own, for steps to arrive and the heatmap to fade
+#define BACKGROUND_FPS 10 // Redraws per second of a running machine while the window is unfocused or minimized
+double busy_until; // GetTime() until which the frontend redraws without waiting for input
+bool waiting_for_events; // EnableEventWaiting() is on, EndDrawing() blocks until input arrives
+bool in_background; // Drawing at BACKGROUND_FPS
+int16_t applied_style = -1; // current_style the GUI styles were last set for, -1 - none yet
+bool applied_dark_mode;
+bool applied_fullscreen_mode;
+typedef struct
+{
+    bool formatted;
+    uint32_t value;
+    char text[12];
+} Readout; // Register readout under the memory view, formatted again only when its value changes
+Readout v_readouts[16];
+Readout i_readout;
+Readout pc_readout;
+Readout opcode_readout;
+Readout stack_top_readout;
+Readout dtimer_readout;
+Readout stimer_readout;
 bool show_message_box;
 bool show_instruction;
 char *message_box_title;
@@ -69,11 +130,25 @@ int16_t message_box_x = 0;
 int16_t message_box_y = 0;
 Vector2 box_mouse_dragging_delta_pos = {0};
 float md_mouse_dragging_delta_pos_y = 0;
-uint16_t memory_heatmap_start_when_dragging = {0};
+int32_t memory_heatmap_start_when_dragging = {0};
+Color display_palette[1 << SCREEN_PLANES]; // Indexed by getPixel(), 0 is transparent, 1 (the only one CHIP-8 draws) the style colour
+PostFx *display_fx; // Persistence and scaling between the screen and display_texture
+uint64_t display_fx_frame; // view->counters.frames when display_fx last ran
+Texture2D display_texture; // POSTFX_MAX_W x POSTFX_MAX_H, the top left corner holds the screen
+Color memory_panel_pixels[32 * 32]; // One pixel per memory cell shown in the panel
+Texture2D memory_panel_texture;
+
+// One grid cell with its right and bottom `margin` pixels opaque, repeated over a grid to draw the gaps between cells
+typedef struct
+{
+    Texture2D texture;
+    uint16_t cell_size;
+    int16_t margin;
+} GapMask;
+GapMask display_gap_mask;
+GapMask memory_panel_gap_mask;
 
 // Keypad input related
-bool waiting_for_key;
-int key_released_this_cycle;
 int chip8_keymap[KEYS_NUM] = {
     KEY_X,     // 0
     KEY_ONE,   // 1
@@ -93,12 +168,6 @@ int chip8_keymap[KEYS_NUM] = {
     KEY_V      // F
 };
 
-// Configuration variables related to quirks of superchip
-bool superchip_shift;
-bool superchip_offset_jump;
-bool superchip_reg_mem_load;
-bool superchip_no_reset_vf_on_bit_ops;
-bool superchip_instructions_set; // Additional instructions for superchip
 
 const char *instruction_text = 
 "Keyboard layout:\n\
@@ -115,11 +184,27 @@ A S D F\n\
 Z X C V\n\
 \n\
 Hotkeys:\n\
-- F3 - display debug info;\n\
+- F3 - display debug info and metrics;\n\
+- F4 - start / stop writing metrics to metrics.csv (with SHIFT - metrics.json);\n\
+- G - switch between the JIT and the interpreter;\n\
 - L - reload the program from the last ROM path;\n\
 - K - restart the program;\n\
 - J - toggle fullscreen mode;\n\
 - H - cycle through cpu speed;\n\
+- T - turbo mode, runs as fast as possible without sound;\n\
+- O - screen persistence against flicker: off, 2 frames, phosphor fade;\n\
+- I - pixel smoothing: off, Scale2x, Scale3x;\n\
+- F2 - run-ahead of 0-4 frames, the screen reacts to keys that much sooner;\n\
+- BACKSPACE - hold to rewind;\n\
+- F5 / F9 - save / load the state in the current slot;\n\
+- F6 / F7 - previous / next save slot;\n\
+- F8 - start / stop recording a movie;\n\
+- F10 - play the recorded movie (or drop a .c8m file).\n\
+- Quirks button - CHIP-8 (CH), SUPER-CHIP (SC) or XO-CHIP (XO),\n\
+  dropping a ROM sets it and the cpu speed from the ROM library,\n\
+  AU - other quirks found by running the ROM once with each combination;\n\
+- P - start / stop profiling, the hot spots replace the memory view\n\
+  and the call paths are saved to profile.folded;\n\
 - M - enter the step-by-step mode;\n\
 - N - step forward in the step-by-step mode;\n\
 - CTRL - switch dark mode;\n\
@@ -128,834 +213,513 @@ Hotkeys:\n\
 To open the ROM drag & drop file into the window.\n\
 Some buttons can be controlled with the mousewheel.";
 
-// 4x5 font
-uint8_t lowres_font_sprites[80] = {
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-// 8x10 font
-uint8_t hires_font_sprites[512] = {
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0
-    0x00, 0x00, 0x18, 0x00, 0x38, 0x00, 0x78, 0x00, 0x58, 0x00, 0x18, 0x00, 0x18, 0x00, 0x18, 0x00, 0x18, 0x00, 0x7E, 0x00, 0x7E, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 1
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0C, 0x00, 0x18, 0x00, 0x30, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 2
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0x03, 0x00, 0x1E, 0x00, 0x1E, 0x00, 0x03, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 3
-    0x00, 0x00, 0x06, 0x00, 0x0E, 0x00, 0x1E, 0x00, 0x36, 0x00, 0x66, 0x00, 0xC6, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x06, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 4
-    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0x03, 0x00, 0x03, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 5
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC0, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 6
-    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x03, 0x00, 0x06, 0x00, 0x0C, 0x00, 0x18, 0x00, 0x30, 0x00, 0x60, 0x00, 0x60, 0x00, 0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 7
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 8
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0x7F, 0x00, 0x3F, 0x00, 0x07, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 9
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // A
-    0x00, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // B
-    0x00, 0x00, 0x3C, 0x00, 0x7E, 0x00, 0xE7, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xE7, 0x00, 0x7E, 0x00, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // C
-    0x00, 0x00, 0xFC, 0x00, 0xFE, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xE7, 0x00, 0xFE, 0x00, 0xFC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // D
-    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFE, 0x00, 0xFE, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // E
-    0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xFE, 0x00, 0xFE, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00  // F
-};
+void pollRaylibKeypad(void) {
+    uint16_t held = 0;
+    uint16_t released = 0;
 
-// Stack Implementation
-typedef struct
-{
-    uint16_t arr[MAX_STACK_SIZE];
-    int16_t top;
-} Stack;
-
-Stack stack; // 16-bit stack of memory addresses
-
-bool isStackEmpty(void) {
-    return stack.top == -1;
-}
-
-bool isStackFull(void) {
-    return stack.top == MAX_STACK_SIZE - 1;
-}
-
-void pushToStack(uint16_t value) {
-    if (isStackFull()) {
-        return;
-    }
-    stack.arr[++(stack.top)] = value;
-}
-
-uint16_t popFromStack(void) {
-    if (isStackEmpty()) {
-        return 0;
-    }
-    return stack.arr[(stack.top)--];
-}
-
-void showMessageBox(const char *title, const char *message, const char *buttons, int textAlignment);
-
-void loadROM(const char* path) {
-    FILE *rom = fopen(path, "rb");
-    if (rom == NULL) {
-        showMessageBox("ERROR", "Cound't open the file.", "Close", TEXT_ALIGN_CENTER);
-        return;
-    }
-    fseek(rom, 0, SEEK_END);
-    size_t rom_size = ftell(rom);
-    fseek(rom, 0, SEEK_SET);
-    if (rom_size > sizeof(memory) - PROGRAM_START) {
-        showMessageBox("ERROR", "ROM is too big.", "Close", TEXT_ALIGN_CENTER);
-        return;
+    for (uint8_t i = 0; i < KEYS_NUM; ++i) {
+        if (IsKeyDown(chip8_keymap[i])) {
+            held |= 1 << i;
+        }
+        // Detect key release for FX0A
+        if (IsKeyReleased(chip8_keymap[i])) {
+            released |= 1 << i;
+        }
     }
-    fread(memory + PROGRAM_START, 1, rom_size, rom);
-    fclose(rom);
-    is_rom_loaded = true;
+    setEmuKeys(emulation, held, released);
 }
 
-// Instructions
-
-// 00E0
-void clearScreen(void) {
-    memset(screen, 0, screen_w * screen_h);
+// Once the emulation thread runs, the frontend touches `chip` only between these two
+void lockMachine(void) {
+    if (emulation != NULL) lockEmuThread(emulation);
 }
 
-// 00EE
-void returnFromSubRoutine(void) {
-    PC = popFromStack();
+void unlockMachine(void) {
+    if (emulation != NULL) unlockEmuThread(emulation);
 }
 
-// 00CN
-void scrollDisplayDownN(uint8_t N) {
-    for (int16_t y = screen_h - 1; y >= 0; --y) {
-        for (int16_t x = 0; x < screen_w; ++x) {
-            if (y >= N) {
-                screen[screen_w * y + x] = screen[screen_w * (y - N) + x];
-            }
-            else {
-                screen[screen_w * y + x] = 0;
-            }
+// Beep, generated on demand by the audio callback. The device is opened by the first beep,
+// so runs without sound never start the audio thread.
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_BUFFER_FRAMES 256 // ~6 ms per callback
+#define BEEP_FREQUENCY 440
+#define BEEP_VOLUME 0.1f
+#define BEEP_FADE_SAMPLES 64 // Ramps at both ends of a beep instead of clicks
+#define PATTERN_BITS (AUDIO_PATTERN_SIZE * 8) // XO-CHIP pattern samples, played in a loop
+AudioStream beep_stream;
+bool audio_started;
+_Atomic bool audio_muted; // Set by the main loop, read by the callback
+
+// State of the callback, touched only by the audio thread
+uint32_t beep_seen_frame;
+uint8_t beep_seen_timer;
+uint32_t beep_samples_left; // Counted down per sample, so a beep ends mid-buffer rather than at the next frame
+float beep_phase; // 0-1 through the square wave period or the XO-CHIP pattern
+float beep_gain;
+
+void beepCallback(void *buffer, unsigned int frames) {
+    short *samples = buffer;
+    const uint32_t samples_per_tick = AUDIO_SAMPLE_RATE / TIMER_SPEED;
+    uint32_t frame;
+    uint8_t timer = readEmuSoundTimer(emulation, &frame);
+    if (frame != beep_seen_frame) {
+        // A plain tick keeps the countdown going unless it drifted by more than a tick,
+        // anything else (FX18, a state load, a rewind) restarts it
+        uint32_t expected = timer * samples_per_tick;
+        bool tick = timer + 1 == beep_seen_timer;
+        uint32_t drift = beep_samples_left > expected ? beep_samples_left - expected : expected - beep_samples_left;
+        if (!tick || drift > samples_per_tick) {
+            beep_samples_left = expected;
         }
+        beep_seen_frame = frame;
+        beep_seen_timer = timer;
     }
-};
-
-// 00FB
-void scrollDisplayRight(void) {
-    for (int16_t y = 0; y < screen_h; ++y) {
-        for (int16_t x = screen_w - 1; x >= 0; --x) {
-            if (x > 3) {
-                screen[screen_w * y + x] = screen[screen_w * y + (x - 4)];
-            } else {
-                screen[screen_w * y + x] = 0;
-            }
+    bool muted = atomic_load_explicit(&audio_muted, memory_order_relaxed);
+    // Once an XO-CHIP program loads a pattern it replaces the square wave, at 4000 * 2^((pitch - 64) / 48) samples per second
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    bool play_pattern = readEmuAudioPattern(emulation, pattern, &pitch);
+    float step = play_pattern ? 4000.0f * exp2f((pitch - 64) / 48.0f) / PATTERN_BITS / AUDIO_SAMPLE_RATE
+                              : (float)BEEP_FREQUENCY / AUDIO_SAMPLE_RATE;
+    for (unsigned int i = 0; i < frames; ++i) {
+        float target = beep_samples_left > 0 && !muted ? 1.0f : 0.0f;
+        if (beep_gain < target) {
+            beep_gain = fminf(beep_gain + 1.0f / BEEP_FADE_SAMPLES, target);
+        } else if (beep_gain > target) {
+            beep_gain = fmaxf(beep_gain - 1.0f / BEEP_FADE_SAMPLES, target);
         }
-    }
-}
-
-// 00FC
-void scrollDisplayLeft(void) {
-    for (uint16_t y = 0; y < screen_h; ++y) {
-        for (int16_t x = 0; x < screen_w; ++x) {
-            if (x < screen_w - 4) {
-                screen[screen_w * y + x] = screen[screen_w * y + (x + 4)];
-            } else {
-                screen[screen_w * y + x] = 0;
-            }
+        if (beep_samples_left > 0) {
+            --beep_samples_left;
         }
+        beep_phase += step;
+        if (beep_phase >= 1.0f) beep_phase -= 1.0f;
+        bool high = beep_phase < 0.5f;
+        if (play_pattern) {
+            uint8_t bit = (uint8_t)(beep_phase * PATTERN_BITS) % PATTERN_BITS;
+            high = (pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        }
+        samples[i] = (short)((high ? 32767 : -32767) * BEEP_VOLUME * beep_gain);
     }
 }
 
-// 1NNN
-void jump(uint16_t addr) {
-    PC = addr & 0xFFF;
-}
-
-// 2NNN
-void execSubroutine(uint16_t addr) {
-    pushToStack(PC);
-    PC = addr;
+// Opens the audio device and starts the beep stream, needs the emulation thread
+void startAudio(void) {
+    if (audio_started) return;
+    audio_started = true; // Also when it fails, it isn't retried every frame
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) return;
+    SetAudioStreamBufferSizeDefault(AUDIO_BUFFER_FRAMES);
+    beep_stream = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 1);
+    SetAudioStreamCallback(beep_stream, beepCallback);
+    PlayAudioStream(beep_stream);
 }
 
-// 3XNN
-void skipIfVxEqNN(uint8_t reg_index, uint8_t num) {
-    if (V[reg_index] == num) {
-        PC += 2;
+// Has to run before the emulation thread stops, the callback reads from it. Closes the device only if startAudio() opened it.
+void stopAudio(void) {
+    if (!audio_started) return;
+    if (IsAudioDeviceReady()) {
+        UnloadAudioStream(beep_stream);
+        CloseAudioDevice();
     }
+    audio_started = false;
 }
 
-// 4XNN
-void skipIfVxNotEqNN(uint8_t reg_index, uint8_t num) {
-    if (V[reg_index] != num) {
-        PC += 2;
+// Colours for the plane combinations XO-CHIP can draw, hues spread around the style colour.
+// display_fx redraws every row when they change.
+void updateDisplayPalette(Color foreground) {
+    Color palette[1 << SCREEN_PLANES] = { BLANK, foreground };
+    Vector3 hsv = ColorToHSV(foreground);
+    float saturation = hsv.y < 0.3f ? 0.6f : hsv.y; // Shades of gray would all look the same
+    float value = hsv.z < 0.3f ? 0.8f : hsv.z;
+    for (uint8_t i = 2; i < (1 << SCREEN_PLANES); ++i) {
+        palette[i] = ColorFromHSV(fmodf(hsv.x + (i - 1) * 360.0f / ((1 << SCREEN_PLANES) - 1), 360.0f), saturation, value);
     }
-}
-
-// 5XY0
-void skipIfVxEqVy(uint8_t regx_index, uint8_t regy_index) {
-    if (V[regx_index] == V[regy_index]) {
-        PC += 2;
+    if (memcmp(palette, display_palette, sizeof(palette)) != 0) {
+        memcpy(display_palette, palette, sizeof(palette));
+        uint32_t fx_palette[1 << SCREEN_PLANES];
+        memcpy(fx_palette, palette, sizeof(fx_palette));
+        setPostFxPalette(display_fx, fx_palette);
     }
 }
 
-// 6XNN
-void setVXNN(uint8_t reg_index, uint8_t num) {
-    V[reg_index] = num;
+// Runs display_fx on the screen rows changed since the last frame and uploads its output rows in one
+// call. Frames that neither touched the screen nor have pixels fading don't upload anything.
+void updateDisplayTexture(void) {
+    uint64_t frame = view->counters.frames;
+    uint32_t frames = frame >= display_fx_frame ? (uint32_t)(frame - display_fx_frame) : 1; // Back after a rewind or reset
+    display_fx_frame = frame;
+    uint64_t rows = runPostFx(display_fx, view, display_dirty_rows, frames);
+    display_dirty_rows = 0;
+    if (rows == 0) return;
+
+    uint8_t first = 0;
+    uint8_t last = SCREEN_MAX_H - 1;
+    while (!((rows >> first) & 1)) ++first;
+    while (!((rows >> last) & 1)) --last;
+    uint8_t scale = postFxSettings(display_fx).scale;
+    uint16_t width, height;
+    const uint32_t *pixels = postFxPixels(display_fx, &width, &height);
+    UpdateTextureRec(display_texture, (Rectangle){ 0, first * scale, POSTFX_MAX_W, (last - first + 1) * scale },
+        (void *)(pixels + first * scale * POSTFX_MAX_W));
 }
 
-// 7XNN
-void addNNToVX(uint8_t reg_index, uint8_t num) {
-    V[reg_index] += num; // vF isn't changed in case of overflow
-}
-
-// 8XY0
-void setVxVy(uint8_t regx_index, uint8_t regy_index) {
-    V[regx_index] = V[regy_index];
-}
-
-// 8XY1
-void orVxVy(uint8_t regx_index, uint8_t regy_index) {
-    V[regx_index] |= V[regy_index];
-    if (!superchip_no_reset_vf_on_bit_ops) {
-        V[0xF] = 0;
+// Paints the gaps of a grid of `cell_size` cells covering `area`,
+// the mask texture is regenerated only when the cell size or the margin changed
+void drawGapMask(GapMask *mask, Rectangle area, uint16_t cell_size, int16_t margin, Color color) {
+    if (cell_size != mask->cell_size || margin != mask->margin) {
+        mask->cell_size = cell_size;
+        mask->margin = margin;
+        if (mask->texture.id != 0) UnloadTexture(mask->texture);
+        mask->texture = (Texture2D){0};
+        if (margin > 0 && cell_size > 0) {
+            Image cell = GenImageColor(cell_size, cell_size, BLANK);
+            ImageDrawRectangle(&cell, cell_size - margin, 0, margin, cell_size, WHITE);
+            ImageDrawRectangle(&cell, 0, cell_size - margin, cell_size, margin, WHITE);
+            mask->texture = LoadTextureFromImage(cell);
+            SetTextureWrap(mask->texture, TEXTURE_WRAP_REPEAT);
+            UnloadImage(cell);
+        }
     }
-}
-
-// 8XY2
-void andVxVy(uint8_t regx_index, uint8_t regy_index) {
-    V[regx_index] &= V[regy_index];
-    if (!superchip_no_reset_vf_on_bit_ops) {
-        V[0xF] = 0;
+    if (mask->texture.id != 0) {
+        DrawTexturePro(mask->texture, (Rectangle){ 0, 0, area.width, area.height }, area, (Vector2){ 0, 0 }, 0, color);
     }
 }
 
-// 8XY3
-void xorVxVy(uint8_t regx_index, uint8_t regy_index) {
-    V[regx_index] ^= V[regy_index];
-    if (!superchip_no_reset_vf_on_bit_ops) {
-        V[0xF] = 0;
-    }
+// How recently a byte was accessed through the given channel, 1 - this tick, 0 - over a second ago, never
+// or outside of the window the frame carries (see setEmuHeatmapWindow())
+float heatmapHeat(uint32_t addr, uint8_t channel) {
+    const uint32_t fade_ticks = 51;
+    uint32_t offset = addr - emu_frame->heatmap_start;
+    if (addr < emu_frame->heatmap_start || offset >= EMU_HEATMAP_WINDOW) return 0;
+    uint32_t last_access = emu_frame->heatmap_window[channel][offset];
+    uint32_t age = emu_frame->heatmap_ticks - last_access;
+    if (last_access == 0 || age >= fade_ticks) return 0;
+    return 1.0f - (float)age / fade_ticks;
 }
 
-// 8XY4
-void addVxVy(uint8_t regx_index, uint8_t regy_index) {
-    uint8_t vF;
-    if ((V[regx_index] + V[regy_index]) > 255) {
-        vF = 1;
-    } else {
-        vF = 0;
-    }
-    V[regx_index] += V[regy_index];
-    V[0xF] = vF;
-}
+void showMessageBox(const char *title, const char *message, const char *buttons, int textAlignment);
 
-// 8XY5
-void subtractVxVy(uint8_t regx_index, uint8_t regy_index) {
-    uint8_t vF;
-    if (V[regx_index] < V[regy_index]) {
-        vF = 0;
-    } else {
-        vF = 1;
-    }
-    V[regx_index] -= V[regy_index];
-    V[0xF] = vF;
+// Drops the movie being recorded or played, needs lockMachine()
+void stopMovie(void) {
+    if (movie == NULL) return;
+    if (emulation != NULL) setEmuMovie(emulation, NULL);
+    destroyMovie(movie);
+    movie = NULL;
 }
 
-// 8XY6
-void shiftVxRight(uint8_t regx_index, uint8_t regy_index) {
-    if (!superchip_shift) {
-        V[regx_index] = V[regy_index];
-    }
-    uint8_t vF;
-    if (V[regx_index] & 0x1) {
-        vF = 1;
-    } else {
-        vF = 0;
+// Reset emulator or program to initial state
+// Type:
+// 0 - reset program
+// 1 - unload program
+// 2 or any number - reset emulator
+void resetEmulator(uint8_t type) {
+    lockMachine();
+    stopMovie();
+    resetState(&chip, type);
+    if (rewind_buffer != NULL) clearRewindBuffer(rewind_buffer);
+    unlockMachine();
+    if (type >= 1) {
+        if (rom_file_path == 0) {
+            rom_file_path = realloc(rom_file_path, 17 * sizeof(char));
+            strcpy(rom_file_path, rom_file_path_default_message);
+        }
     }
-    V[regx_index] >>= 1;
-    V[0xF] = vF;
-}
-
-// 8XY7
-void subtractVyVx(uint8_t regx_index, uint8_t regy_index) {
-    uint8_t vF;
-    if (V[regy_index] < V[regx_index]) {
-        vF = 0;
-    } else {
-        vF = 1;
+    if (type >= 2) {
+        show_instruction = false;
+        fullscreen_mode = false;
+        dark_mode = true;
+        current_style = 5;
+        d_margin = 0;
+        cpu_speed = 700;
+        turbo_mode = false;
+        step_by_step_mode = false;
+        step_one_instruction = false;
+        show_message_box = false;
+        show_debug_info = false;
+        strcpy(quirks_button_text, "CH");
     }
-    V[regx_index] = V[regy_index] - V[regx_index];
-    V[0xF] = vF;
 }
 
-// 8XYE
-void shiftVxLeft(uint8_t regx_index, uint8_t regy_index) {
-    if (!superchip_shift) {
-        V[regx_index] = V[regy_index];
-    }
-    uint8_t vF;
-    if ((V[regx_index] & 0x80) >> 7) {
-        vF = 1;
-    } else {
-        vF = 0;
-    }
-    V[regx_index] <<= 1;
-    V[0xF] = vF;
+void showNotice(const char *text) {
+    snprintf(notice_text, sizeof(notice_text), "%s", text);
+    notice_until = GetTime() + 2.0;
 }
 
-// 9XY0
-void skipIfVXNotEqVy(uint8_t regx_index, uint8_t regy_index) {
-    if (V[regx_index] != V[regy_index]) {
-        PC += 2;
+// Shows a notification left by the core, if there is one. Needs lockMachine().
+void showChipMessage(void) {
+    if (chip.message != NULL) {
+        showMessageBox(chip.message_title, chip.message, "Close", TEXT_ALIGN_CENTER);
+        chip.message_title = NULL;
+        chip.message = NULL;
     }
 }
 
-// ANNN
-void setINNN(uint16_t addr) {
-    I = addr & 0xFFF;
-}
-
-// BNNN
-void offsetJump(uint16_t addr) {
-    PC = (addr + V[0]) & 0xFFF;
-}
-
-// BXNN (BNNN) superchip quirk behaviour
-// XNN address + VX register
-void offsetJumpSC(uint8_t reg_index, uint8_t addr) {
-    PC = (reg_index << 8) + addr + V[reg_index];
+// Path of the ROM to store in save states, NULL if none is loaded
+const char *savedRomPath(void) {
+    return strcmp(rom_file_path, rom_file_path_default_message) != 0 ? rom_file_path : NULL;
 }
 
-// CXNN
-void randomNNToVx(uint8_t reg_index, uint8_t num) {
-    V[reg_index] = (GetRandomValue(0, UINT16_MAX) & num);
+// Hash flag_store keeps the flags of the ROM at `path` (may be NULL) under, 0 if it can't be read
+uint64_t romFlagsHash(const char *path) {
+    RomProfile profile;
+    return path != NULL && rom_library != NULL && findRomProfile(rom_library, path, &profile) ? profile.hash : 0;
 }
 
-// DXY0
-void drawHighRes(uint8_t regx_index, uint8_t regy_index) {
-    uint16_t x0 = V[regx_index] & (screen_w - 1);
-    uint16_t y0 = V[regy_index] & (screen_h - 1);
-    V[0xF] = 0;
-    for (uint8_t i = 0; i < 16; ++i) {
-        uint16_t line = (memory[(I + i + i) & 0xFFF] << 8) | memory[(I + i + i + 1) & 0xFFF];
-        memory_heatmap[(I + i + i) & 0xFFF] = 0xFF;
-        memory_heatmap[(I + i + i + 1) & 0xFFF] = 0xFF;
-        for (uint16_t j = 0; j < 16; ++j) {
-            uint16_t pixel = (line >> (15 - j)) & 1;
-            uint8_t x = x0 + j;
-            uint8_t y = y0 + i;
-            if (x >= screen_w || y >= screen_h) {
-                break;
-            }
-            uint16_t px = screen_w * y + x;
-            if (screen[px] && pixel) {
-                V[0xF] = 1;
-            }
-            screen[px] ^= pixel;
-        }
+// Stores the flags FX75 sets from now on for ROM `hash` (0 - nowhere). With `load` the machine
+// gets the flags stored for it, otherwise it keeps the ones it has. Needs lockMachine().
+void useRomFlags(uint64_t hash, bool load) {
+    if (load && hash != 0 && flag_store != NULL) {
+        loadRomFlags(flag_store, hash, chip.flag_registers);
     }
+    flags_rom_hash = hash;
+    flags_since_frame = chip.counters.frames;
+    memcpy(stored_flags, chip.flag_registers, FLAG_REGISTERS);
 }
 
-// DXYN
-void draw(uint8_t regx_index, uint8_t regy_index, uint8_t length) {
-    uint16_t x0 = V[regx_index] & (screen_w - 1);
-    uint16_t y0 = V[regy_index] & (screen_h - 1);
-    V[0xF] = 0;
-    for (uint8_t i = 0; i < length; ++i) {
-        uint8_t line = memory[(I + i) & 0xFFF];
-        memory_heatmap[(I + i) & 0xFFF] = 0xFF;
-        for (uint8_t j = 0; j < 8; ++j) {
-            uint8_t pixel = (line >> (7 - j)) & 1;
-            uint16_t x = x0 + j;
-            uint16_t y = y0 + i;
-            if (x >= screen_w || y >= screen_h) {
-                break;
-            }
-            uint16_t px = screen_w * y + x;
-            if (screen[px] && pixel) {
-                V[0xF] = 1;
-            }
-            screen[px] ^= pixel;
-        }
-    }
-}
-
-// EX9E
-void skipIfKeyPressed(uint8_t reg_index) {
-    if (IsKeyDown(chip8_keymap[V[reg_index]]))
-        PC += 2;
-}
-
-// EXA1
-void skipIfKeyNotPressed(uint8_t reg_index) {
-    if (!IsKeyDown(chip8_keymap[V[reg_index]]))
-        PC += 2;
-}
-
-// FX07
-void setVxToDTimer(uint8_t reg_index) {
-    V[reg_index] = delay_timer;
-}
-
-// FX0A
-void getKey(uint8_t reg_index) {
-    if (!waiting_for_key) {
-        waiting_for_key = true;
-    }
-    if (key_released_this_cycle != -1) {
-        V[reg_index] = key_released_this_cycle;
-        waiting_for_key = false;
-        key_released_this_cycle = -1;
+// Hands flags changed by FX75 to flag_store, which writes them in the background
+void syncRomFlags(void) {
+    if (view->counters.frames <= flags_since_frame || memcmp(view->flag_registers, stored_flags, FLAG_REGISTERS) == 0) {
+        return;
     }
-    if (waiting_for_key) {
-        PC -= 2;
+    memcpy(stored_flags, view->flag_registers, FLAG_REGISTERS);
+    if (flag_store != NULL && flags_rom_hash != 0) {
+        storeRomFlags(flag_store, flags_rom_hash, stored_flags);
     }
 }
 
-// FX15
-void setDTimerToVx(uint8_t reg_index) {
-    delay_timer = V[reg_index];
-}
-
-// FX18
-void setSTimerToVx(uint8_t reg_index) {
-    sound_timer = V[reg_index];
-}
-
-// FX1E
-void addToI(uint8_t reg_index) {
-    uint8_t vF;
-    if (I + V[reg_index] > 0xFFF) {
-        vF = 1;
+void saveToSlot(void) {
+    char path[16]; sprintf(path, "state%u.c8s", save_slot);
+    lockMachine();
+    bool saved = saveStateToFile(&chip, savedRomPath(), path);
+    unlockMachine();
+    if (saved) {
+        char notice[32]; sprintf(notice, "Saved to slot %u", save_slot);
+        showNotice(notice);
     } else {
-        vF = 0;
+        showMessageBox("ERROR", "Couldn't write the save state.", "Close", TEXT_ALIGN_CENTER);
     }
-    I += V[reg_index];
-    V[0xF] = vF;
 }
 
-// FX29
-void setIToLowResFontChar(uint8_t reg_index) {
-    I = FONT_MEM_LOC + (V[reg_index] & 0xF) * 5;
+// Quirks button text for the machine, needs lockMachine()
+const char *quirksLabel(void) {
+    if (chip.xochip_instructions_set) {
+        return "XO";
+    }
+    uint8_t quirks = quirkFlags(&chip);
+    return quirks == platformQuirks(0) ? "CH" : quirks == platformQuirks(1) ? "SC" : "AU";
 }
 
-// FX30
-void setIToHighResFontChar(uint8_t reg_index) {
-    I = FONT_MEM_LOC + (V[reg_index] & 0xF) * 32;
+// Brings the ROM path and the quirks button in line with a machine restored from a file
+void afterStateRestored(const char *quirks_label) {
+    if (rom_file_path[0] == '\0') {
+        rom_file_path = realloc(rom_file_path, 17 * sizeof(char));
+        strcpy(rom_file_path, rom_file_path_default_message);
+    }
+    strcpy(quirks_button_text, quirks_label);
 }
 
-// FX33
-void binCodedDecimalConversion(uint8_t reg_index) {
-    memory[I] = V[reg_index] / 100;
-    memory[I + 1] = (V[reg_index] % 100) / 10;
-    memory[I + 2] = V[reg_index] % 10;
-    memory_heatmap[I] = 0xFF;
-    memory_heatmap[I + 1] = 0xFF;
-    memory_heatmap[I + 2] = 0xFF;
+// Restores a save state along with the ROM path and the quirks button
+bool loadFromFile(const char *path) {
+    lockMachine();
+    stopMovie();
+    bool loaded = loadStateFromFile(&chip, path, &rom_file_path);
+    if (loaded && rewind_buffer != NULL) clearRewindBuffer(rewind_buffer);
+    if (loaded) useRomFlags(romFlagsHash(rom_file_path), false); // The state's flags stay until the game stores new ones
+    const char *quirks_label = quirksLabel();
+    showChipMessage();
+    unlockMachine();
+    if (loaded) afterStateRestored(quirks_label);
+    return loaded;
 }
 
-// FX55
-void storeRegistersInMemory(uint8_t reg_index) {
-    memcpy(memory + I, V, reg_index + 1);
-    if (!superchip_reg_mem_load) {
-        I += reg_index + 1;
+void toggleMovieRecording(void) {
+    lockMachine();
+    if (movieStatus(movie) == MOVIE_RECORDING) {
+        bool saved = saveMovie(movie, &chip, MOVIE_FILE);
+        stopMovie();
+        unlockMachine();
+        if (saved)
+            showNotice("Movie saved");
+        else
+            showMessageBox("ERROR", "Couldn't write the movie.", "Close", TEXT_ALIGN_CENTER);
+        return;
     }
+    stopMovie();
+    movie = startMovieRecording(&chip, savedRomPath());
+    setEmuMovie(emulation, movie);
+    unlockMachine();
+    showNotice(movie != NULL ? "Recording" : "Out of memory");
 }
 
-// FX65
-void loadRegistersFromMemory(uint8_t reg_index) {
-    memcpy(V, memory + I, reg_index + 1);
-    if (!superchip_reg_mem_load) {
-        I += reg_index + 1;
-    }
+// Detaches the profiler and writes its call paths
+void stopProfiler(void) {
+    if (profiler == NULL) return;
+    lockMachine();
+    chip.profiler = NULL;
+    unlockMachine();
+    bool saved = saveCollapsedStacks(profiler, PROFILE_FILE);
+    destroyProfiler(profiler);
+    profiler = NULL;
+    showNotice(saved ? "Profile saved to " PROFILE_FILE : "Couldn't write the profile");
 }
 
-// FX75
-// Saves registers state into local storage (instead of real flag registers)
-void saveRegStateToLocalStorage(uint8_t reg_index) {
-    FILE *flag_registers = fopen("chipdata", "wb");
-    if (flag_registers == NULL) {
-        showMessageBox("ERROR", "Error opening/creating the chipdata file\nduring\nsaveRegStateToLocalStorage operation.", "Close", TEXT_ALIGN_CENTER);
+void toggleProfiler(void) {
+    if (profiler != NULL) {
+        stopProfiler();
         return;
     }
-    fwrite(V, sizeof(uint8_t), reg_index + 1, flag_registers);
-    fclose(flag_registers);
-}
-
-// FX85
-// Loads registers state from local storage if possible
-void loadRegStateFromLocalStorage(uint8_t reg_index) {
-    FILE *flag_registers = fopen("chipdata", "rb");
-    if (flag_registers == NULL) {
-        memset(V, 0, reg_index + 1); // If there's no chipdata file, just set registers to 0
-    }
-    fseek(flag_registers, 0, SEEK_END);
-    size_t bytes_in_file = ftell(flag_registers);
-    fseek(flag_registers, 0, SEEK_SET);
-    if (bytes_in_file > 16) {
-        showMessageBox("INFO", "chipdata file this program is trying to use\nis too big,\npossibly corrupted.", "Close", TEXT_ALIGN_CENTER);
+    profiler = createProfiler();
+    if (profiler == NULL) {
+        showNotice("Out of memory");
+        return;
     }
-    fread(V, sizeof(uint8_t), reg_index + 1, flag_registers);
-    fclose(flag_registers);
+    lockMachine();
+    chip.profiler = profiler;
+    unlockMachine();
+    profile_hot_spot_count = 0;
+    profile_subroutine_count = 0;
+    profile_cycles = 0;
+    profile_refresh_time = 0;
+    showNotice("Profiling");
 }
 
-void pollRaylibKeypadReleased(void) {
-    key_released_this_cycle = -1;
-
-    // Detect key release for FX0A
-    for (uint8_t i = 0; i < KEYS_NUM; ++i) {
-        if (IsKeyReleased(chip8_keymap[i])) {
-            key_released_this_cycle = i;
-        }
-    }
-
+// Copies the top of the profile out for drawing, at most twice a second to keep the lock short
+void refreshProfile(void) {
+    if (profiler == NULL || GetTime() < profile_refresh_time) return;
+    lockMachine();
+    profile_cycles = profiledCycles(profiler);
+    profile_hot_spot_count = profileHotSpots(profiler, profile_hot_spots, PROFILE_ROWS);
+    profile_subroutine_count = profileSubroutines(profiler, profile_subroutines, PROFILE_ROWS);
+    unlockMachine();
+    profile_refresh_time = GetTime() + 0.5;
 }
 
-Sound generateBeep(int frequency) {
-    const int sample_rate = 44000;
-    const int sample_size = 16;
-    const float duration_sec = 1.0f;
-
-    int num_samples = (int)(duration_sec * sample_rate);
-    Wave wave = {0};
-    wave.frameCount = num_samples;
-    wave.sampleRate = sample_rate;
-    wave.sampleSize = sample_size;
-    wave.channels = 1;
-
-    short *samples = (short *)malloc(num_samples * sizeof(short));
-    int period = sample_rate / frequency;
-
-    for (int i = 0; i < num_samples; i++) {
-        samples[i] = ((i % period) < (period / 2)) ? 32767 : -32768;
+// Hot spots (address, opcode, share of cycles) and subroutines (inclusive, exclusive share, calls)
+void drawProfilePanel(Rectangle bounds, int font_size, Color background, Color text_color) {
+    DrawRectangleRec(bounds, background);
+    int x = bounds.x + font_size / 2;
+    int y = bounds.y + font_size / 2;
+    int line = font_size + font_size / 3;
+    double total = profile_cycles ? (double)profile_cycles : 1;
+    char text[32];
+
+    DrawText("HOT SPOT", x, y, font_size, text_color);
+    DrawText("OP", x + font_size * 6, y, font_size, text_color);
+    DrawText("CYCLES", x + font_size * 11, y, font_size, text_color);
+    for (uint32_t i = 0; i < profile_hot_spot_count; ++i) {
+        uint16_t addr = profile_hot_spots[i].addr;
+        y += line;
+        sprintf(text, "%03X", addr);
+        DrawText(text, x, y, font_size, text_color);
+        sprintf(text, "%02X%02X", view->memory[addr], view->memory[(addr + 1) & (addressSpace(view) - 1)]);
+        DrawText(text, x + font_size * 6, y, font_size, text_color);
+        sprintf(text, "%.1f%%", 100.0 * profile_hot_spots[i].cycles / total);
+        DrawText(text, x + font_size * 11, y, font_size, text_color);
     }
 
-    wave.data = samples;
-    Sound beep = LoadSoundFromWave(wave);
-    UnloadWave(wave); // frees samples as well
-
-    return beep;
-}
-
-// Type:
-// 0 - CHIP-8
-// 1 - SUPER-CHIP
-void setQuirks(uint8_t type) {
-    if (type != 0) type = 1;
-    superchip_shift = type;
-    superchip_offset_jump = type;
-    superchip_reg_mem_load = type;
-    superchip_no_reset_vf_on_bit_ops = type;
+    y += 2 * line;
+    DrawText("CALLED", x, y, font_size, text_color);
+    DrawText("INCL", x + font_size * 6, y, font_size, text_color);
+    DrawText("EXCL", x + font_size * 11, y, font_size, text_color);
+    DrawText("CALLS", x + font_size * 16, y, font_size, text_color);
+    for (uint32_t i = 0; i < profile_subroutine_count; ++i) {
+        const ProfileSubroutine *sub = &profile_subroutines[i];
+        y += line;
+        if (sub->entry == PROFILE_MAIN)
+            strcpy(text, "main");
+        else
+            sprintf(text, "%03X", sub->entry);
+        DrawText(text, x, y, font_size, text_color);
+        sprintf(text, "%.1f%%", 100.0 * sub->inclusive / total);
+        DrawText(text, x + font_size * 6, y, font_size, text_color);
+        sprintf(text, "%.1f%%", 100.0 * sub->exclusive / total);
+        DrawText(text, x + font_size * 11, y, font_size, text_color);
+        sprintf(text, "%u", sub->calls);
+        DrawText(text, x + font_size * 16, y, font_size, text_color);
+    }
 }
 
-// Set screen resolution
-// Type:
-// 0 or any number - 64x32
-// 1 - 64x64
-// 2 - 128x64
-void setScreenMode(uint8_t type) {
-    switch (type) {
-        case 1:
-            screen_w = 64;
-            screen_h = 64;
-            break;
-        case 2:
-            screen_w = 128;
-            screen_h = 64;
-            break;
-        default: // default - CHIP-8
-            screen_w = 64;
-            screen_h = 32;
-            break;
+void toggleMetricsExport(const char *path) {
+    if (metrics == NULL) return;
+    if (isExportingMetrics(metrics)) {
+        stopMetricsExport(metrics);
+        showNotice("Metrics export stopped");
+    } else if (startMetricsExport(metrics, path, METRICS_EXPORT_INTERVAL)) {
+        char notice[48]; sprintf(notice, "Writing metrics to %s", path);
+        showNotice(notice);
+    } else {
+        showMessageBox("ERROR", "Couldn't create the metrics file.", "Close", TEXT_ALIGN_CENTER);
     }
-    clearScreen();
 }
 
-// Activates SUPER-CHIP instructions
-// Type:
-// 0 - CHIP-8
-// 1 or any other - SUPER-CHIP
-void setInstructions(uint8_t type) {
-    if (type)
-        superchip_instructions_set = true;
-    else
-        superchip_instructions_set = false;
+// Feeds the metrics with the totals of the frame just drawn
+void recordFrameMetrics(void) {
+    if (metrics == NULL) return;
+    MetricsInput input = {
+        GetTime(), emu_frame->ips, turbo_mode ? 0 : cpu_speed, emu_frame->emulation_seconds,
+        render_seconds, emu_frame->timer_underruns, view->counters
+    };
+    recordMetrics(metrics, &input);
 }
 
-// Loads fonts into the memory at 0x000 - 0x09F/0x1FF (depending on size)
-// Type:
-// 0 - lowres (80 bytes)
-// 1 - hires (512 bytes)
-// any other number - set font mem space to 0
-void setFontType(uint8_t type) {
-    memset(memory + FONT_MEM_LOC, 0, PROGRAM_START - 1);
-    if (type == 0) {
-        currently_loaded_font_type = 0;
-        memcpy(memory + FONT_MEM_LOC, lowres_font_sprites, sizeof(lowres_font_sprites));
-    } else if (type == 1) {
-        currently_loaded_font_type = 1;
-        memcpy(memory + FONT_MEM_LOC, hires_font_sprites, sizeof(hires_font_sprites));
+// Bar graph of the newest samples of one metric, one pixel column per sample, scaled to the peak
+void drawMetricGraph(Metric metric, const char *label, Rectangle bounds, Color background, Color bar_color, Color text_color) {
+    DrawRectangleRec(bounds, background);
+    float peak = metricPeak(metrics, metric);
+    uint32_t columns = metricSampleCount(metrics);
+    if (columns > bounds.width) columns = bounds.width;
+    for (uint32_t age = 0; age < columns && peak > 0; ++age) {
+        float height = metricValue(metrics, metric, age) / peak * (bounds.height - 12);
+        DrawRectangle(bounds.x + bounds.width - 1 - age, bounds.y + bounds.height - height, 1, height, bar_color);
     }
+    char text[32]; sprintf(text, "%s %.*f", label, metric == METRIC_IPS ? 0 : 1, metricValue(metrics, metric, 0));
+    DrawText(text, bounds.x + 2, bounds.y + 1, 10, text_color);
 }
 
-// Reset emulator or program to initial state
-// Type:
-// 0 - reset program
-// 1 - unload program
-// 2 or any number - reset emulator
-void resetState(uint8_t type) {
-    I = PROGRAM_START;
-    PC = PROGRAM_START;
-    delay_timer = 0;
-    sound_timer = 0;
-    stack.top = -1;
-    memset(stack.arr, 0, MAX_STACK_SIZE);
-    memset(memory_heatmap, 0, 4096);
-    memset(V, 0, 16);
-    setInstructions(1);
-    setFontType(0);
-    clearScreen();
-    if (type >= 1 || type < 0) {
-        is_rom_loaded = false;
-        if (rom_file_path == 0) {
-            rom_file_path = realloc(rom_file_path, 17 * sizeof(char));
-            strcpy(rom_file_path, rom_file_path_default_message);
-        }
-        memset(memory, 0, 4096);
-        setScreenMode(0);
-    }
-    if (type >= 2 || type < 0) {
-        show_instruction = false;
-        fullscreen_mode = false;
-        dark_mode = true;
-        current_style = 5;
-        d_margin = 0;
-        setQuirks(0);
-        cpu_speed = 700;
-        step_by_step_mode = false;
-        step_one_instruction = false;
-        show_message_box = false;
-        show_debug_info = false;
-        strcpy(quirks_button_text, "CH");
+void drawMetricsOverlay(int x, int y, int width, Color background, Color bar_color, Color text_color) {
+    static const Metric shown[] = {
+        METRIC_IPS, METRIC_EMULATION_MS, METRIC_RENDER_MS, METRIC_DRAWS, METRIC_COLLISIONS,
+        METRIC_CLEARS, METRIC_SCROLLS, METRIC_KEY_WAIT, METRIC_TIMER_UNDERRUNS
+    };
+    static const char *labels[] = { "IPS", "EMU ms", "DRAW ms", "DXYN/f", "HIT/f", "CLS/f", "SCRL/f", "FX0A %", "LATE" };
+    const uint8_t count = sizeof(shown) / sizeof(shown[0]);
+    int graph_width = width / count;
+    for (uint8_t i = 0; i < count; ++i) {
+        drawMetricGraph(shown[i], labels[i], (Rectangle){ x + i * graph_width, y, graph_width - 4, 40 }, background, bar_color, text_color);
     }
 }
 
-// Fetch / Decode / Execute Loop
-void stepOneСycle(void) {
-    // Fetch
-    uint8_t b1 = memory[PC++];
-    uint8_t nibble1 = b1 >> 4;
-    uint8_t nibble2 = b1 & 0xF;
-    uint8_t b2 = memory[PC++];
-    uint8_t nibble3 = b2 >> 4;
-    uint8_t nibble4 = b2 & 0xF;
-    uint16_t opcode = (b1 << 8) | b2;
-    uint16_t addr = (nibble2 << 8) | b2;
-
-    memory_heatmap[PC - 2] = 0xFF;
-    memory_heatmap[PC - 1] = 0xFF;
-
-    // If end of the memory is reached
-    if (PC - 1 >= 0xFFF) {
-        jump(PROGRAM_START);
-        return;
+// Puts the machine into the movie's starting state and replays its input from there
+void playMovie(const char *path) {
+    lockMachine();
+    stopMovie();
+    movie = startMoviePlayback(&chip, path, &rom_file_path);
+    if (movie != NULL && rewind_buffer != NULL) clearRewindBuffer(rewind_buffer);
+    if (movie != NULL) useRomFlags(0, false); // Replays don't overwrite the stored flags
+    setEmuMovie(emulation, movie);
+    const char *quirks_label = quirksLabel();
+    showChipMessage();
+    unlockMachine();
+    if (movie != NULL) {
+        afterStateRestored(quirks_label);
+        showNotice("Playing the movie");
     }
+}
 
-    // Init 64x64 hires mode
-    if (PC == (PROGRAM_START + 2) && opcode == 0x1260) {
-        setScreenMode(1);
-        jump(0x2C0);
-        return;
-    }
+bool hasExtension(const char *path, const char *extension) {
+    size_t length = strlen(path);
+    size_t extension_length = strlen(extension);
+    return length >= extension_length && strcmp(path + length - extension_length, extension) == 0;
+}
 
-    // Decode & Execute
-    switch (nibble1) {
-        case 0x0:
-            switch(opcode) {
-                case 0x00E0:
-                    clearScreen(); // 00E0
-                    break;
-                case 0x00EE:
-                    returnFromSubRoutine(); // 00EE
-                    break;
-                case 0x00FE:
-                    // lores mode
-                    if (superchip_instructions_set) {
-                        setScreenMode(0); // 00FE
-                    }
-                    break;
-                case 0x00FB:
-                    if (superchip_instructions_set) {
-                        scrollDisplayRight(); // 00FB
-                    }
-                    break;
-                case 0x00FC:
-                    if (superchip_instructions_set) {
-                        scrollDisplayLeft(); // 00FC
-                    }
-                    break;
-                case 0x00FF:
-                    // hires mode
-                    if (superchip_instructions_set) {
-                        setScreenMode(2); // 00FF
-                    }
-                    break;
-                case 0x00FD:
-                    if (superchip_instructions_set) {
-                        exit(0);
-                    }
-                    break;
-            }
-            if (b1 == 0x0 && nibble3 == 0xC && superchip_instructions_set) {
-                scrollDisplayDownN(nibble4); // 00CN
-            }
-            break;
-        case 0x1:
-            jump(addr); // 1NNN
-            break;
-        case 0x2:
-            execSubroutine(addr); // 2NNN
-            break;
-        case 0x3:
-            skipIfVxEqNN(nibble2, b2); // 3XNN
-            break;
-        case 0x4:
-            skipIfVxNotEqNN(nibble2, b2); // 4XNN
-            break;
-        case 0x5:
-            if (nibble4 == 0)
-                skipIfVxEqVy(nibble2, nibble3); // 5XY0
-            break;
-        case 0x6:
-            setVXNN(nibble2, b2); // 6XNN
-            break;
-        case 0x7:
-            addNNToVX(nibble2, b2); // 7XNN
-            break;
-        case 0x8:
-            switch (nibble4) {
-                case 0x0:
-                    setVxVy(nibble2, nibble3); // 8XY0
-                    break;
-                case 0x1:
-                    orVxVy(nibble2, nibble3); // 8XY1
-                    break;
-                case 0x2:
-                    andVxVy(nibble2, nibble3); // 8XY2
-                    break;
-                case 0x3:
-                    xorVxVy(nibble2, nibble3); // 8XY3
-                    break;
-                case 0x4:
-                    addVxVy(nibble2, nibble3); // 8XY4
-                    break;
-                case 0x5:
-                    subtractVxVy(nibble2, nibble3); // 8XY5
-                    break;
-                case 0x6:
-                    shiftVxRight(nibble2, nibble3); // 8XY6
-                    break;
-                case 0x7:
-                    subtractVyVx(nibble2, nibble3); // 8XY7
-                    break;
-                case 0xE:
-                    shiftVxLeft(nibble2, nibble3); // 8XYE
-                    break;
-            }
-            break;
-        case 0x9:
-            if (nibble4 == 0)
-                skipIfVXNotEqVy(nibble2, nibble3); // 9XY0
-            break;
-        case 0xA:
-            setINNN(addr); // ANNN
-            break;
-        case 0xB:
-            if (superchip_offset_jump) {
-                offsetJumpSC(nibble2, b2); // BXNN
-            } else {
-                offsetJump(addr); // BNNN
-            }
-            break;
-        case 0xC:
-            randomNNToVx(nibble2, b2); // CXNN
-            break;
-        case 0xD:
-            if (nibble4 == 0x0 && superchip_instructions_set) {
-                drawHighRes(nibble2, nibble3);
-            } else {
-                draw(nibble2, nibble3, nibble4); // DXYN
-            }
-            break;
-        case 0xE:
-            switch(b2) {
-                case 0x9E:
-                    skipIfKeyPressed(nibble2); // EX9E
-                    break;
-                case 0xA1:
-                    skipIfKeyNotPressed(nibble2); // EXA1
-                    break;
-            }
-            break;
-        case 0xF:
-            switch(b2) {
-                case 0x07:
-                    setVxToDTimer(nibble2); // FX07
-                    break;
-                case 0x0A:
-                    getKey(nibble2); // FX0A
-                    break;
-                case 0x15:
-                    setDTimerToVx(nibble2); // FX15
-                    break;
-                case 0x18:
-                    setSTimerToVx(nibble2); // FX18
-                    break;
-                case 0x1E:
-                    addToI(nibble2); // FX1E
-                    break;
-                case 0x29:
-                    if (currently_loaded_font_type != 0) {
-                        setFontType(0);
-                    }
-                    setIToLowResFontChar(nibble2); // FX29
-                    break;
-                case 0x30:
-                    if (superchip_instructions_set) {
-                        if (currently_loaded_font_type == 0) {
-                            setFontType(1);
-                        }
-                        setIToHighResFontChar(nibble2); // FX30
-                    }
-                    break;
-                case 0x33:
-                    binCodedDecimalConversion(nibble2); // FX33
-                    break;
-                case 0x55:
-                    storeRegistersInMemory(nibble2); // FX55
-                    break;
-                case 0x65:
-                    loadRegistersFromMemory(nibble2); // FX65
-                    break;
-                case 0x75:
-                    if (superchip_instructions_set) {
-                        saveRegStateToLocalStorage(nibble2); // FX75
-                    }
-                    break;
-                case 0x85:
-                    if (superchip_instructions_set) {
-                        loadRegStateFromLocalStorage(nibble2); // FX85
-                    }
-                    break;
-            }
-            break;
-        default:
-            break;
+void loadFromSlot(void) {
+    char path[16]; sprintf(path, "state%u.c8s", save_slot);
+    if (!FileExists(path)) {
+        char notice[32]; sprintf(notice, "Slot %u is empty", save_slot);
+        showNotice(notice);
+    } else if (loadFromFile(path)) {
+        char notice[32]; sprintf(notice, "Loaded slot %u", save_slot);
+        showNotice(notice);
     }
 }
 
@@ -1024,30 +788,187 @@ int customMessageBox(Rectangle bounds, const char *title, const char *message, c
     return result;
 }
 
+// Sets the raygui styles for the current theme, only called when it or fullscreen_mode changes
+void applyGuiStyle(Color main_foreground, Color main_background, Color secondary_color, Color main_text_color) {
+    // Generate style base on theme color
+    GuiSetStyle(BUTTON, BORDER_COLOR_PRESSED, ColorToInt(ColorBrightness(main_foreground, 0.3)));
+    GuiSetStyle(BUTTON, BORDER_COLOR_FOCUSED, ColorToInt(ColorBrightness(main_foreground, -0.3)));
+    GuiSetStyle(BUTTON, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
+
+    GuiSetStyle(BUTTON, BASE_COLOR_PRESSED, ColorToInt(ColorBrightness(secondary_color, 0.5)));
+    GuiSetStyle(BUTTON, BASE_COLOR_FOCUSED, ColorToInt(ColorBrightness(secondary_color, -0.5)));
+    GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(secondary_color));
+
+    if (dark_mode)
+        GuiSetStyle(BUTTON, TEXT_COLOR_PRESSED, ColorToInt(ColorBrightness(main_text_color, 0.3)));
+    else 
+        GuiSetStyle(BUTTON, TEXT_COLOR_PRESSED, ColorToInt(ColorBrightness(main_text_color, -0.3)));
+    GuiSetStyle(BUTTON, TEXT_COLOR_FOCUSED, ColorToInt(ColorBrightness(main_text_color, -0.3)));
+    GuiSetStyle(BUTTON, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
+
+    // Style for messagebox, instruction window
+    GuiSetStyle(STATUSBAR, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
+    GuiSetStyle(STATUSBAR, BASE_COLOR_NORMAL, ColorToInt(main_background));
+    GuiSetStyle(STATUSBAR, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
+    GuiSetStyle(DEFAULT, BACKGROUND_COLOR, ColorToInt(main_background));
+    GuiSetStyle(DEFAULT, LINE_COLOR, ColorToInt(main_foreground));
+    GuiSetStyle(LABEL, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
+    GuiSetStyle(LABEL, BASE_COLOR_NORMAL, ColorToInt(secondary_color));
+    GuiSetStyle(LABEL, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
+
+    // The only button in fullscreen sits on the background
+    if (fullscreen_mode) {
+        GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(main_background)); // To keep base_color opaque
+        GuiSetStyle(BUTTON, BASE_COLOR_FOCUSED, ColorToInt(main_background));
+        GuiSetStyle(BUTTON, BASE_COLOR_PRESSED, ColorToInt(main_background));
+    }
+    applied_style = current_style;
+    applied_dark_mode = dark_mode;
+    applied_fullscreen_mode = fullscreen_mode;
+}
+
+// Text of a readout as "label: value" in `digits` hex digits, formatted again only when the value changes
+const char *formatReadout(Readout *readout, const char *label, uint32_t value, uint8_t digits) {
+    if (!readout->formatted || readout->value != value) {
+        snprintf(readout->text, sizeof(readout->text), "%s: %0*X", label, digits, value);
+        readout->value = value;
+        readout->formatted = true;
+    }
+    return readout->text;
+}
+
+// Once nothing but input can change the screen (the machine is stepped by hand or has no ROM, its timers
+// are out and no notice is showing), EndDrawing() blocks until input arrives instead of drawing the same
+// frame 60 times a second. A running machine in an unfocused or minimized window is drawn less often,
+// the emulation thread keeps its own pace either way. Called right before EndDrawing().
+void updateFrameRate(void) {
+    double time = GetTime();
+    bool stopped = step_by_step_mode || !view->is_rom_loaded;
+    if (!stopped || step_one_instruction || IsKeyDown(KEY_N) || IsKeyDown(KEY_BACKSPACE) || view->delay_timer > 0
+        || view->sound_timer > 0 || emu_frame->movie_status != MOVIE_NONE || time < notice_until) {
+        busy_until = time + IDLE_DELAY;
+    }
+    bool idle = time >= busy_until;
+    if (idle != waiting_for_events) {
+        if (idle)
+            EnableEventWaiting();
+        else
+            DisableEventWaiting();
+        waiting_for_events = idle;
+    }
+    bool background = !idle && (!IsWindowFocused() || IsWindowMinimized());
+    if (background != in_background) {
+        SetTargetFPS(background ? BACKGROUND_FPS : 60);
+        in_background = background;
+    }
+}
+
 void raylibProcess() {
 
     // Raylib events (not all events are here, some are inline in UI code)
     if (IsFileDropped()) {
         FilePathList droppedFiles = LoadDroppedFiles();
-        resetState(1);
-        rom_file_path = realloc(rom_file_path, (strlen(droppedFiles.paths[0]) + 1) * sizeof(char));
-        strcpy(rom_file_path, droppedFiles.paths[0]);
-        loadROM(rom_file_path);
+        if (hasExtension(droppedFiles.paths[0], ".c8m")) {
+            playMovie(droppedFiles.paths[0]);
+        } else if (hasExtension(droppedFiles.paths[0], ".c8s")) {
+            loadFromFile(droppedFiles.paths[0]);
+        } else {
+            resetEmulator(1);
+            rom_file_path = realloc(rom_file_path, (strlen(droppedFiles.paths[0]) + 1) * sizeof(char));
+            strcpy(rom_file_path, droppedFiles.paths[0]);
+            RomProfile profile;
+            bool has_profile = rom_library != NULL && findRomProfile(rom_library, rom_file_path, &profile);
+            if (has_profile && !profile.quirks_detected) {
+                int size = 0;
+                unsigned char *rom = LoadFileData(rom_file_path, &size);
+                if (rom != NULL) {
+                    profile.quirks = detectQuirks(quirk_pool, rom, size, profile.platform, profile.cpu_speed, profile.quirks, NULL);
+                    setRomQuirks(rom_library, profile.hash, profile.quirks);
+                    UnloadFileData(rom);
+                }
+            }
+            lockMachine();
+            if (has_profile) applyRomProfile(&chip, &profile);
+            loadROM(&chip, rom_file_path);
+            useRomFlags(has_profile ? profile.hash : 0, true);
+            const char *quirks_label = quirksLabel();
+            showChipMessage();
+            unlockMachine();
+            if (has_profile) {
+                cpu_speed = profile.cpu_speed;
+                strcpy(quirks_button_text, quirks_label);
+            }
+        }
         UnloadDroppedFiles(droppedFiles);
     }
 
+    if (IsKeyPressed(KEY_F2)) {
+        run_ahead = (run_ahead + 1) % (EMU_MAX_RUN_AHEAD + 1);
+        char notice[32];
+        if (run_ahead > 0)
+            sprintf(notice, "Run-ahead: %u frame%s", run_ahead, run_ahead > 1 ? "s" : "");
+        else
+            strcpy(notice, "Run-ahead off");
+        showNotice(notice);
+    }
+    if (IsKeyPressed(KEY_O)) {
+        // Off, erased pixels kept for 2 frames, or fading to half every 3 frames
+        PostFxSettings settings = postFxSettings(display_fx);
+        settings.persistence = (settings.persistence + 1) % 3;
+        settings.frames = settings.persistence == PERSISTENCE_OR ? 2 : 3;
+        setPostFxSettings(display_fx, settings);
+        const char *names[] = { "Persistence off", "Persistence: 2 frames", "Persistence: phosphor fade" };
+        showNotice(names[settings.persistence]);
+    }
+    if (IsKeyPressed(KEY_I)) {
+        PostFxSettings settings = postFxSettings(display_fx);
+        settings.scale = settings.scale % POSTFX_MAX_SCALE + 1;
+        setPostFxSettings(display_fx, settings);
+        const char *names[] = { "Smoothing off", "Smoothing: Scale2x", "Smoothing: Scale3x" };
+        showNotice(names[settings.scale - 1]);
+    }
     if (IsKeyPressed(KEY_F3)) show_debug_info = !show_debug_info;
+    if (IsKeyPressed(KEY_F4))
+        toggleMetricsExport(IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT) ? METRICS_JSON_FILE : METRICS_CSV_FILE);
+    if (IsKeyPressed(KEY_F5)) saveToSlot();
+    if (IsKeyPressed(KEY_F9)) loadFromSlot();
+    if (IsKeyPressed(KEY_F8)) toggleMovieRecording();
+    if (IsKeyPressed(KEY_F10)) {
+        if (FileExists(MOVIE_FILE))
+            playMovie(MOVIE_FILE);
+        else
+            showNotice("No movie recorded yet");
+    }
+    if (IsKeyPressed(KEY_F6) || IsKeyPressed(KEY_F7)) {
+        save_slot = (save_slot + (IsKeyPressed(KEY_F7) ? 1 : 9)) % 10;
+        char notice[32]; sprintf(notice, "Slot %u", save_slot);
+        showNotice(notice);
+    }
+    if (IsKeyPressed(KEY_P)) toggleProfiler();
+    if (IsKeyPressed(KEY_G)) {
+        lockMachine();
+        bool jit_changed = setJit(&chip, chip.jit == NULL);
+        unlockMachine();
+        if (!jit_changed) {
+            showMessageBox("INFO", "JIT isn't supported on this platform.", "Close", TEXT_ALIGN_CENTER);
+        }
+    }
     if (IsKeyPressed(KEY_L)) {
         if (strcmp(rom_file_path, rom_file_path_default_message) != 0) {
-            resetState(1);
-            loadROM(rom_file_path);
+            resetEmulator(1);
+            lockMachine();
+            loadROM(&chip, rom_file_path);
+            useRomFlags(romFlagsHash(rom_file_path), true);
+            showChipMessage();
+            unlockMachine();
         } else {
             showMessageBox("INFO", "No ROM file has been loaded yet.\nDrag & Drop the file into the window to start.", "Close", TEXT_ALIGN_CENTER);
         }
     };
-    if (IsKeyPressed(KEY_K)) resetState(0);
+    if (IsKeyPressed(KEY_K)) resetEmulator(0);
     if (IsKeyPressed(KEY_J)) fullscreen_mode = !fullscreen_mode;
     if (IsKeyPressed(KEY_M)) step_by_step_mode = !step_by_step_mode;
+    if (IsKeyPressed(KEY_T)) turbo_mode = !turbo_mode;
     if (IsKeyDown(KEY_N)) step_one_instruction = true;
     if (IsKeyPressed(KEY_TAB)) {
         // Yes, it's a code from the analogous button, but I don't wanna make a function for that
@@ -1081,6 +1002,7 @@ void raylibProcess() {
         else
             main_background = ColorBrightness(main_foreground, 0.9);
         Color secondary_color = Fade(main_foreground, 0.1);
+        updateDisplayPalette(main_foreground);
         ClearBackground(main_background);
         Color main_text_color;
         if (main_background.r + main_background.g + main_background.b < 128)
@@ -1088,59 +1010,43 @@ void raylibProcess() {
         else 
             main_text_color = BLACK;
 
-        // Generate style base on theme color
-        GuiSetStyle(BUTTON, BORDER_COLOR_PRESSED, ColorToInt(ColorBrightness(main_foreground, 0.3)));
-        GuiSetStyle(BUTTON, BORDER_COLOR_FOCUSED, ColorToInt(ColorBrightness(main_foreground, -0.3)));
-        GuiSetStyle(BUTTON, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
-
-        GuiSetStyle(BUTTON, BASE_COLOR_PRESSED, ColorToInt(ColorBrightness(secondary_color, 0.5)));
-        GuiSetStyle(BUTTON, BASE_COLOR_FOCUSED, ColorToInt(ColorBrightness(secondary_color, -0.5)));
-        GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(secondary_color));
-
-        if (dark_mode)
-            GuiSetStyle(BUTTON, TEXT_COLOR_PRESSED, ColorToInt(ColorBrightness(main_text_color, 0.3)));
-        else 
-            GuiSetStyle(BUTTON, TEXT_COLOR_PRESSED, ColorToInt(ColorBrightness(main_text_color, -0.3)));
-        GuiSetStyle(BUTTON, TEXT_COLOR_FOCUSED, ColorToInt(ColorBrightness(main_text_color, -0.3)));
-        GuiSetStyle(BUTTON, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
-
-        // Style for messagebox, instruction window
-        GuiSetStyle(STATUSBAR, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
-        GuiSetStyle(STATUSBAR, BASE_COLOR_NORMAL, ColorToInt(main_background));
-        GuiSetStyle(STATUSBAR, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
-        GuiSetStyle(DEFAULT, BACKGROUND_COLOR, ColorToInt(main_background));
-        GuiSetStyle(DEFAULT, LINE_COLOR, ColorToInt(main_foreground));
-        GuiSetStyle(LABEL, BORDER_COLOR_NORMAL, ColorToInt(main_foreground));
-        GuiSetStyle(LABEL, BASE_COLOR_NORMAL, ColorToInt(secondary_color));
-        GuiSetStyle(LABEL, TEXT_COLOR_NORMAL, ColorToInt(main_text_color));
+        if (applied_style != current_style || applied_dark_mode != dark_mode || applied_fullscreen_mode != fullscreen_mode)
+            applyGuiStyle(main_foreground, main_background, secondary_color, main_text_color);
 
         // Emulator display
         if (fullscreen_mode) {
-            uint16_t scaleX = (GetScreenWidth() - 2 * border_margin - 2 * border_width) / screen_w;
-            uint16_t scaleY = (GetScreenHeight() - 2 * border_margin - 2 * border_width) / screen_h;
+            uint16_t scaleX = (GetScreenWidth() - 2 * border_margin - 2 * border_width) / view->screen_w;
+            uint16_t scaleY = (GetScreenHeight() - 2 * border_margin - 2 * border_width) / view->screen_h;
             d_px_size = (scaleX < scaleY) ? scaleX : scaleY;
-            d_x = (GetScreenWidth() - d_px_size * screen_w - 2 * border_margin - 2 * border_width) / 2;
-            d_y = (GetScreenHeight() - d_px_size * screen_h - 2 * border_margin - 2 * border_width) / 2;
+            d_x = (GetScreenWidth() - d_px_size * view->screen_w - 2 * border_margin - 2 * border_width) / 2;
+            d_y = (GetScreenHeight() - d_px_size * view->screen_h - 2 * border_margin - 2 * border_width) / 2;
         } else {
-            d_px_size = GetScreenWidth() * 0.7 / screen_w;
-            if ((d_px_size * screen_h + 2 * border_margin + 2 * border_width) > GetScreenHeight()) {
-                d_px_size = (GetScreenHeight() - 2 * border_width - 2 * border_margin) / screen_h;
+            d_px_size = GetScreenWidth() * 0.7 / view->screen_w;
+            if ((d_px_size * view->screen_h + 2 * border_margin + 2 * border_width) > GetScreenHeight()) {
+                d_px_size = (GetScreenHeight() - 2 * border_width - 2 * border_margin) / view->screen_h;
             }
-            d_x = GetScreenWidth() - d_px_size * screen_w - border_margin - border_width - global_margin;
+            d_x = GetScreenWidth() - d_px_size * view->screen_w - border_margin - border_width - global_margin;
             d_y = global_margin + border_margin + border_width;
         }
 
-        DrawRectangle(d_x - border_margin, d_y - border_margin, screen_w * d_px_size + 2 * border_margin - d_margin, screen_h * d_px_size + 2 * border_margin - d_margin, secondary_color);
-        DrawRectangle(d_x - border_width - border_margin, d_y - border_width - border_margin, screen_w * d_px_size + 2 * border_width + 2 * border_margin - d_margin, border_width, main_foreground);
-        DrawRectangle(d_x - border_width - border_margin, d_y + screen_h * d_px_size + border_margin - d_margin, screen_w * d_px_size + 2 * border_width + 2 * border_margin - d_margin, border_width, main_foreground);
-        DrawRectangle(d_x - border_width - border_margin, d_y - border_margin, border_width, screen_h * d_px_size + 2 * border_margin - d_margin, main_foreground);
-        DrawRectangle(d_x + screen_w * d_px_size + border_margin - d_margin, d_y - border_margin, border_width, screen_h * d_px_size + 2 * border_margin - d_margin, main_foreground);
+        DrawRectangle(d_x - border_margin, d_y - border_margin, view->screen_w * d_px_size + 2 * border_margin - d_margin, view->screen_h * d_px_size + 2 * border_margin - d_margin, secondary_color);
+
+        // Whole screen in one textured quad, then the gaps painted with the color showing behind unlit pixels.
+        // Drawn before the borders, which cover the gap of the last column and row.
+        updateDisplayTexture();
+        Rectangle display_rect = { d_x, d_y, view->screen_w * d_px_size, view->screen_h * d_px_size };
+        uint16_t display_w, display_h;
+        postFxPixels(display_fx, &display_w, &display_h);
+        DrawTexturePro(display_texture, (Rectangle){ 0, 0, display_w, display_h }, display_rect, (Vector2){ 0, 0 }, 0, WHITE);
+        Color gap_color = ColorAlphaBlend(main_background, secondary_color, WHITE);
+        if (postFxSettings(display_fx).scale == 1) // Smoothed pixels run into each other, there's no grid left to show
+            drawGapMask(&display_gap_mask, display_rect, d_px_size, d_margin, gap_color);
+
+        DrawRectangle(d_x - border_width - border_margin, d_y - border_width - border_margin, view->screen_w * d_px_size + 2 * border_width + 2 * border_margin - d_margin, border_width, main_foreground);
+        DrawRectangle(d_x - border_width - border_margin, d_y + view->screen_h * d_px_size + border_margin - d_margin, view->screen_w * d_px_size + 2 * border_width + 2 * border_margin - d_margin, border_width, main_foreground);
+        DrawRectangle(d_x - border_width - border_margin, d_y - border_margin, border_width, view->screen_h * d_px_size + 2 * border_margin - d_margin, main_foreground);
+        DrawRectangle(d_x + view->screen_w * d_px_size + border_margin - d_margin, d_y - border_margin, border_width, view->screen_h * d_px_size + 2 * border_margin - d_margin, main_foreground);
 
-        for (int16_t y = 0; y < screen_h; ++y) {
-            for (int16_t x = 0; x < screen_w; ++x) {
-                if (screen[screen_w*y+x]) DrawRectangle(d_x + x * d_px_size, d_y + y * d_px_size, d_px_size - d_margin, d_px_size - d_margin, main_foreground);
-            }
-        }
 
         int16_t md_row_length = 32;
         int16_t md_row_num = 32;
@@ -1167,7 +1073,7 @@ void raylibProcess() {
             DrawRectangle(md_r_x, md_lr_y, border_width, md_lr_h, main_foreground);
 
             if (GetMouseX() > md_lud_x && GetMouseX() < md_r_x && GetMouseY() < md_d_y && GetMouseY() > md_u_y) {
-                memory_heatmap_start -= (int16_t)GetMouseWheelMove() * md_row_length;
+                memory_heatmap_start -= (int32_t)GetMouseWheelMove() * md_row_length;
             }
 
             if (GetMouseX() > md_lud_x && GetMouseX() < md_r_x && GetMouseY() < md_d_y && GetMouseY() > md_u_y 
@@ -1187,107 +1093,70 @@ void raylibProcess() {
 
             if (memory_heatmap_start < 0) {
                 memory_heatmap_start = 0;
-            } else if (memory_heatmap_start >= 4096 - md_row_num * md_row_length) {
-                memory_heatmap_start = 4096 - md_row_num * md_row_length;
+            } else if (memory_heatmap_start >= (int32_t)addressSpace(view) - md_row_num * md_row_length) {
+                memory_heatmap_start = addressSpace(view) - md_row_num * md_row_length;
             }
+            if (emulation != NULL) setEmuHeatmapWindow(emulation, memory_heatmap_start);
 
-            for (int16_t i = memory_heatmap_start; i < memory_heatmap_start + md_row_num * md_row_length; ++i) {
+            // Brightness is derived from the access ticks only for the visible cells: executed bytes
+            // light up as before, reads fade in yellow and writes in orange on top of them
+            for (int32_t i = memory_heatmap_start; i < memory_heatmap_start + md_row_num * md_row_length; ++i) {
                 Color cell_color;
-                if (i == PC) {
+                if (i == view->PC) {
                     cell_color = RED;
                 } else if (i == PROGRAM_START) {
                     cell_color = DARKBLUE;
-                } else if ((currently_loaded_font_type == 0 && i < 0x50) || (currently_loaded_font_type == 1 && i < PROGRAM_START)) {
+                } else if ((view->currently_loaded_font_type == 0 && i < 0x50) || (view->currently_loaded_font_type == 1 && i < PROGRAM_START)) {
                     cell_color = BLUE;
-                } else if (memory[i] == 0x00) {
+                } else if (view->memory[i] == 0x00) {
                     cell_color = GRAY;
                 } else {
                     cell_color = GREEN;
                 }
-                double brightness = (memory_heatmap[i] / 255.0) - 0.3;
-                if (brightness < 0)
-                    brightness = 0;
-                DrawRectangle(md_x + (i - (int) memory_heatmap_start) % md_row_length * md_cell_size,
-                            md_y + (i - (int) memory_heatmap_start) / md_row_length * md_cell_size,
-                            md_cell_size - md_margin, md_cell_size - md_margin, memory_heatmap[i] == 0 ? cell_color : ColorBrightness(cell_color, brightness));
+                float execute_heat = heatmapHeat(i, HEATMAP_EXECUTE);
+                float read_heat = heatmapHeat(i, HEATMAP_READ);
+                float write_heat = heatmapHeat(i, HEATMAP_WRITE);
+                if (execute_heat > 0)
+                    cell_color = ColorBrightness(cell_color, execute_heat > 0.3f ? execute_heat - 0.3f : 0);
+                if (read_heat > 0)
+                    cell_color = ColorLerp(cell_color, YELLOW, read_heat * 0.8f);
+                if (write_heat > 0)
+                    cell_color = ColorLerp(cell_color, ORANGE, write_heat * 0.8f);
+                memory_panel_pixels[i - memory_heatmap_start] = cell_color;
             }
+            UpdateTexture(memory_panel_texture, memory_panel_pixels);
+            Rectangle md_rect = { md_x, md_y, md_row_length * md_cell_size, md_row_num * md_cell_size };
+            DrawTexturePro(memory_panel_texture, (Rectangle){ 0, 0, md_row_length, md_row_num }, md_rect, (Vector2){ 0, 0 }, 0, WHITE);
+            drawGapMask(&memory_panel_gap_mask, md_rect, md_cell_size, md_margin, gap_color);
+            if (profiler != NULL)
+                drawProfilePanel(md_rect, md_cell_size, main_background, main_text_color);
         }
 
-        if (!is_rom_loaded) {
+        if (!view->is_rom_loaded) {
             uint16_t font_size = d_px_size * 4;
-            DrawText("Drag & Drop", d_x + d_px_size * screen_w / 2.0 - font_size * 3.0, d_y + d_px_size * screen_h / 2.0 - font_size / 2.0, font_size, main_foreground);
+            DrawText("Drag & Drop", d_x + d_px_size * view->screen_w / 2.0 - font_size * 3.0, d_y + d_px_size * view->screen_h / 2.0 - font_size / 2.0, font_size, main_foreground);
         }
 
         if (!fullscreen_mode) {
             // Draw registers, I, PC, CURRENT_OPCODE, STACK TOP
             for (int i = 0; i < 16; ++i) {
-                char reg_info[16];
-                if (V[i] < 0x10) {
-                    sprintf(reg_info, "%X: 0%X", i, V[i]);
-                } else {
-                    sprintf(reg_info, "%X: %X", i, V[i]);
-                }
+                const char *reg_info = formatReadout(&v_readouts[i], (char[2]){ "0123456789ABCDEF"[i], '\0' }, view->V[i], 2);
                 if (i < 8)
                     DrawText(reg_info, md_x + i * md_cell_size * 4, md_y + md_lr_h + 8, md_cell_size, main_text_color);
                 else 
                     DrawText(reg_info, md_x + i % 8 * md_cell_size * 4, md_y + md_lr_h + 2 * 8 + md_cell_size, md_cell_size, main_text_color);
             }
-            char pc_info[16];
-            char i_info[16];
-            char opcode_info[16];
-            char stack_top_info[16];
-            char dtimer_info[16];
-            char stimer_info[16];
-
-            if (I < 0x10)
-                sprintf(i_info, "I: 00%X", I);
-            else if (I < 0x100)
-                sprintf(i_info, "I: 0%X", I);
-            else
-                sprintf(i_info, "I: %X", I);
-
-            if (PC < 0x10)
-                sprintf(pc_info, "PC: 00%X", PC);
-            else if (PC < 0x100)
-                sprintf(pc_info, "PC: 0%X", PC);
-            else
-                sprintf(pc_info, "PC: %X", PC);
-
-            uint16_t opcode = (memory[PC] << 8) | memory[PC + 1];
-            if (opcode < 0x10)
-                sprintf(opcode_info, "OP: 000%X", opcode);
-            else if (opcode < 0x100)
-                sprintf(opcode_info, "OP: 00%X", opcode);
-            else if (opcode < 0x1000)
-                sprintf(opcode_info, "OP: 0%X", opcode);
+            const char *i_info = formatReadout(&i_readout, "I", view->I, 3);
+            const char *pc_info = formatReadout(&pc_readout, "PC", view->PC, 3);
+            uint16_t opcode = (view->memory[view->PC & (addressSpace(view) - 1)] << 8) | view->memory[(view->PC + 1) & (addressSpace(view) - 1)];
+            const char *opcode_info = formatReadout(&opcode_readout, "OP", opcode, 4);
+            const char *stack_top_info;
+            if (isStackFull(view))
+                stack_top_info = "SP: XXXX";
             else
-                sprintf(opcode_info, "OP: %X", opcode);
-
-            uint16_t stack_top_addr = stack.arr[stack.top];
-            if (stack_top_addr < 0x10)
-                sprintf(stack_top_info, "SP: 000%X", stack_top_addr);
-            else if (stack_top_addr < 0x100)
-                sprintf(stack_top_info, "SP: 00%X", stack_top_addr);
-            else if (stack_top_addr < 0x1000)
-                sprintf(stack_top_info, "SP: 0%X", stack_top_addr);
-            else
-                sprintf(stack_top_info, "SP: %X", stack_top_addr);
-            if (isStackEmpty())
-                sprintf(stack_top_info, "SP: 0000");
-            else if (isStackFull())
-                sprintf(stack_top_info, "SP: XXXX");
-
-            if (delay_timer < 0x10) {
-                sprintf(dtimer_info, "D: 0%X", delay_timer);
-            } else {
-                sprintf(dtimer_info, "D: %X", delay_timer);
-            }
-
-            if (sound_timer < 0x10) {
-                sprintf(stimer_info, "S: 0%X", sound_timer);
-            } else {
-                sprintf(stimer_info, "S: %X", sound_timer);
-            }
+                stack_top_info = formatReadout(&stack_top_readout, "SP", isStackEmpty(view) ? 0 : view->stack[view->sp - 1], 4);
+            const char *dtimer_info = formatReadout(&dtimer_readout, "D", view->delay_timer, 2);
+            const char *stimer_info = formatReadout(&stimer_readout, "S", view->sound_timer, 2);
 
             DrawText(i_info, md_x, md_y + md_lr_h + 3 * 8 + 2 * md_cell_size, md_cell_size, main_text_color);
             DrawText(pc_info, md_x + md_cell_size * 5, md_y + md_lr_h + 3 * 8 + 2 * md_cell_size, md_cell_size, main_text_color);
@@ -1337,22 +1206,27 @@ void raylibProcess() {
             }
 
             if (GuiButton((Rectangle){ button_x_dest, button_y_dest + button_size + button_margin, button_size, button_size}, quirks_button_text)) {
-                if (quirks_button_text[0] == 'S') {
-                    setQuirks(0);
-                    strcpy(quirks_button_text, "CH");
-                } else {
-                    setQuirks(1);
-                    strcpy(quirks_button_text, "SC");
-                }
+                // CH -> SC -> XO -> CH, XO-CHIP also brings its instructions and memory
+                uint8_t type = quirks_button_text[0] == 'C' ? 1 : quirks_button_text[0] == 'S' ? 2 : 0;
+                lockMachine();
+                setQuirks(&chip, type);
+                setInstructions(&chip, type == 2 ? 2 : 1);
+                unlockMachine();
+                strcpy(quirks_button_text, type == 2 ? "XO" : type == 1 ? "SC" : "CH");
             }
 
             if (GetMouseX() >= button_x_dest + button_size_with_margin && GetMouseX() <= button_x_dest + button_size_with_margin + button_size
                 && GetMouseY() >= button_y_dest + button_size + button_margin && GetMouseY() <= button_y_dest + 2 * button_size + button_margin
                 ) {
-                cpu_speed += (uint16_t)GetMouseWheelMove();
+                int64_t speed = (int64_t)cpu_speed + (int32_t)GetMouseWheelMove();
+                cpu_speed = speed < 0 ? 0 : speed > MAX_CPU_SPEED ? MAX_CPU_SPEED : (uint32_t)speed;
             }
 
-            char cpu_speed_text[16]; sprintf(cpu_speed_text, "%dhz", cpu_speed);
+            char cpu_speed_text[16];
+            if (turbo_mode)
+                sprintf(cpu_speed_text, "%.1fM", emu_frame->ips / 1e6);
+            else
+                sprintf(cpu_speed_text, "%uhz", cpu_speed);
             if (GuiButton((Rectangle){ button_x_dest + button_size_with_margin, button_y_dest + button_size + button_margin, button_size, button_size}, cpu_speed_text) || IsKeyPressed(KEY_H)) {
                 if (cpu_speed < 700)
                     cpu_speed = 700;
@@ -1362,12 +1236,12 @@ void raylibProcess() {
                     cpu_speed = 1500;
                 else if (cpu_speed < 2100 && cpu_speed >= 1500)
                     cpu_speed = 2100;
-                else if (cpu_speed >= 2100)
-                    cpu_speed = 0;
+                else
+                    cpu_speed = 700; // Back to the first preset, also from the faster speeds of ROM profiles
             };
 
             if (GuiButton((Rectangle){ button_x_dest + 2 * button_size_with_margin, button_y_dest + button_size + button_margin, button_size, button_size}, "#76#")) {
-                resetState(0);
+                resetEmulator(0);
             };
 
             if (GuiButton((Rectangle){ button_x_dest + 3 * button_size_with_margin, button_y_dest + button_size + button_margin, button_size, button_size}, step_by_step_mode ? "#131#" : "#132#")) {
@@ -1384,9 +1258,6 @@ void raylibProcess() {
                 if (step_by_step_mode) step_one_instruction = true;
             }
         } else {
-            GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(main_background)); // To keep base_color opaque
-            GuiSetStyle(BUTTON, BASE_COLOR_FOCUSED, ColorToInt(main_background));
-            GuiSetStyle(BUTTON, BASE_COLOR_PRESSED, ColorToInt(main_background));
             if (GuiButton((Rectangle){ 16, GetScreenHeight() - 48, 32, 32}, "#103#"))
                 fullscreen_mode = false;
         }
@@ -1417,84 +1288,157 @@ void raylibProcess() {
 
         if(show_debug_info) {
             DrawFPS(global_margin, GetScreenHeight() - 32);
-            char debug_info1[32]; sprintf(debug_info1, "Time: %.2f", GetTime());
-            char debug_info2[256]; sprintf(debug_info2, "ROMpath: %s", rom_file_path);
-            char debug_info3[32]; sprintf(debug_info3, "Screen size: %dx%d", GetScreenWidth(), GetScreenHeight());
+            char debug_info1[64]; sprintf(debug_info1, "Time: %.2f Rewind: %.0fs %zuKB", GetTime(),
+                (double)emu_frame->rewind_frames / TIMER_SPEED, emu_frame->rewind_bytes >> 10);
+            char debug_info2[320]; snprintf(debug_info2, sizeof(debug_info2), "Run-ahead: %u (snapshot %.2fus, restore %.2fus) ROMpath: %s", emu_frame->run_ahead,
+                emu_frame->snapshot_seconds * 1e6, emu_frame->restore_seconds * 1e6, rom_file_path);
+            char debug_info3[96]; sprintf(debug_info3, "Screen size: %dx%d Core: %s IPS: %.0f%s", GetScreenWidth(), GetScreenHeight(),
+                view->jit ? "JIT" : "interpreter", emu_frame->ips, turbo_mode ? " (turbo)" : "");
             DrawText(debug_info1, 2 * global_margin + 20 * 4, GetScreenHeight() - 32, 20, main_text_color);
             DrawText(debug_info2, global_margin, GetScreenHeight() - 64 + 8, 16, main_text_color);
             DrawText(debug_info3, 3 * global_margin + 20 * (4 + (strlen(debug_info1) / 2)), GetScreenHeight() - 32, 20, main_text_color);
+            if (metrics != NULL)
+                drawMetricsOverlay(global_margin, GetScreenHeight() - 112, GetScreenWidth() - 2 * global_margin,
+                    Fade(main_background, 0.85f), Fade(main_foreground, 0.7f), main_text_color);
         }
+        char movie_text[32] = "";
+        if (emu_frame->movie_status == MOVIE_RECORDING)
+            sprintf(movie_text, "REC %.1fs", (double)emu_frame->movie_frame / TIMER_SPEED);
+        else if (emu_frame->movie_status == MOVIE_PLAYING)
+            sprintf(movie_text, "PLAY %.1fs", (double)emu_frame->movie_frame / TIMER_SPEED);
+        if (GetTime() >= notice_until && movie_text[0] != '\0') {
+            DrawText(movie_text, GetScreenWidth() - MeasureText(movie_text, 20) - global_margin, GetScreenHeight() - 32, 20, main_text_color);
+        } else if (GetTime() < notice_until) {
+            DrawText(notice_text, GetScreenWidth() - MeasureText(notice_text, 20) - global_margin, GetScreenHeight() - 32, 20, main_text_color);
+        }
+        render_seconds = GetTime() - frame_start_time;
+        updateFrameRate();
         EndDrawing();
 }
 
-int main() {
-    resetState(2);
+int main(int argc, char **argv) {
+    initChip8(&chip);
+    chip.memory_heatmap = &memory_heatmap;
+    setDecodeCache(&chip, true);
+    setJit(&chip, true); // Stays on the decode cache if there's no JIT for this platform
+    resetEmulator(2);
+    seedRandom(&chip, (uint32_t)time(NULL)); // CXNN differs between runs, movies store the state they need
 
     SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_VSYNC_HINT);
     InitWindow(900, 600, "CHIP Emulator");
     SetWindowMinSize(885, 500);
     SetTargetFPS(60);
-    InitAudioDevice();
-    Sound beep = generateBeep(440);
-    SetSoundVolume(beep, 0.1f);
-
-    double last_cycle_time = GetTime();
-    double timer_accumulator = 0.0;
-    double cpu_accumulator = 0.0;
+    display_fx = createPostFx();
+    if (display_fx == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    uint16_t display_w, display_h;
+    display_texture = LoadTextureFromImage((Image){ (void *)postFxPixels(display_fx, &display_w, &display_h), POSTFX_MAX_W, POSTFX_MAX_H, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 });
+    chip.dirty_rows = UINT64_MAX; // Goes out with the first frame
+    memory_panel_texture = LoadTextureFromImage((Image){ memory_panel_pixels, 32, 32, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 });
+
+    // Only files added or changed since the last run are read
+    rom_library = loadRomLibrary(ROM_LIBRARY_FILE);
+    if (rom_library != NULL) {
+        addRomDirectory(rom_library, ROMS_DIRECTORY);
+        for (int i = 1; i < argc; ++i) {
+            addRomDirectory(rom_library, argv[i]);
+        }
+        refreshRomLibrary(rom_library);
+        saveRomLibrary(rom_library, ROM_LIBRARY_FILE);
+    }
+    quirk_pool = createThreadPool(0);
+    flag_store = createFlagStore(FLAGS_DIRECTORY);
 
-    while (!WindowShouldClose()) {
-        double current_cycle_time = GetTime();
-        double delta_seconds = (current_cycle_time - last_cycle_time);
-        last_cycle_time = current_cycle_time;
-        timer_accumulator += delta_seconds * TIMER_SPEED;
+    if (FileExists(SESSION_FILE)) {
+        loadFromFile(SESSION_FILE); // Picks up where the last run stopped, without loading and starting the ROM again
+    }
 
-        pollRaylibKeypadReleased();
+    rewind_buffer = createRewindBuffer(REWIND_CAPACITY, REWIND_SECONDS * TIMER_SPEED);
+    emulation = startEmuThread(&chip, rewind_buffer);
+    if (emulation == NULL) {
+        fprintf(stderr, "Couldn't start the emulation thread\n");
+        return 1;
+    }
 
-        while (timer_accumulator >= 1.0) {
-            if (delay_timer > 0) {
-                --delay_timer;
-            }
-            if (sound_timer > 0) {
-                --sound_timer;
-                if (!IsSoundPlaying(beep)) {
-                    PlaySound(beep);
-                }
-            } else {
-                if (IsSoundPlaying(beep)) {
-                    StopSound(beep);
-                }
-            }
-            timer_accumulator -= 1.0;
-            for (uint16_t i = 0; i < 4096; ++i) {
-                if (memory_heatmap[i] > 0 && memory_heatmap[i] - 5 >= 0) {
-                    memory_heatmap[i] -= 5;
-                } else {
-                    memory_heatmap[i] = 0;
-                }
-            }
+    metrics = createMetricsLog();
+    while (!WindowShouldClose()) {
+        frame_start_time = GetTime();
+        pollRaylibKeypad();
+        setEmuSpeed(emulation, cpu_speed);
+        setEmuTurbo(emulation, turbo_mode);
+        setEmuRunAhead(emulation, run_ahead);
+        setEmuPaused(emulation, step_by_step_mode);
+        setEmuRewinding(emulation, IsKeyDown(KEY_BACKSPACE));
+        if (step_one_instruction && step_by_step_mode) {
+            stepEmuThread(emulation);
+            step_one_instruction = false;
         }
 
-        if (step_by_step_mode) {
-            cpu_accumulator = 0;
-        } else {
-            cpu_accumulator += delta_seconds * cpu_speed;
+        // Takes whatever the emulation finished last, a slow frame here doesn't slow the machine down
+        bool is_new_frame;
+        emu_frame = acquireEmuFrame(emulation, &is_new_frame);
+        view = &emu_frame->chip;
+        if (is_new_frame) {
+            display_dirty_rows |= emu_frame->dirty_rows;
+            syncRomFlags();
         }
-
-        if (step_one_instruction && step_by_step_mode) {
-            stepOneСycle();
-            step_one_instruction = false;
+        if (view->message != NULL) {
+            lockMachine();
+            showChipMessage();
+            unlockMachine();
+        }
+        if (view->halted) {
+            break; // 00FD exits the program like closing the window
+        }
+        if ((emu_frame->movie_status == MOVIE_FINISHED || emu_frame->movie_status == MOVIE_DESYNCED) && movie != NULL) {
+            showNotice(emu_frame->movie_status == MOVIE_FINISHED ? "Movie over, same end state" : "Movie over, end state differs");
+            lockMachine();
+            stopMovie();
+            unlockMachine();
         }
 
-        while (cpu_accumulator >= 1.0) {
-            stepOneСycle();
-            cpu_accumulator -= 1.0;
+        atomic_store_explicit(&audio_muted, turbo_mode, memory_order_relaxed);
+        if (view->sound_timer > 0 && !turbo_mode) {
+            startAudio();
         }
 
+        refreshProfile();
         raylibProcess();
+        recordFrameMetrics();
     }
 
-    CloseAudioDevice();
+    stopAudio();
+    stopEmuThread(emulation);
+    emulation = NULL;
+    stopMovie();
+    stopProfiler();
+    destroyMetricsLog(metrics);
+    destroyRewindBuffer(rewind_buffer);
+    if (rom_library != NULL) {
+        saveRomLibrary(rom_library, ROM_LIBRARY_FILE); // Detected quirks and ROMs dropped from elsewhere
+        destroyRomLibrary(rom_library);
+    }
+    if (quirk_pool != NULL) destroyThreadPool(quirk_pool);
+    if (flag_store != NULL) {
+        if (flags_rom_hash != 0) storeRomFlags(flag_store, flags_rom_hash, chip.flag_registers); // Ones set after the last frame was shown
+        destroyFlagStore(flag_store);
+    }
+    if (chip.is_rom_loaded && !chip.halted) {
+        saveStateToFile(&chip, savedRomPath(), SESSION_FILE);
+    } else {
+        remove(SESSION_FILE);
+    }
+    if (display_gap_mask.texture.id != 0) UnloadTexture(display_gap_mask.texture);
+    if (memory_panel_gap_mask.texture.id != 0) UnloadTexture(memory_panel_gap_mask.texture);
+    UnloadTexture(memory_panel_texture);
+    UnloadTexture(display_texture);
+    destroyPostFx(display_fx);
     CloseWindow();
+    setJit(&chip, false);
+    setDecodeCache(&chip, false);
+    releaseChip8(&chip);
     free(message_box_title);
     free(message_box_message);
     free(message_box_buttons); 
@@ -0,0 +1,165 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *metric_names[METRIC_COUNT] = {
+    "ips", "speed_pct", "emulation_ms", "render_ms", "draws", "collisions",
+    "clears", "scrolls", "key_wait_pct", "timer_underruns"
+};
+
+struct MetricsLog
+{
+    float samples[METRICS_HISTORY][METRIC_COUNT]; // Circular, samples[newest] is the last one
+    uint32_t newest;
+    uint32_t count;
+    MetricsInput previous;
+    bool has_previous;
+
+    FILE *export_file;
+    bool export_json;
+    double export_interval;
+    double export_start; // Start of the interval being accumulated
+    double sums[METRIC_COUNT];
+    float peaks[METRIC_COUNT];
+    uint32_t accumulated;
+};
+
+MetricsLog *createMetricsLog(void) {
+    return calloc(1, sizeof(MetricsLog));
+}
+
+void destroyMetricsLog(MetricsLog *log) {
+    if (log == NULL) {
+        return;
+    }
+    stopMetricsExport(log);
+    free(log);
+}
+
+const char *metricName(Metric metric) {
+    return metric < METRIC_COUNT ? metric_names[metric] : "?";
+}
+
+uint32_t metricSampleCount(const MetricsLog *log) {
+    return log->count;
+}
+
+float metricValue(const MetricsLog *log, Metric metric, uint32_t age) {
+    if (age >= log->count) {
+        return 0;
+    }
+    return log->samples[(log->newest + METRICS_HISTORY - age) % METRICS_HISTORY][metric];
+}
+
+float metricPeak(const MetricsLog *log, Metric metric) {
+    float peak = 0;
+    for (uint32_t age = 0; age < log->count; ++age) {
+        float value = metricValue(log, metric, age);
+        if (value > peak) {
+            peak = value;
+        }
+    }
+    return peak;
+}
+
+static void writeExportRow(MetricsLog *log, double time) {
+    FILE *file = log->export_file;
+    fprintf(file, log->export_json ? "{\"time\":%.3f" : "%.3f", time);
+    for (uint8_t i = 0; i < METRIC_COUNT; ++i) {
+        double mean = log->sums[i] / log->accumulated;
+        if (log->export_json) {
+            fprintf(file, ",\"%s\":%.4g,\"%s_max\":%.4g", metric_names[i], mean, metric_names[i], log->peaks[i]);
+        } else {
+            fprintf(file, ",%.4g,%.4g", mean, log->peaks[i]);
+        }
+    }
+    fputs(log->export_json ? "}\n" : "\n", file);
+    fflush(file); // Rows can be charted while the session goes on
+    memset(log->sums, 0, sizeof(log->sums));
+    memset(log->peaks, 0, sizeof(log->peaks));
+    log->accumulated = 0;
+}
+
+void recordMetrics(MetricsLog *log, const MetricsInput *input) {
+    const MetricsInput *previous = &log->previous;
+    if (!log->has_previous) {
+        log->previous = *input;
+        log->has_previous = true;
+        return;
+    }
+    uint64_t frames = input->counters.frames - previous->counters.frames;
+    double per_frame = frames ? 1.0 / frames : 0;
+    float sample[METRIC_COUNT];
+    sample[METRIC_IPS] = (float)input->ips;
+    sample[METRIC_SPEED] = input->target_ips ? (float)(100.0 * input->ips / input->target_ips) : 0;
+    sample[METRIC_EMULATION_MS] = (float)((input->emulation_seconds - previous->emulation_seconds) * 1000);
+    sample[METRIC_RENDER_MS] = (float)(input->render_seconds * 1000);
+    sample[METRIC_DRAWS] = (float)((input->counters.draws - previous->counters.draws) * per_frame);
+    sample[METRIC_COLLISIONS] = (float)((input->counters.collisions - previous->counters.collisions) * per_frame);
+    sample[METRIC_CLEARS] = (float)((input->counters.clears - previous->counters.clears) * per_frame);
+    sample[METRIC_SCROLLS] = (float)((input->counters.scrolls - previous->counters.scrolls) * per_frame);
+    sample[METRIC_KEY_WAIT] = (float)((input->counters.key_wait_frames - previous->counters.key_wait_frames) * per_frame * 100);
+    sample[METRIC_TIMER_UNDERRUNS] = (float)(input->timer_underruns - previous->timer_underruns);
+    log->previous = *input;
+
+    log->newest = (log->newest + 1) % METRICS_HISTORY;
+    memcpy(log->samples[log->newest], sample, sizeof(sample));
+    if (log->count < METRICS_HISTORY) {
+        ++log->count;
+    }
+
+    if (log->export_file == NULL) {
+        return;
+    }
+    for (uint8_t i = 0; i < METRIC_COUNT; ++i) {
+        log->sums[i] += sample[i];
+        if (sample[i] > log->peaks[i]) {
+            log->peaks[i] = sample[i];
+        }
+    }
+    ++log->accumulated;
+    if (input->time - log->export_start >= log->export_interval) {
+        writeExportRow(log, input->time);
+        log->export_start = input->time;
+    }
+}
+
+bool startMetricsExport(MetricsLog *log, const char *path, double interval) {
+    stopMetricsExport(log);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    size_t length = strlen(path);
+    log->export_json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    if (!log->export_json) {
+        fputs("time", file);
+        for (uint8_t i = 0; i < METRIC_COUNT; ++i) {
+            fprintf(file, ",%s,%s_max", metric_names[i], metric_names[i]);
+        }
+        fputs("\n", file);
+    }
+    log->export_file = file;
+    log->export_interval = interval;
+    log->export_start = log->previous.time;
+    memset(log->sums, 0, sizeof(log->sums));
+    memset(log->peaks, 0, sizeof(log->peaks));
+    log->accumulated = 0;
+    return true;
+}
+
+void stopMetricsExport(MetricsLog *log) {
+    if (log->export_file == NULL) {
+        return;
+    }
+    if (log->accumulated > 0) {
+        writeExportRow(log, log->previous.time);
+    }
+    fclose(log->export_file);
+    log->export_file = NULL;
+}
+
+bool isExportingMetrics(const MetricsLog *log) {
+    return log->export_file != NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// Rolling history of emulator load, one sample per frontend frame, built from running totals
+// so the emulation only ever increments counters. Optionally dumps the mean and peak of every
+// metric at a fixed interval to a CSV or JSON Lines file for charting long sessions.
+
+#define METRICS_HISTORY 240 // Samples kept for the overlay
+
+typedef enum
+{
+    METRIC_IPS, // Emulated instructions per second
+    METRIC_SPEED, // IPS as a percentage of the target cpu_speed, 0 without a target
+    METRIC_EMULATION_MS, // Host time the emulation thread ran since the previous sample
+    METRIC_RENDER_MS, // Host time the frontend spent drawing the sample's frame
+    METRIC_DRAWS, // Per emulated frame
+    METRIC_COLLISIONS, // Per emulated frame
+    METRIC_CLEARS, // Per emulated frame
+    METRIC_SCROLLS, // Per emulated frame
+    METRIC_KEY_WAIT, // Percentage of emulated frames spent in FX0A
+    METRIC_TIMER_UNDERRUNS, // Timer ticks that ran late since the previous sample
+    METRIC_COUNT
+} Metric;
+
+// What the frontend knows at the end of one of its frames
+typedef struct
+{
+    double time; // Host seconds
+    double ips;
+    uint32_t target_ips; // 0 if there is none (turbo)
+    double emulation_seconds; // Running total
+    double render_seconds; // This frame only
+    uint64_t timer_underruns; // Running total
+    MachineCounters counters; // Running totals
+} MetricsInput;
+
+typedef struct MetricsLog MetricsLog;
+
+// NULL if out of memory
+MetricsLog *createMetricsLog(void);
+// Also ends an export
+void destroyMetricsLog(MetricsLog *log);
+
+void recordMetrics(MetricsLog *log, const MetricsInput *input);
+
+// Column name used by the export ("ips", "render_ms", ...)
+const char *metricName(Metric metric);
+// Samples held, at most METRICS_HISTORY
+uint32_t metricSampleCount(const MetricsLog *log);
+// `age` 0 is the newest sample
+float metricValue(const MetricsLog *log, Metric metric, uint32_t age);
+// Highest value in the history
+float metricPeak(const MetricsLog *log, Metric metric);
+
+// Starts writing a row every `interval` seconds, JSON Lines if `path` ends in ".json", CSV otherwise.
+// Returns false if the file can't be created.
+bool startMetricsExport(MetricsLog *log, const char *path, double interval);
+void stopMetricsExport(MetricsLog *log);
+bool isExportingMetrics(const MetricsLog *log);
+
+#endif
@@ -0,0 +1,275 @@
+#include "movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, numbers little-endian:
+// "CH8M", u16 version, u32 frame count, u32 hash of the final state, u32 start state size,
+// the start state (saveState() format), then one record per input change: varint frames since
+// the previous record, u16 keys, key released that frame (0xFF - none), varint CPU speed
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 18
+
+typedef struct
+{
+    uint32_t frame;
+    uint16_t keys;
+    int8_t key_released;
+    uint32_t cpu_speed;
+} MovieInput;
+
+struct Movie
+{
+    MovieStatus status;
+    uint32_t frame; // Frames recorded or played
+    uint32_t length; // Frames of a playback
+    uint32_t final_hash;
+    uint8_t *start_state;
+    size_t start_state_size;
+    MovieInput *inputs;
+    uint32_t input_count;
+    uint32_t input_capacity;
+    uint32_t next_input; // Playback position
+};
+
+static uint32_t hashState(const Chip8 *chip) {
+    uint8_t state[SAVE_STATE_MAX_SIZE];
+    size_t size = saveState(chip, NULL, state);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ state[i]) * 16777619u; // FNV-1a
+    }
+    return hash;
+}
+
+static bool pushInput(Movie *movie, MovieInput input) {
+    if (movie->input_count == movie->input_capacity) {
+        uint32_t capacity = movie->input_capacity ? movie->input_capacity * 2 : 256;
+        MovieInput *inputs = realloc(movie->inputs, capacity * sizeof(MovieInput));
+        if (inputs == NULL) {
+            return false;
+        }
+        movie->inputs = inputs;
+        movie->input_capacity = capacity;
+    }
+    movie->inputs[movie->input_count++] = input;
+    return true;
+}
+
+Movie *startMovieRecording(const Chip8 *chip, const char *rom_path) {
+    Movie *movie = calloc(1, sizeof(Movie));
+    uint8_t *state = malloc(SAVE_STATE_MAX_SIZE);
+    if (movie == NULL || state == NULL) {
+        free(movie);
+        free(state);
+        return NULL;
+    }
+    movie->status = MOVIE_RECORDING;
+    movie->start_state = state;
+    movie->start_state_size = saveState(chip, rom_path, state);
+    return movie;
+}
+
+void destroyMovie(Movie *movie) {
+    if (movie == NULL) {
+        return;
+    }
+    free(movie->inputs);
+    free(movie->start_state);
+    free(movie);
+}
+
+bool movieFrame(Movie *movie, Chip8 *chip, uint32_t *cpu_speed) {
+    if (movie->status == MOVIE_RECORDING) {
+        const MovieInput *last = movie->input_count ? &movie->inputs[movie->input_count - 1] : NULL;
+        // A release only lasts its frame, so each one gets a record, as does the frame after it
+        if (last == NULL || last->keys != chip->keys || last->key_released != chip->key_released_this_cycle
+            || chip->key_released_this_cycle >= 0 || last->cpu_speed != *cpu_speed) {
+            // Out of memory only loses the rest of the input, the playback will tell it desynced
+            pushInput(movie, (MovieInput){ movie->frame, chip->keys, chip->key_released_this_cycle, *cpu_speed });
+        }
+        ++movie->frame;
+        return true;
+    }
+    if (movie->status != MOVIE_PLAYING) {
+        return false;
+    }
+    if (movie->frame == movie->length) {
+        movie->status = hashState(chip) == movie->final_hash ? MOVIE_FINISHED : MOVIE_DESYNCED;
+        return false;
+    }
+    while (movie->next_input + 1 < movie->input_count && movie->inputs[movie->next_input + 1].frame <= movie->frame) {
+        ++movie->next_input;
+    }
+    const MovieInput *input = &movie->inputs[movie->next_input];
+    chip->keys = input->keys;
+    chip->key_released_this_cycle = input->frame == movie->frame ? input->key_released : -1;
+    *cpu_speed = input->cpu_speed;
+    ++movie->frame;
+    return true;
+}
+
+static size_t putVarint(uint8_t *out, uint32_t value) {
+    size_t written = 0;
+    do {
+        out[written++] = (value & 0x7F) | (value >= 0x80 ? 0x80 : 0);
+        value >>= 7;
+    } while (value > 0);
+    return written;
+}
+
+// Returns 0 if the varint runs past `end`
+static size_t getVarint(const uint8_t *in, const uint8_t *end, uint32_t *value) {
+    size_t read = 0;
+    uint8_t shift = 0;
+    *value = 0;
+    do {
+        if (in + read >= end || shift > 28) {
+            return 0;
+        }
+        *value |= (uint32_t)(in[read] & 0x7F) << shift;
+        shift += 7;
+    } while (in[read++] & 0x80);
+    return read;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    for (uint8_t i = 0; i < 4; ++i) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool saveMovie(Movie *movie, const Chip8 *chip, const char *path) {
+    if (movie->status != MOVIE_RECORDING) {
+        return false;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    uint8_t header[MOVIE_HEADER_SIZE];
+    memcpy(header, "CH8M", 4);
+    header[4] = MOVIE_VERSION & 0xFF;
+    header[5] = MOVIE_VERSION >> 8;
+    put32(header + 6, movie->frame);
+    put32(header + 10, hashState(chip));
+    put32(header + 14, (uint32_t)movie->start_state_size);
+    bool written = fwrite(header, 1, sizeof(header), file) == sizeof(header)
+        && fwrite(movie->start_state, 1, movie->start_state_size, file) == movie->start_state_size;
+
+    uint32_t previous_frame = 0;
+    for (uint32_t i = 0; i < movie->input_count && written; ++i) {
+        const MovieInput *input = &movie->inputs[i];
+        uint8_t record[16];
+        size_t size = putVarint(record, input->frame - previous_frame);
+        record[size++] = input->keys & 0xFF;
+        record[size++] = input->keys >> 8;
+        record[size++] = input->key_released < 0 ? 0xFF : (uint8_t)input->key_released;
+        size += putVarint(record + size, input->cpu_speed);
+        written = fwrite(record, 1, size, file) == size;
+        previous_frame = input->frame;
+    }
+    return fclose(file) == 0 && written;
+}
+
+Movie *startMoviePlayback(Chip8 *chip, const char *path, char **rom_path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        chip->message_title = "ERROR";
+        chip->message = "Couldn't open the movie.";
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(size ? size : 1);
+    Movie *movie = calloc(1, sizeof(Movie));
+    bool read = data != NULL && movie != NULL && fread(data, 1, size, file) == size;
+    fclose(file);
+
+    const char *error = NULL;
+    if (!read) {
+        error = "Couldn't read the movie.";
+    } else if (size < MOVIE_HEADER_SIZE || memcmp(data, "CH8M", 4) != 0) {
+        error = "Not a movie.";
+    } else if ((data[4] | data[5] << 8) != MOVIE_VERSION) {
+        error = "Movie was made by\nan incompatible version.";
+    } else if (get32(data + 14) > size - MOVIE_HEADER_SIZE) {
+        error = "Movie is corrupted.";
+    }
+    if (error == NULL) {
+        movie->length = get32(data + 6);
+        movie->final_hash = get32(data + 10);
+        movie->start_state_size = get32(data + 14);
+        const uint8_t *p = data + MOVIE_HEADER_SIZE + movie->start_state_size;
+        const uint8_t *end = data + size;
+        uint32_t frame = 0;
+        while (p < end && error == NULL) {
+            uint32_t frame_delta, cpu_speed;
+            size_t length = getVarint(p, end, &frame_delta);
+            if (length == 0 || end - (p + length) < 3) {
+                error = "Movie is corrupted.";
+                break;
+            }
+            p += length;
+            MovieInput input = { frame + frame_delta, p[0] | (p[1] << 8), p[2] == 0xFF ? -1 : (int8_t)(p[2] & 0xF), 0 };
+            p += 3;
+            length = getVarint(p, end, &cpu_speed);
+            if (length == 0 || (movie->input_count == 0 && input.frame != 0)) {
+                error = "Movie is corrupted.";
+                break;
+            }
+            p += length;
+            input.cpu_speed = cpu_speed;
+            frame = input.frame;
+            if (!pushInput(movie, input)) {
+                error = "Out of memory.";
+            }
+        }
+        if (error == NULL && movie->input_count == 0 && movie->length > 0) {
+            error = "Movie is corrupted.";
+        }
+    }
+    if (error != NULL) {
+        chip->message_title = "ERROR";
+        chip->message = error;
+        free(data);
+        destroyMovie(movie);
+        return NULL;
+    }
+
+    const char *stored_path = NULL;
+    size_t stored_path_length = 0;
+    if (!loadState(chip, data + MOVIE_HEADER_SIZE, movie->start_state_size, &stored_path, &stored_path_length)) {
+        free(data);
+        destroyMovie(movie);
+        return NULL;
+    }
+    if (rom_path != NULL) {
+        char *copy = realloc(*rom_path, stored_path_length + 1);
+        if (copy != NULL) {
+            memcpy(copy, stored_path, stored_path_length);
+            copy[stored_path_length] = '\0';
+            *rom_path = copy;
+        }
+    }
+    free(data);
+    movie->status = MOVIE_PLAYING;
+    return movie;
+}
+
+MovieStatus movieStatus(const Movie *movie) {
+    return movie ? movie->status : MOVIE_NONE;
+}
+
+uint32_t movieFramesDone(const Movie *movie) {
+    return movie->frame;
+}
+
+uint32_t movieLength(const Movie *movie) {
+    return movie->length;
+}
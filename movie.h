@@ -0,0 +1,36 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// Input movies: the save state a recording started from, then the keypad state and CPU speed
+// of every frame, stored only when they change. runFrame() depends on nothing else, so playing
+// a movie back repeats the run bit for bit, which is checked against the state hash at its end.
+
+typedef enum { MOVIE_NONE, MOVIE_RECORDING, MOVIE_PLAYING, MOVIE_FINISHED, MOVIE_DESYNCED } MovieStatus;
+
+typedef struct Movie Movie;
+
+// Starts recording from the current state of the machine, NULL if out of memory
+Movie *startMovieRecording(const Chip8 *chip, const char *rom_path);
+// Reads a movie file and puts the machine into its starting state, *rom_path (may be NULL)
+// is reallocated to the stored ROM path. Returns NULL and sets the chip message on failure.
+Movie *startMoviePlayback(Chip8 *chip, const char *path, char **rom_path);
+void destroyMovie(Movie *movie);
+
+// Call before every runFrame(). A recording takes the keys and the speed of the frame,
+// a playback replaces them with the recorded ones. Returns false once a playback is over,
+// its status then tells if the machine ended up where the recording did.
+bool movieFrame(Movie *movie, Chip8 *chip, uint32_t *cpu_speed);
+// Ends a recording at the current state of the machine and writes it to `path`
+bool saveMovie(Movie *movie, const Chip8 *chip, const char *path);
+
+MovieStatus movieStatus(const Movie *movie);
+// Frames recorded or played so far
+uint32_t movieFramesDone(const Movie *movie);
+// Total frames of a playback
+uint32_t movieLength(const Movie *movie);
+
+#endif
@@ -0,0 +1,328 @@
+#include "postfx.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define POSTFX_SSE2
+#endif
+
+#define FADE_CUTOFF 8 // Alpha under which a fading pixel counts as unlit
+#define BORDER 4 // Pixels before each row of PostFx.source, keeps the rows 16-byte aligned
+#define SOURCE_W (SCREEN_MAX_W + 2 * BORDER)
+
+struct PostFx
+{
+    PostFxSettings settings;
+    uint32_t palette[1 << SCREEN_PLANES];
+    uint8_t fade_end; // Age from which an unlit pixel is drawn as colour 0
+    bool redraw; // Every row has to be redone
+    uint8_t screen_w;
+    uint8_t screen_h;
+    uint64_t fading_rows; // Rows with unlit pixels younger than fade_end
+    uint64_t expand[256]; // The bits of a byte as 8 bytes of 0 or 1, the top bit first in memory
+    _Alignas(16) uint32_t colors[1 << SCREEN_PLANES][256]; // Output pixel by colour and age
+    _Alignas(16) uint8_t age[SCREEN_MAX_H][SCREEN_MAX_W]; // Emulated frames since the pixel was lit, up to 255
+    _Alignas(16) uint8_t color[SCREEN_MAX_H][SCREEN_MAX_W]; // getPixel() when it was last lit
+    // Persistence output, framed by a copy of the edge pixels for the scalers to read around each one
+    _Alignas(16) uint32_t source[SCREEN_MAX_H + 2][SOURCE_W];
+    _Alignas(16) uint32_t pixels[POSTFX_MAX_H][POSTFX_MAX_W];
+};
+
+// Fills `colors` from the palette and the persistence settings
+static void updateColors(PostFx *fx) {
+    uint8_t fade[256];
+    fx->fade_end = 1;
+    for (uint16_t age = 0; age < 256; ++age) {
+        float alpha = 0.0f;
+        if (age == 0) {
+            alpha = 255.0f;
+        } else if (fx->settings.persistence == PERSISTENCE_OR) {
+            alpha = age <= fx->settings.frames ? 255.0f : 0.0f;
+        } else if (fx->settings.persistence == PERSISTENCE_DECAY && fx->settings.frames > 0) {
+            alpha = 255.0f * exp2f(-(float)age / fx->settings.frames);
+        }
+        fade[age] = alpha >= FADE_CUTOFF && age < 255 ? (uint8_t)(alpha + 0.5f) : 0; // 255 also means never lit
+        if (fade[age] != 0) {
+            fx->fade_end = age + 1;
+        }
+    }
+    for (uint8_t color = 0; color < (1 << SCREEN_PLANES); ++color) {
+        for (uint16_t age = 0; age < 256; ++age) {
+            if (color == 0 || fade[age] == 0) {
+                fx->colors[color][age] = fx->palette[0]; // The scalers compare pixels, a faded one has to equal the background
+                continue;
+            }
+            uint8_t rgba[4];
+            memcpy(rgba, &fx->palette[color], 4);
+            rgba[3] = rgba[3] * fade[age] / 255;
+            memcpy(&fx->colors[color][age], rgba, 4);
+        }
+    }
+    fx->redraw = true;
+}
+
+PostFx *createPostFx(void) {
+#ifdef _WIN32
+    PostFx *fx = _aligned_malloc(sizeof(PostFx), _Alignof(PostFx));
+#else
+    PostFx *fx = aligned_alloc(_Alignof(PostFx), sizeof(PostFx));
+#endif
+    if (fx == NULL) {
+        return NULL;
+    }
+    memset(fx, 0, sizeof(PostFx));
+    for (uint16_t bits = 0; bits < 256; ++bits) {
+        uint8_t bytes[8];
+        for (uint8_t i = 0; i < 8; ++i) {
+            bytes[i] = (bits >> (7 - i)) & 1;
+        }
+        memcpy(&fx->expand[bits], bytes, 8);
+    }
+    memset(fx->age, 0xFF, sizeof(fx->age));
+    fx->settings = (PostFxSettings){ PERSISTENCE_OFF, 0, 1 };
+    updateColors(fx);
+    return fx;
+}
+
+void destroyPostFx(PostFx *fx) {
+#ifdef _WIN32
+    _aligned_free(fx);
+#else
+    free(fx);
+#endif
+}
+
+void setPostFxSettings(PostFx *fx, PostFxSettings settings) {
+    if (settings.scale < 1) settings.scale = 1;
+    if (settings.scale > POSTFX_MAX_SCALE) settings.scale = POSTFX_MAX_SCALE;
+    fx->settings = settings;
+    updateColors(fx);
+}
+
+PostFxSettings postFxSettings(const PostFx *fx) {
+    return fx->settings;
+}
+
+void setPostFxPalette(PostFx *fx, const uint32_t palette[1 << SCREEN_PLANES]) {
+    memcpy(fx->palette, palette, sizeof(fx->palette));
+    updateColors(fx);
+}
+
+// Ages the pixels of row y by `step` frames, resets the lit ones and writes the row into `source`.
+// Returns whether it still has pixels fading.
+static bool persistRow(PostFx *fx, const Chip8 *chip, uint8_t y, uint8_t step) {
+    _Alignas(16) uint8_t index[SCREEN_MAX_W]; // getPixel() of the row
+    for (uint8_t x = 0; x < fx->screen_w; x += 8) {
+        uint64_t pixels = 0;
+        for (uint8_t plane = 0; plane < SCREEN_PLANES; ++plane) {
+            uint8_t bits = chip->screen[plane][y][x >> 6] >> (56 - (x & 63));
+            pixels |= fx->expand[bits] << plane;
+        }
+        memcpy(index + x, &pixels, 8);
+    }
+
+    uint8_t *age = fx->age[y];
+    uint8_t *color = fx->color[y];
+    bool fading = false;
+#ifdef POSTFX_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i steps = _mm_set1_epi8((char)step);
+    __m128i end = _mm_set1_epi8((char)fx->fade_end);
+    for (uint8_t x = 0; x < fx->screen_w; x += 16) {
+        __m128i lit = _mm_load_si128((const __m128i *)(index + x));
+        __m128i unlit = _mm_cmpeq_epi8(lit, zero);
+        __m128i new_age = _mm_and_si128(_mm_adds_epu8(_mm_load_si128((const __m128i *)(age + x)), steps), unlit);
+        __m128i old_color = _mm_load_si128((const __m128i *)(color + x));
+        _mm_store_si128((__m128i *)(age + x), new_age);
+        _mm_store_si128((__m128i *)(color + x), _mm_or_si128(_mm_and_si128(unlit, old_color), _mm_andnot_si128(unlit, lit)));
+        __m128i faded = _mm_cmpeq_epi8(_mm_max_epu8(new_age, end), new_age);
+        fading |= _mm_movemask_epi8(_mm_andnot_si128(faded, unlit)) != 0;
+    }
+#else
+    for (uint8_t x = 0; x < fx->screen_w; ++x) {
+        if (index[x] != 0) {
+            age[x] = 0;
+            color[x] = index[x];
+        } else {
+            age[x] = age[x] + step < 255 ? age[x] + step : 255;
+            fading |= age[x] < fx->fade_end;
+        }
+    }
+#endif
+
+    uint32_t *out = &fx->source[y + 1][BORDER];
+    for (uint8_t x = 0; x < fx->screen_w; ++x) {
+        out[x] = fx->colors[color[x]][age[x]];
+    }
+    return fading;
+}
+
+#ifdef POSTFX_SSE2
+static inline __m128i select128(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+// Scale2x: with B, D, F and H the pixels above, left, right and below E, a corner of E takes the
+// colour of the two neighbours meeting there when they match and the opposite ones don't
+static void scale2xRow(PostFx *fx, uint8_t y) {
+    const uint32_t *above = &fx->source[y][BORDER];
+    const uint32_t *row = &fx->source[y + 1][BORDER];
+    const uint32_t *below = &fx->source[y + 2][BORDER];
+    uint32_t *out0 = fx->pixels[2 * y];
+    uint32_t *out1 = fx->pixels[2 * y + 1];
+#ifdef POSTFX_SSE2
+    for (uint8_t x = 0; x < fx->screen_w; x += 4) {
+        __m128i b = _mm_load_si128((const __m128i *)(above + x));
+        __m128i d = _mm_loadu_si128((const __m128i *)(row + x - 1));
+        __m128i e = _mm_load_si128((const __m128i *)(row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        __m128i h = _mm_load_si128((const __m128i *)(below + x));
+        __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i e0 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(d, b)), d, e);
+        __m128i e1 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(b, f)), f, e);
+        __m128i e2 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(d, h)), d, e);
+        __m128i e3 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(h, f)), f, e);
+        _mm_store_si128((__m128i *)(out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+        _mm_store_si128((__m128i *)(out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+        _mm_store_si128((__m128i *)(out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+        _mm_store_si128((__m128i *)(out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+    }
+#else
+    for (uint8_t x = 0; x < fx->screen_w; ++x) {
+        uint32_t b = above[x], d = row[x - 1], e = row[x], f = row[x + 1], h = below[x];
+        bool edge = b != h && d != f;
+        out0[2 * x] = edge && d == b ? d : e;
+        out0[2 * x + 1] = edge && b == f ? f : e;
+        out1[2 * x] = edge && d == h ? d : e;
+        out1[2 * x + 1] = edge && h == f ? f : e;
+    }
+#endif
+}
+
+// Scale3x: the same corners as Scale2x, with the edge centres following a matching pair
+// only where the corner pixel next to it differs from E
+static void scale3xRow(PostFx *fx, uint8_t y) {
+    const uint32_t *above = &fx->source[y][BORDER];
+    const uint32_t *row = &fx->source[y + 1][BORDER];
+    const uint32_t *below = &fx->source[y + 2][BORDER];
+    uint32_t *out[3] = { fx->pixels[3 * y], fx->pixels[3 * y + 1], fx->pixels[3 * y + 2] };
+#ifdef POSTFX_SSE2
+    _Alignas(16) uint32_t result[9][4];
+    for (uint8_t x = 0; x < fx->screen_w; x += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(above + x - 1));
+        __m128i b = _mm_load_si128((const __m128i *)(above + x));
+        __m128i c = _mm_loadu_si128((const __m128i *)(above + x + 1));
+        __m128i d = _mm_loadu_si128((const __m128i *)(row + x - 1));
+        __m128i e = _mm_load_si128((const __m128i *)(row + x));
+        __m128i f = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        __m128i g = _mm_loadu_si128((const __m128i *)(below + x - 1));
+        __m128i h = _mm_load_si128((const __m128i *)(below + x));
+        __m128i i = _mm_loadu_si128((const __m128i *)(below + x + 1));
+        __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i db = _mm_andnot_si128(flat, _mm_cmpeq_epi32(d, b));
+        __m128i bf = _mm_andnot_si128(flat, _mm_cmpeq_epi32(b, f));
+        __m128i dh = _mm_andnot_si128(flat, _mm_cmpeq_epi32(d, h));
+        __m128i hf = _mm_andnot_si128(flat, _mm_cmpeq_epi32(h, f));
+        __m128i ea = _mm_cmpeq_epi32(e, a);
+        __m128i ec = _mm_cmpeq_epi32(e, c);
+        __m128i eg = _mm_cmpeq_epi32(e, g);
+        __m128i ei = _mm_cmpeq_epi32(e, i);
+        __m128i e1 = _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf));
+        __m128i e3 = _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh));
+        __m128i e5 = _mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf));
+        __m128i e7 = _mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf));
+        _mm_store_si128((__m128i *)result[0], select128(db, d, e));
+        _mm_store_si128((__m128i *)result[1], select128(e1, b, e));
+        _mm_store_si128((__m128i *)result[2], select128(bf, f, e));
+        _mm_store_si128((__m128i *)result[3], select128(e3, d, e));
+        _mm_store_si128((__m128i *)result[4], e);
+        _mm_store_si128((__m128i *)result[5], select128(e5, f, e));
+        _mm_store_si128((__m128i *)result[6], select128(dh, d, e));
+        _mm_store_si128((__m128i *)result[7], select128(e7, h, e));
+        _mm_store_si128((__m128i *)result[8], select128(hf, f, e));
+        for (uint8_t pixel = 0; pixel < 4; ++pixel) {
+            for (uint8_t sub = 0; sub < 9; ++sub) {
+                out[sub / 3][3 * (x + pixel) + sub % 3] = result[sub][pixel];
+            }
+        }
+    }
+#else
+    for (uint8_t x = 0; x < fx->screen_w; ++x) {
+        uint32_t a = above[x - 1], b = above[x], c = above[x + 1];
+        uint32_t d = row[x - 1], e = row[x], f = row[x + 1];
+        uint32_t g = below[x - 1], h = below[x], i = below[x + 1];
+        bool edge = b != h && d != f;
+        bool db = edge && d == b, bf = edge && b == f, dh = edge && d == h, hf = edge && h == f;
+        uint32_t *p0 = out[0] + 3 * x, *p1 = out[1] + 3 * x, *p2 = out[2] + 3 * x;
+        p0[0] = db ? d : e;
+        p0[1] = (db && e != c) || (bf && e != a) ? b : e;
+        p0[2] = bf ? f : e;
+        p1[0] = (db && e != g) || (dh && e != a) ? d : e;
+        p1[1] = e;
+        p1[2] = (bf && e != i) || (hf && e != c) ? f : e;
+        p2[0] = dh ? d : e;
+        p2[1] = (dh && e != i) || (hf && e != g) ? h : e;
+        p2[2] = hf ? f : e;
+    }
+#endif
+}
+
+uint64_t runPostFx(PostFx *fx, const Chip8 *chip, uint64_t dirty_rows, uint32_t frames) {
+    if (chip->screen_w != fx->screen_w || chip->screen_h != fx->screen_h) {
+        // The same pixel is somewhere else at another resolution, the history goes
+        fx->screen_w = chip->screen_w;
+        fx->screen_h = chip->screen_h;
+        memset(fx->age, 0xFF, sizeof(fx->age));
+        memset(fx->color, 0, sizeof(fx->color));
+        fx->fading_rows = 0;
+        fx->redraw = true;
+    }
+    if (fx->screen_h == 0 || (!fx->redraw && dirty_rows == 0 && frames == 0)) {
+        return 0;
+    }
+    uint8_t h = fx->screen_h;
+    uint64_t all_rows = h < 64 ? (1ULL << h) - 1 : UINT64_MAX;
+    uint64_t rows = (fx->redraw ? all_rows : dirty_rows | (frames > 0 ? fx->fading_rows : 0)) & all_rows;
+    uint8_t step = frames < 255 ? frames : 255;
+    for (uint8_t y = 0; y < h; ++y) {
+        if ((rows >> y) & 1) {
+            uint64_t bit = 1ULL << y;
+            fx->fading_rows = persistRow(fx, chip, y, step) ? fx->fading_rows | bit : fx->fading_rows & ~bit;
+            fx->source[y + 1][BORDER - 1] = fx->source[y + 1][BORDER];
+            fx->source[y + 1][BORDER + fx->screen_w] = fx->source[y + 1][BORDER + fx->screen_w - 1];
+        }
+    }
+    if (rows & 1) {
+        memcpy(fx->source[0], fx->source[1], sizeof(fx->source[0]));
+    }
+    if ((rows >> (h - 1)) & 1) {
+        memcpy(fx->source[h + 1], fx->source[h], sizeof(fx->source[0]));
+    }
+    fx->redraw = false;
+
+    uint8_t scale = fx->settings.scale;
+    if (scale > 1) {
+        rows = (rows | rows << 1 | rows >> 1) & all_rows; // The scalers look at the rows around
+    }
+    for (uint8_t y = 0; y < h; ++y) {
+        if (!((rows >> y) & 1)) {
+            continue;
+        }
+        if (scale == 2) {
+            scale2xRow(fx, y);
+        } else if (scale == 3) {
+            scale3xRow(fx, y);
+        } else {
+            memcpy(fx->pixels[y], &fx->source[y + 1][BORDER], fx->screen_w * sizeof(uint32_t));
+        }
+    }
+    return rows;
+}
+
+const uint32_t *postFxPixels(const PostFx *fx, uint16_t *width, uint16_t *height) {
+    *width = fx->screen_w * fx->settings.scale;
+    *height = fx->screen_h * fx->settings.scale;
+    return &fx->pixels[0][0];
+}
@@ -0,0 +1,46 @@
+#ifndef POSTFX_H
+#define POSTFX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// Post-processing of the emulated screen before it's shown, done on the CPU so the window and the
+// headless tools (tools/render_movie.c) get the same picture. Persistence keeps erased pixels lit
+// for a few frames or fades them out like phosphor, which hides the flicker of sprites erased and
+// redrawn with XOR. Scale2x or Scale3x then round off the staircase edges of the enlarged pixels.
+// The rest of the enlargement is left to whoever draws the result.
+
+#define POSTFX_MAX_SCALE 3
+#define POSTFX_MAX_W (SCREEN_MAX_W * POSTFX_MAX_SCALE) // Pixels per row of the output, whatever the scale
+#define POSTFX_MAX_H (SCREEN_MAX_H * POSTFX_MAX_SCALE)
+
+typedef enum { PERSISTENCE_OFF, PERSISTENCE_OR, PERSISTENCE_DECAY } PersistenceMode;
+
+typedef struct
+{
+    uint8_t persistence; // PersistenceMode
+    // PERSISTENCE_OR: frames an erased pixel stays lit, PERSISTENCE_DECAY: frames it takes to fade to half
+    uint8_t frames;
+    uint8_t scale; // 1, 2 (Scale2x) or 3 (Scale3x)
+} PostFxSettings;
+
+typedef struct PostFx PostFx;
+
+// Starts with persistence off, no scaling and every colour transparent. Returns NULL on failure.
+PostFx *createPostFx(void);
+void destroyPostFx(PostFx *fx);
+void setPostFxSettings(PostFx *fx, PostFxSettings settings);
+PostFxSettings postFxSettings(const PostFx *fx);
+// Colours by getPixel(), each one 4 bytes of R, G, B and A in memory order (raylib's Color).
+// Faded pixels get their colour with a lower alpha.
+void setPostFxPalette(PostFx *fx, const uint32_t palette[1 << SCREEN_PLANES]);
+
+// Takes the next screen, `frames` emulated frames after the previous one, `dirty_rows` being the rows
+// the machine changed since then (see Chip8.dirty_rows). Returns the screen rows whose output changed,
+// output row y comes from screen row y / scale. Nothing is done if neither frames nor rows passed.
+uint64_t runPostFx(PostFx *fx, const Chip8 *chip, uint64_t dirty_rows, uint32_t frames);
+// Output of the last run, POSTFX_MAX_W pixels per row of which the first `width` are used
+const uint32_t *postFxPixels(const PostFx *fx, uint16_t *width, uint16_t *height);
+
+#endif
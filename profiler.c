@@ -0,0 +1,193 @@
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_MAX_NODES 65536 // Call paths, deeper calls on new paths count for their caller once full
+#define NO_NODE UINT32_MAX
+
+// One call path, node 0 is the code outside of subroutines
+typedef struct
+{
+    uint16_t entry;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t calls;
+    uint64_t self; // Instructions executed on this path and not deeper
+} CallNode;
+
+struct Profiler
+{
+    uint64_t pc_cycles[MEMORY_SIZE];
+    uint64_t total;
+    CallNode *nodes;
+    uint32_t node_count;
+    uint32_t path[STACK_SIZE + 1]; // Node of each stack depth, path[depth] is the current one
+    uint8_t depth;
+    // Scratch of profileSubroutines()
+    uint64_t subtree[PROFILE_MAX_NODES];
+    uint64_t inclusive[MEMORY_SIZE + 1]; // Indexed by entry, the last one is PROFILE_MAIN
+    uint64_t exclusive[MEMORY_SIZE + 1];
+    uint32_t calls[MEMORY_SIZE + 1];
+};
+
+Profiler *createProfiler(void) {
+    Profiler *profiler = malloc(sizeof(Profiler));
+    CallNode *nodes = malloc(PROFILE_MAX_NODES * sizeof(CallNode));
+    if (profiler == NULL || nodes == NULL) {
+        free(profiler);
+        free(nodes);
+        return NULL;
+    }
+    profiler->nodes = nodes;
+    clearProfiler(profiler);
+    return profiler;
+}
+
+void destroyProfiler(Profiler *profiler) {
+    if (profiler == NULL) {
+        return;
+    }
+    free(profiler->nodes);
+    free(profiler);
+}
+
+void clearProfiler(Profiler *profiler) {
+    memset(profiler->pc_cycles, 0, sizeof(profiler->pc_cycles));
+    profiler->total = 0;
+    profiler->nodes[0] = (CallNode){ PROFILE_MAIN, NO_NODE, NO_NODE, NO_NODE, 0, 0 };
+    profiler->node_count = 1;
+    profiler->path[0] = 0;
+    profiler->depth = 0;
+}
+
+static uint32_t enterSubroutine(Profiler *profiler, uint32_t caller, uint16_t entry) {
+    CallNode *nodes = profiler->nodes;
+    uint32_t child = nodes[caller].first_child;
+    while (child != NO_NODE && nodes[child].entry != entry) {
+        child = nodes[child].next_sibling;
+    }
+    if (child == NO_NODE) {
+        if (profiler->node_count == PROFILE_MAX_NODES) {
+            return caller;
+        }
+        child = profiler->node_count++;
+        nodes[child] = (CallNode){ entry, caller, NO_NODE, nodes[caller].first_child, 0, 0 };
+        nodes[caller].first_child = child;
+    }
+    ++nodes[child].calls;
+    return child;
+}
+
+void profileInstruction(Profiler *profiler, const Chip8 *chip, uint16_t addr) {
+    // The stack pointer moves by one per instruction, anything else is a state load or a reset
+    // and the new frames are entered at wherever execution continues
+    uint8_t sp = chip->sp <= STACK_SIZE ? chip->sp : STACK_SIZE;
+    if (sp < profiler->depth) {
+        profiler->depth = sp;
+    }
+    while (profiler->depth < sp) {
+        profiler->path[profiler->depth + 1] = enterSubroutine(profiler, profiler->path[profiler->depth], addr);
+        ++profiler->depth;
+    }
+    ++profiler->pc_cycles[addr];
+    ++profiler->nodes[profiler->path[profiler->depth]].self;
+    ++profiler->total;
+}
+
+uint64_t profiledCycles(const Profiler *profiler) {
+    return profiler->total;
+}
+
+uint32_t profileHotSpots(const Profiler *profiler, ProfileHotSpot *out, uint32_t count) {
+    uint32_t found = 0;
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; ++addr) {
+        uint64_t cycles = profiler->pc_cycles[addr];
+        if (cycles == 0 || (found == count && cycles <= out[count - 1].cycles)) {
+            continue;
+        }
+        uint32_t i = found < count ? found++ : count - 1;
+        for (; i > 0 && out[i - 1].cycles < cycles; --i) {
+            out[i] = out[i - 1];
+        }
+        out[i] = (ProfileHotSpot){ (uint16_t)addr, cycles };
+    }
+    return found;
+}
+
+static uint32_t entryIndex(uint16_t entry) {
+    return entry == PROFILE_MAIN ? MEMORY_SIZE : entry & 0xFFF; // Only 2NNN enters subroutines
+}
+
+uint32_t profileSubroutines(Profiler *profiler, ProfileSubroutine *out, uint32_t count) {
+    const CallNode *nodes = profiler->nodes;
+    memset(profiler->inclusive, 0, sizeof(profiler->inclusive));
+    memset(profiler->exclusive, 0, sizeof(profiler->exclusive));
+    memset(profiler->calls, 0, sizeof(profiler->calls));
+
+    // Children always come after their parents, so one backward pass sums every subtree
+    for (uint32_t i = 0; i < profiler->node_count; ++i) {
+        profiler->subtree[i] = nodes[i].self;
+    }
+    for (uint32_t i = profiler->node_count - 1; i > 0; --i) {
+        profiler->subtree[nodes[i].parent] += profiler->subtree[i];
+    }
+    for (uint32_t i = 0; i < profiler->node_count; ++i) {
+        uint32_t entry = entryIndex(nodes[i].entry);
+        profiler->exclusive[entry] += nodes[i].self;
+        profiler->calls[entry] += nodes[i].calls;
+        // A recursive call is already inside its outermost frame
+        bool recursive = false;
+        for (uint32_t parent = nodes[i].parent; parent != NO_NODE && !recursive; parent = nodes[parent].parent) {
+            recursive = nodes[parent].entry == nodes[i].entry;
+        }
+        if (!recursive) {
+            profiler->inclusive[entry] += profiler->subtree[i];
+        }
+    }
+
+    uint32_t found = 0;
+    for (uint32_t entry = 0; entry <= MEMORY_SIZE; ++entry) {
+        uint64_t inclusive = profiler->inclusive[entry];
+        if (inclusive == 0 || (found == count && inclusive <= out[count - 1].inclusive)) {
+            continue;
+        }
+        uint32_t i = found < count ? found++ : count - 1;
+        for (; i > 0 && out[i - 1].inclusive < inclusive; --i) {
+            out[i] = out[i - 1];
+        }
+        out[i] = (ProfileSubroutine){ entry == MEMORY_SIZE ? PROFILE_MAIN : (uint16_t)entry,
+            inclusive, profiler->exclusive[entry], profiler->calls[entry] };
+    }
+    return found;
+}
+
+bool saveCollapsedStacks(const Profiler *profiler, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    const CallNode *nodes = profiler->nodes;
+    bool written = true;
+    for (uint32_t i = 0; i < profiler->node_count && written; ++i) {
+        if (nodes[i].self == 0) {
+            continue;
+        }
+        uint32_t frames[STACK_SIZE + 1];
+        uint8_t depth = 0;
+        for (uint32_t node = i; node != NO_NODE && depth <= STACK_SIZE; node = nodes[node].parent) {
+            frames[depth++] = node;
+        }
+        while (depth-- > 0) {
+            uint16_t entry = nodes[frames[depth]].entry;
+            if (entry == PROFILE_MAIN) {
+                fputs("main", file);
+            } else {
+                fprintf(file, ";sub_%03X", entry);
+            }
+        }
+        written = fprintf(file, " %llu\n", (unsigned long long)nodes[i].self) > 0;
+    }
+    return fclose(file) == 0 && written;
+}
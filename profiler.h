@@ -0,0 +1,51 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// Counts executed instructions per PC and per call path. Calls and returns are followed through
+// the stack pointer: when it grows the current instruction is the entry of a subroutine (2NNN),
+// when it shrinks the subroutines on top returned (00EE). Call paths form a tree, so a subroutine
+// gets exclusive cycles (its own instructions) and inclusive ones (with everything it called).
+// Attached through Chip8.profiler, which bypasses the JIT and idle loop skipping. A machine
+// without one pays nothing.
+
+typedef struct Profiler Profiler;
+
+typedef struct
+{
+    uint16_t addr;
+    uint64_t cycles;
+} ProfileHotSpot;
+
+typedef struct
+{
+    uint16_t entry; // Address of its first instruction, PROFILE_MAIN for code outside subroutines
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint32_t calls;
+} ProfileSubroutine;
+
+#define PROFILE_MAIN 0xFFFF
+
+// NULL if out of memory
+Profiler *createProfiler(void);
+void destroyProfiler(Profiler *profiler);
+void clearProfiler(Profiler *profiler);
+
+// Called by the core before executing the instruction at `addr`
+void profileInstruction(Profiler *profiler, const Chip8 *chip, uint16_t addr);
+
+// Instructions counted since the last clear
+uint64_t profiledCycles(const Profiler *profiler);
+// Up to `count` PCs with the most cycles, most first. Returns how many were written.
+uint32_t profileHotSpots(const Profiler *profiler, ProfileHotSpot *out, uint32_t count);
+// Up to `count` subroutines with the most inclusive cycles, most first. Returns how many were written.
+uint32_t profileSubroutines(Profiler *profiler, ProfileSubroutine *out, uint32_t count);
+// Writes one "main;sub_2A0;sub_31C cycles" line per call path, the folded format flame graph tools read
+bool saveCollapsedStacks(const Profiler *profiler, const char *path);
+
+#endif
@@ -0,0 +1,224 @@
+#include "rewind.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_SIZE (SAVE_STATE_MAX_SIZE - SAVE_STATE_MAX_PATH) // Save state without a ROM path
+#define MAX_ENCODED_SIZE (STATE_SIZE + 16) // All literals, plus the run lengths
+
+typedef struct
+{
+    uint32_t offset; // Start of the encoded bytes in the ring, may wrap around its end
+    uint32_t size; // Encoded size
+    uint32_t state_size; // Size of the save state it decodes to
+    bool keyframe;
+} RewindRecord;
+
+struct RewindBuffer
+{
+    uint8_t *ring;
+    size_t capacity;
+    size_t used;
+    RewindRecord *records; // Circular, records[first] is the oldest
+    uint32_t max_frames;
+    uint32_t first;
+    uint32_t count;
+    uint32_t since_keyframe;
+    uint8_t current[STATE_SIZE]; // State of the newest record, zero-padded
+    size_t current_size; // Bytes of `current` that may not be zero
+    uint8_t state[STATE_SIZE];
+    uint8_t scratch[MAX_ENCODED_SIZE];
+};
+
+RewindBuffer *createRewindBuffer(size_t capacity, uint32_t max_frames) {
+    RewindBuffer *rewind = calloc(1, sizeof(RewindBuffer));
+    if (rewind == NULL) {
+        return NULL;
+    }
+    rewind->ring = malloc(capacity);
+    rewind->records = malloc(max_frames * sizeof(RewindRecord));
+    if (rewind->ring == NULL || rewind->records == NULL || max_frames == 0 || capacity < MAX_ENCODED_SIZE) {
+        destroyRewindBuffer(rewind);
+        return NULL;
+    }
+    rewind->capacity = capacity;
+    rewind->max_frames = max_frames;
+    return rewind;
+}
+
+void destroyRewindBuffer(RewindBuffer *rewind) {
+    if (rewind == NULL) {
+        return;
+    }
+    free(rewind->records);
+    free(rewind->ring);
+    free(rewind);
+}
+
+void clearRewindBuffer(RewindBuffer *rewind) {
+    rewind->used = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+}
+
+uint32_t rewindFrameCount(const RewindBuffer *rewind) {
+    return rewind->count;
+}
+
+size_t rewindBytesUsed(const RewindBuffer *rewind) {
+    return rewind->used;
+}
+
+static RewindRecord *record(RewindBuffer *rewind, uint32_t index) {
+    return &rewind->records[(rewind->first + index) % rewind->max_frames];
+}
+
+static size_t putLength(uint8_t *out, size_t length) {
+    size_t written = 0;
+    do {
+        out[written++] = (length & 0x7F) | (length >= 0x80 ? 0x80 : 0);
+        length >>= 7;
+    } while (length > 0);
+    return written;
+}
+
+static size_t getLength(const uint8_t *in, size_t *length) {
+    size_t read = 0;
+    uint8_t shift = 0;
+    *length = 0;
+    do {
+        *length |= (size_t)(in[read] & 0x7F) << shift;
+        shift += 7;
+    } while (in[read++] & 0x80);
+    return read;
+}
+
+// (zero run, literal count, literals) until the end of `bytes`
+static size_t encodeRuns(const uint8_t *bytes, size_t size, uint8_t *out) {
+    size_t written = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros = 0;
+        while (i + zeros < size && bytes[i + zeros] == 0) ++zeros;
+        i += zeros;
+        size_t literals = 0;
+        // A single zero between literals is cheaper to keep than to start a new run for
+        while (i + literals < size && (bytes[i + literals] != 0
+            || (i + literals + 1 < size && bytes[i + literals + 1] != 0))) ++literals;
+        written += putLength(out + written, zeros);
+        written += putLength(out + written, literals);
+        memcpy(out + written, bytes + i, literals);
+        written += literals;
+        i += literals;
+    }
+    return written;
+}
+
+// XORs the decoded bytes into `target`
+static void applyRuns(const uint8_t *in, size_t size, uint8_t *target) {
+    size_t read = 0;
+    uint8_t *p = target;
+    while (read < size) {
+        size_t zeros, literals;
+        read += getLength(in + read, &zeros);
+        read += getLength(in + read, &literals);
+        p += zeros;
+        for (size_t i = 0; i < literals; ++i) {
+            p[i] ^= in[read + i];
+        }
+        p += literals;
+        read += literals;
+    }
+}
+
+// Copies a record out of the ring into scratch, undoing the wrap around its end
+static const uint8_t *readRecord(RewindBuffer *rewind, const RewindRecord *rec) {
+    size_t tail = rewind->capacity - rec->offset;
+    if (rec->size <= tail) {
+        return rewind->ring + rec->offset;
+    }
+    memcpy(rewind->scratch, rewind->ring + rec->offset, tail);
+    memcpy(rewind->scratch + tail, rewind->ring, rec->size - tail);
+    return rewind->scratch;
+}
+
+// Drops the oldest keyframe interval, the oldest record left is always a keyframe
+static void dropOldest(RewindBuffer *rewind) {
+    do {
+        rewind->used -= record(rewind, 0)->size;
+        rewind->first = (rewind->first + 1) % rewind->max_frames;
+        --rewind->count;
+    } while (rewind->count > 0 && !record(rewind, 0)->keyframe);
+}
+
+// Only the bytes either state may use are compared and encoded, XO-CHIP states are over ten times
+// the size of the others
+void captureRewindFrame(RewindBuffer *rewind, const Chip8 *chip) {
+    uint8_t *state = rewind->state;
+    size_t state_size = saveState(chip, NULL, state);
+    size_t compared = state_size > rewind->current_size ? state_size : rewind->current_size;
+    memset(state + state_size, 0, compared - state_size);
+
+    bool keyframe = rewind->count == 0 || rewind->since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL;
+    if (!keyframe) {
+        for (size_t i = 0; i < compared; ++i) {
+            rewind->current[i] ^= state[i]; // Delta, replaced with the state right after
+        }
+    }
+    uint8_t *encoded = rewind->scratch;
+    size_t size = encodeRuns(keyframe ? state : rewind->current, compared, encoded);
+    memcpy(rewind->current, state, compared);
+    rewind->current_size = state_size;
+    rewind->since_keyframe = keyframe ? 0 : rewind->since_keyframe + 1;
+
+    while (rewind->count > 0 && (rewind->used + size > rewind->capacity || rewind->count == rewind->max_frames)) {
+        dropOldest(rewind);
+    }
+    size_t offset = 0;
+    if (rewind->count > 0) {
+        const RewindRecord *newest = record(rewind, rewind->count - 1);
+        offset = (newest->offset + newest->size) % rewind->capacity;
+    } else {
+        // Nothing but this one can be restored, it has to be a whole state
+        if (!keyframe) {
+            size = encodeRuns(state, state_size, encoded);
+            keyframe = true;
+            rewind->since_keyframe = 0;
+        }
+        rewind->first = 0;
+    }
+    size_t tail = rewind->capacity - offset;
+    memcpy(rewind->ring + offset, encoded, size < tail ? size : tail);
+    if (size > tail) {
+        memcpy(rewind->ring, encoded + tail, size - tail);
+    }
+    *record(rewind, rewind->count++) = (RewindRecord){ (uint32_t)offset, (uint32_t)size, (uint32_t)state_size, keyframe };
+    rewind->used += size;
+}
+
+bool rewindFrame(RewindBuffer *rewind, Chip8 *chip) {
+    if (rewind->count < 2) {
+        return false;
+    }
+    const RewindRecord *newest = record(rewind, rewind->count - 1);
+    if (!newest->keyframe) {
+        applyRuns(readRecord(rewind, newest), newest->size, rewind->current);
+    } else {
+        // The state before a keyframe is rebuilt forward from the keyframe before it
+        uint32_t start = rewind->count - 2;
+        while (!record(rewind, start)->keyframe) --start;
+        memset(rewind->current, 0, rewind->current_size);
+        for (uint32_t i = start; i < rewind->count - 1; ++i) {
+            const RewindRecord *rec = record(rewind, i);
+            applyRuns(readRecord(rewind, rec), rec->size, rewind->current);
+        }
+    }
+    rewind->used -= newest->size;
+    --rewind->count;
+
+    uint32_t since_keyframe = 0;
+    while (!record(rewind, rewind->count - 1 - since_keyframe)->keyframe) ++since_keyframe;
+    rewind->since_keyframe = since_keyframe;
+    rewind->current_size = record(rewind, rewind->count - 1)->state_size;
+
+    return loadState(chip, rewind->current, rewind->current_size, NULL, NULL);
+}
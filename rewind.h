@@ -0,0 +1,33 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// History of machine states for stepping back frame by frame. Each captured frame is stored as
+// the XOR of its save state with the previous one, run-length encoded, since from one frame to
+// the next mostly the screen, V and a few bytes of memory change. Every REWIND_KEYFRAME_INTERVAL
+// frames a whole state is stored instead, so no step back has to replay more than that many
+// deltas. When full, the oldest frames are dropped a keyframe interval at a time.
+
+#define REWIND_KEYFRAME_INTERVAL 120
+
+typedef struct RewindBuffer RewindBuffer;
+
+// `capacity` bytes of compressed states, at most `max_frames` of them. Returns NULL on failure.
+RewindBuffer *createRewindBuffer(size_t capacity, uint32_t max_frames);
+void destroyRewindBuffer(RewindBuffer *rewind);
+// Forgets everything, for when the machine jumps somewhere unrelated (reset, ROM or state load)
+void clearRewindBuffer(RewindBuffer *rewind);
+
+void captureRewindFrame(RewindBuffer *rewind, const Chip8 *chip);
+// Restores the frame captured before the newest one and drops the newest,
+// returns false if there's nothing older left
+bool rewindFrame(RewindBuffer *rewind, Chip8 *chip);
+
+uint32_t rewindFrameCount(const RewindBuffer *rewind);
+size_t rewindBytesUsed(const RewindBuffer *rewind);
+
+#endif
@@ -0,0 +1,589 @@
+#define _DEFAULT_SOURCE // realpath()
+#include "romlibrary.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Index layout, all numbers little-endian:
+// "C8RL", u16 version, u16 directory count, u32 entry count, u32 string table size,
+// entries sorted by path (u64 hash, i64 modification time, u32 size, u32 cpu speed,
+// u32 path offset, platform, QUIRK_* flags, quirks detected (0/1), zero byte), u32 path offset
+// of every directory, the string table (0-terminated paths).
+#define INDEX_VERSION 3
+#define INDEX_HEADER_SIZE 16
+#define INDEX_ENTRY_SIZE 32
+#define MAX_PATH_LENGTH 4096
+#define MAX_DIRECTORY_DEPTH 16 // Stops symlink loops
+
+static const uint32_t platform_speeds[] = { 700, 1500, 60000 }; // XO-CHIP ROMs are mostly written for Octo's 1000 per frame
+
+typedef struct
+{
+    RomProfile profile;
+    int64_t mtime;
+    uint32_t path; // Offset in RomLibrary.strings
+    bool seen; // Found by the running refresh
+} RomEntry;
+
+struct RomLibrary
+{
+    RomEntry *entries; // Sorted by path
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *directories; // Offsets in strings
+    uint16_t directory_count;
+    char *strings; // Paths, only ever appended to, saving leaves out the unused ones
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+    bool modified; // Differs from the file
+};
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value & 0xFFFF);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static void put64(uint8_t *p, uint64_t value) {
+    put32(p, value & 0xFFFFFFFF);
+    put32(p + 4, value >> 32);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static uint64_t hashRom(const uint8_t *bytes, size_t count) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL; // FNV-1a
+    }
+    return hash;
+}
+
+// Absolute path without links or dots, so a ROM dropped into the window is found under the path a scan gave it
+static bool canonicalPath(const char *path, char *canonical) {
+#ifdef _WIN32
+    return _fullpath(canonical, path, MAX_PATH_LENGTH) != NULL;
+#else
+    return realpath(path, canonical) != NULL;
+#endif
+}
+
+// Offset of a copy of `text` in the string table, UINT32_MAX if out of memory
+static uint32_t addString(RomLibrary *library, const char *text) {
+    uint32_t length = strlen(text) + 1;
+    if (library->strings_size + length > library->strings_capacity) {
+        uint32_t capacity = library->strings_capacity ? library->strings_capacity : 4096;
+        while (library->strings_size + length > capacity) {
+            capacity *= 2;
+        }
+        char *strings = realloc(library->strings, capacity);
+        if (strings == NULL) {
+            return UINT32_MAX;
+        }
+        library->strings = strings;
+        library->strings_capacity = capacity;
+    }
+    memcpy(library->strings + library->strings_size, text, length);
+    library->strings_size += length;
+    return library->strings_size - length;
+}
+
+// Index of the entry of `path` or of where it would go
+static bool findEntry(const RomLibrary *library, const char *path, uint32_t *index) {
+    uint32_t low = 0;
+    uint32_t high = library->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        int order = strcmp(library->strings + library->entries[middle].path, path);
+        if (order == 0) {
+            *index = middle;
+            return true;
+        }
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    *index = low;
+    return false;
+}
+
+static RomEntry *insertEntry(RomLibrary *library, uint32_t index, const char *path) {
+    if (library->count == library->capacity) {
+        uint32_t capacity = library->capacity ? library->capacity * 2 : 256;
+        RomEntry *entries = realloc(library->entries, capacity * sizeof(RomEntry));
+        if (entries == NULL) {
+            return NULL;
+        }
+        library->entries = entries;
+        library->capacity = capacity;
+    }
+    uint32_t offset = addString(library, path);
+    if (offset == UINT32_MAX) {
+        return NULL;
+    }
+    memmove(library->entries + index + 1, library->entries + index, (library->count - index) * sizeof(RomEntry));
+    ++library->count;
+    library->entries[index] = (RomEntry){ .path = offset };
+    return &library->entries[index];
+}
+
+static void removeEntry(RomLibrary *library, uint32_t index) {
+    memmove(library->entries + index, library->entries + index + 1, (library->count - index - 1) * sizeof(RomEntry));
+    --library->count;
+    library->modified = true;
+}
+
+RomPlatform detectRomPlatform(const uint8_t *rom, size_t size, const char *path) {
+    if (size > LEGACY_MEMORY_SIZE - PROGRAM_START) {
+        return PLATFORM_XOCHIP;
+    }
+    const char *extension = path ? strrchr(path, '.') : NULL;
+    if (extension != NULL && strcmp(extension, ".xo8") == 0) {
+        return PLATFORM_XOCHIP;
+    }
+    RomPlatform platform = extension != NULL && strcmp(extension, ".sc8") == 0 ? PLATFORM_SUPERCHIP : PLATFORM_CHIP8;
+
+    // Follows jumps, calls and both ways of every skip from the entry point, so sprites and other
+    // data that happen to look like SUPER-CHIP or XO-CHIP opcodes don't count. A path ends at a return,
+    // BNNN (its target depends on V0), anything that isn't an instruction or the end of the ROM.
+    uint8_t visited[LEGACY_MEMORY_SIZE / 8] = {0};
+    uint16_t pending[LEGACY_MEMORY_SIZE]; // Every instruction adds at most one
+    uint32_t pending_count = 0;
+    pending[pending_count++] = PROGRAM_START;
+    uint32_t rom_end = PROGRAM_START + size;
+    while (pending_count > 0 && platform != PLATFORM_XOCHIP) {
+        uint16_t addr = pending[--pending_count];
+        while (addr >= PROGRAM_START && addr + 1u < rom_end && !(visited[addr >> 3] & (1 << (addr & 7)))) {
+            visited[addr >> 3] |= 1 << (addr & 7);
+            uint8_t b1 = rom[addr - PROGRAM_START];
+            uint8_t b2 = rom[addr + 1 - PROGRAM_START];
+            uint16_t nnn = (b1 & 0xF) << 8 | b2;
+            uint16_t next = addr + 2;
+            // Skipped instruction, F000 NNNN takes 4 bytes
+            uint16_t after_next = next + (next + 1u < rom_end && rom[next - PROGRAM_START] == 0xF0 && rom[next + 1 - PROGRAM_START] == 0x00 ? 4 : 2);
+            bool ends = false;
+            switch (b1 >> 4) {
+                case 0x0:
+                    if (b1 != 0x00 || b2 == 0xEE) {
+                        ends = true; // 0NNN machine code or 00EE
+                    } else if ((b2 & 0xF0) == 0xC0 || b2 >= 0xFB) {
+                        if (platform < PLATFORM_SUPERCHIP) platform = PLATFORM_SUPERCHIP;
+                        ends = b2 == 0xFD;
+                    } else if ((b2 & 0xF0) == 0xD0) {
+                        platform = PLATFORM_XOCHIP;
+                    } else {
+                        ends = b2 != 0xE0;
+                    }
+                    break;
+                case 0x1:
+                    next = nnn;
+                    break;
+                case 0x2:
+                    pending[pending_count++] = next;
+                    next = nnn;
+                    break;
+                case 0x3:
+                case 0x4:
+                    pending[pending_count++] = after_next;
+                    break;
+                case 0x5:
+                case 0x9:
+                    if ((b2 & 0xF) == 0) {
+                        pending[pending_count++] = after_next;
+                    } else if ((b1 >> 4) == 0x5 && ((b2 & 0xF) == 2 || (b2 & 0xF) == 3)) {
+                        platform = PLATFORM_XOCHIP;
+                    } else {
+                        ends = true;
+                    }
+                    break;
+                case 0x8:
+                    ends = (b2 & 0xF) > 7 && (b2 & 0xF) != 0xE;
+                    break;
+                case 0xB:
+                    ends = true;
+                    break;
+                case 0xD:
+                    if ((b2 & 0xF) == 0 && platform < PLATFORM_SUPERCHIP) platform = PLATFORM_SUPERCHIP;
+                    break;
+                case 0xE:
+                    if (b2 == 0x9E || b2 == 0xA1)
+                        pending[pending_count++] = after_next;
+                    else
+                        ends = true;
+                    break;
+                case 0xF:
+                    switch (b2) {
+                        case 0x00:
+                        case 0x02:
+                            if (b1 != 0xF0) {
+                                ends = true;
+                            } else {
+                                platform = PLATFORM_XOCHIP;
+                            }
+                            break;
+                        case 0x01:
+                        case 0x3A:
+                            platform = PLATFORM_XOCHIP;
+                            break;
+                        case 0x30:
+                        case 0x75:
+                        case 0x85:
+                            if (platform < PLATFORM_SUPERCHIP) platform = PLATFORM_SUPERCHIP;
+                            break;
+                        case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+                        case 0x29: case 0x33: case 0x55: case 0x65:
+                            break;
+                        default:
+                            ends = true;
+                            break;
+                    }
+                    break;
+                default: // 6XNN, 7XNN, ANNN, CXNN
+                    break;
+            }
+            if (ends) {
+                break;
+            }
+            addr = next;
+        }
+    }
+    return platform;
+}
+
+// Profile of a ROM file, taken over from an indexed ROM with the same content if there is one
+static bool analyzeRom(const RomLibrary *library, const char *path, RomProfile *profile) {
+    FILE *file = fopen(path, "rb");
+    uint8_t *rom = malloc(MEMORY_SIZE - PROGRAM_START);
+    if (file == NULL || rom == NULL) {
+        if (file != NULL) fclose(file);
+        free(rom);
+        return false;
+    }
+    size_t size = fread(rom, 1, MEMORY_SIZE - PROGRAM_START, file);
+    bool too_big = fgetc(file) != EOF;
+    fclose(file);
+    if (size == 0 || too_big) {
+        free(rom);
+        return false;
+    }
+    uint64_t hash = hashRom(rom, size);
+    for (uint32_t i = 0; i < library->count; ++i) {
+        if (library->entries[i].profile.hash == hash && library->entries[i].profile.size == size) {
+            *profile = library->entries[i].profile;
+            free(rom);
+            return true;
+        }
+    }
+    RomPlatform platform = detectRomPlatform(rom, size, path);
+    free(rom);
+    *profile = (RomProfile){
+        .hash = hash,
+        .size = size,
+        .cpu_speed = platform_speeds[platform],
+        .platform = platform,
+        .quirks = platformQuirks(platform) // setQuirks() types follow the platforms
+    };
+    return true;
+}
+
+// Up-to-date entry of the file at the canonical `path`, NULL if it can't be read
+static RomEntry *indexFile(RomLibrary *library, const char *path, const struct stat *info, uint32_t *analyzed) {
+    uint32_t index;
+    bool found = findEntry(library, path, &index);
+    if (found && library->entries[index].profile.size == (uint64_t)info->st_size && library->entries[index].mtime == (int64_t)info->st_mtime) {
+        return &library->entries[index];
+    }
+    RomProfile profile;
+    if (analyzed != NULL) ++*analyzed;
+    if (!analyzeRom(library, path, &profile)) {
+        if (found) removeEntry(library, index);
+        return NULL;
+    }
+    RomEntry *entry = found ? &library->entries[index] : insertEntry(library, index, path);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->profile = profile;
+    entry->mtime = info->st_mtime;
+    library->modified = true;
+    return entry;
+}
+
+bool looksLikeRom(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    const char *extension = strrchr(name, '.');
+    if (extension != NULL) {
+        return strcmp(extension, ".ch8") == 0 || strcmp(extension, ".sc8") == 0 || strcmp(extension, ".xo8") == 0 || strcmp(extension, ".c8") == 0;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool binary = false;
+    int c;
+    while (!binary && (c = fgetc(file)) != EOF) {
+        binary = c < 0x20 && c != '\n' && c != '\r' && c != '\t';
+        binary |= c >= 0x7F;
+    }
+    fclose(file);
+    return binary;
+}
+
+static void indexDirectory(RomLibrary *library, const char *directory, uint8_t depth, uint32_t *analyzed) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        if (dir_entry->d_name[0] == '.') {
+            continue;
+        }
+        char path[MAX_PATH_LENGTH];
+        if (snprintf(path, sizeof(path), "%s/%s", directory, dir_entry->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+        struct stat info;
+        if (stat(path, &info) != 0) {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            if (depth < MAX_DIRECTORY_DEPTH) indexDirectory(library, path, depth + 1, analyzed);
+            continue;
+        }
+        uint32_t index;
+        RomEntry *entry = findEntry(library, path, &index) ? &library->entries[index] : NULL;
+        if (entry == NULL && (!S_ISREG(info.st_mode) || !looksLikeRom(path))) {
+            continue;
+        }
+        entry = indexFile(library, path, &info, analyzed);
+        if (entry != NULL) entry->seen = true;
+    }
+    closedir(dir);
+}
+
+RomLibrary *loadRomLibrary(const char *path) {
+    RomLibrary *library = calloc(1, sizeof(RomLibrary));
+    if (library == NULL) {
+        return NULL;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return library;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = size >= INDEX_HEADER_SIZE ? malloc(size) : NULL;
+    bool read = data != NULL && fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!read || memcmp(data, "C8RL", 4) != 0 || get16(data + 4) != INDEX_VERSION) {
+        free(data);
+        return library; // Rebuilt by the next refresh
+    }
+    uint16_t directory_count = get16(data + 6);
+    uint32_t count = get32(data + 8);
+    uint32_t strings_size = get32(data + 12);
+    const uint8_t *entries = data + INDEX_HEADER_SIZE;
+    const uint8_t *directories = entries + (size_t)count * INDEX_ENTRY_SIZE;
+    const char *strings = (const char *)directories + directory_count * 4;
+    bool valid = INDEX_HEADER_SIZE + (uint64_t)count * INDEX_ENTRY_SIZE + directory_count * 4 + strings_size == (uint64_t)size
+        && (strings_size == 0 || strings[strings_size - 1] == '\0');
+    for (uint32_t i = 0; valid && i < count; ++i) {
+        valid = get32(entries + i * INDEX_ENTRY_SIZE + 24) < strings_size && entries[i * INDEX_ENTRY_SIZE + 28] <= PLATFORM_XOCHIP
+            && (i == 0 || strcmp(strings + get32(entries + (i - 1) * INDEX_ENTRY_SIZE + 24), strings + get32(entries + i * INDEX_ENTRY_SIZE + 24)) < 0);
+    }
+    for (uint16_t i = 0; valid && i < directory_count; ++i) {
+        valid = get32(directories + i * 4) < strings_size;
+    }
+    library->entries = malloc((count ? count : 1) * sizeof(RomEntry));
+    library->directories = malloc((directory_count ? directory_count : 1) * sizeof(uint32_t));
+    library->strings = malloc(strings_size ? strings_size : 1);
+    if (!valid || library->entries == NULL || library->directories == NULL || library->strings == NULL) {
+        free(data);
+        free(library->entries);
+        free(library->directories);
+        free(library->strings);
+        *library = (RomLibrary){0};
+        return library;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *p = entries + i * INDEX_ENTRY_SIZE;
+        library->entries[i] = (RomEntry){
+            .profile = {
+                .hash = get64(p),
+                .size = get32(p + 16),
+                .cpu_speed = get32(p + 20),
+                .platform = p[28],
+                .quirks = p[29] & (QUIRK_COMBINATIONS - 1),
+                .quirks_detected = p[30] != 0
+            },
+            .mtime = (int64_t)get64(p + 8),
+            .path = get32(p + 24)
+        };
+    }
+    for (uint16_t i = 0; i < directory_count; ++i) {
+        library->directories[i] = get32(directories + i * 4);
+    }
+    memcpy(library->strings, strings, strings_size);
+    library->count = library->capacity = count;
+    library->directory_count = directory_count;
+    library->strings_size = library->strings_capacity = strings_size;
+    free(data);
+    return library;
+}
+
+void destroyRomLibrary(RomLibrary *library) {
+    if (library == NULL) {
+        return;
+    }
+    free(library->entries);
+    free(library->directories);
+    free(library->strings);
+    free(library);
+}
+
+bool saveRomLibrary(RomLibrary *library, const char *path) {
+    if (!library->modified) {
+        return true;
+    }
+    uint32_t strings_size = 0;
+    for (uint32_t i = 0; i < library->count; ++i) {
+        strings_size += strlen(library->strings + library->entries[i].path) + 1;
+    }
+    for (uint16_t i = 0; i < library->directory_count; ++i) {
+        strings_size += strlen(library->strings + library->directories[i]) + 1;
+    }
+    size_t size = INDEX_HEADER_SIZE + (size_t)library->count * INDEX_ENTRY_SIZE + library->directory_count * 4 + strings_size;
+    uint8_t *data = calloc(1, size);
+    if (data == NULL) {
+        return false;
+    }
+    memcpy(data, "C8RL", 4);
+    put16(data + 4, INDEX_VERSION);
+    put16(data + 6, library->directory_count);
+    put32(data + 8, library->count);
+    put32(data + 12, strings_size);
+    uint8_t *directories = data + INDEX_HEADER_SIZE + (size_t)library->count * INDEX_ENTRY_SIZE;
+    char *strings = (char *)directories + library->directory_count * 4;
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < library->count; ++i) {
+        const RomEntry *entry = &library->entries[i];
+        uint8_t *p = data + INDEX_HEADER_SIZE + i * INDEX_ENTRY_SIZE;
+        put64(p, entry->profile.hash);
+        put64(p + 8, (uint64_t)entry->mtime);
+        put32(p + 16, entry->profile.size);
+        put32(p + 20, entry->profile.cpu_speed);
+        put32(p + 24, offset);
+        p[28] = entry->profile.platform;
+        p[29] = entry->profile.quirks;
+        p[30] = entry->profile.quirks_detected;
+        strcpy(strings + offset, library->strings + entry->path);
+        offset += strlen(strings + offset) + 1;
+    }
+    for (uint16_t i = 0; i < library->directory_count; ++i) {
+        put32(directories + i * 4, offset);
+        strcpy(strings + offset, library->strings + library->directories[i]);
+        offset += strlen(strings + offset) + 1;
+    }
+    FILE *file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(data, 1, size, file) == size;
+    if (file != NULL) written &= fclose(file) == 0;
+    free(data);
+    if (written) library->modified = false;
+    return written;
+}
+
+void addRomDirectory(RomLibrary *library, const char *directory) {
+    char path[MAX_PATH_LENGTH];
+    if (!canonicalPath(directory, path)) {
+        return;
+    }
+    for (uint16_t i = 0; i < library->directory_count; ++i) {
+        if (strcmp(library->strings + library->directories[i], path) == 0) {
+            return;
+        }
+    }
+    if (library->directory_count == UINT16_MAX) {
+        return;
+    }
+    uint32_t *directories = realloc(library->directories, (library->directory_count + 1) * sizeof(uint32_t));
+    if (directories == NULL) {
+        return;
+    }
+    library->directories = directories;
+    uint32_t offset = addString(library, path);
+    if (offset == UINT32_MAX) {
+        return;
+    }
+    library->directories[library->directory_count++] = offset;
+    library->modified = true;
+}
+
+uint32_t refreshRomLibrary(RomLibrary *library) {
+    uint32_t analyzed = 0;
+    for (uint32_t i = 0; i < library->count; ++i) {
+        library->entries[i].seen = false;
+    }
+    for (uint16_t i = 0; i < library->directory_count; ++i) {
+        char directory[MAX_PATH_LENGTH];
+        snprintf(directory, sizeof(directory), "%s", library->strings + library->directories[i]); // The table may move while indexing
+        indexDirectory(library, directory, 0, &analyzed);
+    }
+    // ROMs opened from elsewhere stay while they exist, changes to them are picked up when they're looked up
+    for (uint32_t i = library->count; i-- > 0;) {
+        struct stat info;
+        if (!library->entries[i].seen && (stat(library->strings + library->entries[i].path, &info) != 0 || !S_ISREG(info.st_mode))) {
+            removeEntry(library, i);
+        }
+    }
+    return analyzed;
+}
+
+bool findRomProfile(RomLibrary *library, const char *path, RomProfile *profile) {
+    char canonical[MAX_PATH_LENGTH];
+    struct stat info;
+    if (!canonicalPath(path, canonical) || stat(canonical, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return false;
+    }
+    const RomEntry *entry = indexFile(library, canonical, &info, NULL);
+    if (entry == NULL) {
+        return false;
+    }
+    *profile = entry->profile;
+    return true;
+}
+
+void setRomQuirks(RomLibrary *library, uint64_t hash, uint8_t quirks) {
+    for (uint32_t i = 0; i < library->count; ++i) {
+        RomProfile *profile = &library->entries[i].profile;
+        if (profile->hash == hash) {
+            profile->quirks = quirks;
+            profile->quirks_detected = true;
+            library->modified = true;
+        }
+    }
+}
+
+void applyRomProfile(Chip8 *chip, const RomProfile *profile) {
+    setQuirkFlags(chip, profile->quirks);
+    setInstructions(chip, profile->platform == PLATFORM_XOCHIP ? 2 : 1);
+}
@@ -0,0 +1,58 @@
+#ifndef ROMLIBRARY_H
+#define ROMLIBRARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+// Index of the ROMs under a set of directories: content hash, size, the platform found by a static
+// scan of the reachable code and the quirks and speed to run it with. It's kept in a binary file
+// that's read in one go, refreshing it only analyzes files whose size or modification time changed,
+// and looking a ROM up costs a stat() unless it's new or changed.
+
+typedef enum { PLATFORM_CHIP8, PLATFORM_SUPERCHIP, PLATFORM_XOCHIP } RomPlatform; // setInstructions() type for XO-CHIP
+
+// How to run a ROM
+typedef struct
+{
+    uint64_t hash; // FNV-1a of the ROM
+    uint32_t size;
+    uint32_t cpu_speed; // Instructions per second
+    uint8_t platform; // RomPlatform
+    uint8_t quirks; // QUIRK_* flags, the platform's until detectQuirks() ran on the ROM
+    bool quirks_detected;
+} RomProfile;
+
+typedef struct RomLibrary RomLibrary;
+
+// Reads the index at `path`, a missing or invalid one gives an empty library. NULL if out of memory.
+RomLibrary *loadRomLibrary(const char *path);
+void destroyRomLibrary(RomLibrary *library);
+// Writes the index if anything changed since it was loaded or saved
+bool saveRomLibrary(RomLibrary *library, const char *path);
+
+// Indexes `directory` recursively from now on, it's remembered in the index
+void addRomDirectory(RomLibrary *library, const char *directory);
+// Brings the index in line with the directories, dropping ROMs that are gone.
+// Returns the number of files analyzed.
+uint32_t refreshRomLibrary(RomLibrary *library);
+
+// Profile of the ROM at `path`, analyzing and adding it first if it isn't indexed or changed.
+// A ROM with the content of an indexed one gets the same profile. False if it can't be read.
+bool findRomProfile(RomLibrary *library, const char *path, RomProfile *profile);
+
+// Stores the QUIRK_* flags detectQuirks() picked for every ROM with this hash
+void setRomQuirks(RomLibrary *library, uint64_t hash, uint8_t quirks);
+
+// Platform whose instructions the code reachable from PROGRAM_START uses, `path` (may be NULL)
+// is only looked at for the .sc8 and .xo8 extensions
+RomPlatform detectRomPlatform(const uint8_t *rom, size_t size, const char *path);
+
+// True for the ROM extensions and for binary files without one, so README, LICENSE and the like
+// found next to ROMs are skipped
+bool looksLikeRom(const char *path);
+
+// Machine set up to run a ROM with `profile`, before loadROM()
+void applyRomProfile(Chip8 *chip, const RomProfile *profile);
+
+#endif
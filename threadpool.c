@@ -0,0 +1,249 @@
+#define _DEFAULT_SOURCE // sysconf(_SC_NPROCESSORS_ONLN)
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+    TaskFn fn;
+    void *arg;
+} Task;
+
+// Ring buffer of tasks, the owner pushes and pops at the bottom, thieves take from the top
+typedef struct
+{
+    pthread_mutex_t lock;
+    Task *tasks;
+    uint32_t capacity; // Power of two
+    uint32_t top;
+    uint32_t bottom;
+} TaskDeque;
+
+typedef struct
+{
+    ThreadPool *pool;
+    uint32_t index;
+    pthread_t thread;
+    TaskDeque deque;
+} Worker;
+
+struct ThreadPool
+{
+    uint32_t size;
+    Worker *workers;
+    pthread_mutex_t lock; // Guards everything below
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    uint32_t queued; // Tasks waiting in the deques
+    uint32_t unfinished; // Tasks queued or running
+    uint32_t next_worker; // Round-robin target for tasks submitted from outside
+    bool stopping;
+};
+
+static _Thread_local Worker *current_worker;
+
+uint32_t cpuCount(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+static bool pushBottom(TaskDeque *deque, Task task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        uint32_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        Task *tasks = malloc(capacity * sizeof(Task));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (uint32_t i = deque->top; i != deque->bottom; ++i) {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom++ & (deque->capacity - 1)] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static bool popBottom(TaskDeque *deque, Task *task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->bottom != deque->top;
+    if (found) {
+        *task = deque->tasks[--deque->bottom & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool stealTop(TaskDeque *deque, Task *task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->bottom != deque->top;
+    if (found) {
+        *task = deque->tasks[deque->top++ & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Own deque first, then the other workers in order starting from the next one
+static bool takeTask(Worker *worker, Task *task) {
+    ThreadPool *pool = worker->pool;
+    if (popBottom(&worker->deque, task)) {
+        return true;
+    }
+    for (uint32_t i = 1; i < pool->size; ++i) {
+        if (stealTop(&pool->workers[(worker->index + i) % pool->size].deque, task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *workerMain(void *arg) {
+    Worker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    current_worker = worker;
+    while (1) {
+        Task task;
+        if (takeTask(worker, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            --pool->queued;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->unfinished == 0) {
+                pthread_cond_broadcast(&pool->all_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        bool done = pool->queued == 0 && pool->stopping;
+        pthread_mutex_unlock(&pool->lock);
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+// Wakes and joins the first `started` workers once their deques are empty
+static void stopWorkers(ThreadPool *pool, uint32_t started) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+static void freeThreadPool(ThreadPool *pool) {
+    for (uint32_t i = 0; i < pool->size; ++i) {
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+        free(pool->workers[i].deque.tasks);
+    }
+    pthread_cond_destroy(&pool->all_done);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+ThreadPool *createThreadPool(uint32_t threads) {
+    if (threads == 0) {
+        threads = cpuCount();
+    }
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->workers = calloc(threads, sizeof(Worker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    for (uint32_t i = 0; i < threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+    }
+    pool->size = threads; // Fixed before the workers start, they read it without the lock
+    for (uint32_t i = 0; i < threads; ++i) {
+        if (pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]) != 0) {
+            stopWorkers(pool, i);
+            freeThreadPool(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void destroyThreadPool(ThreadPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    waitThreadPool(pool);
+    stopWorkers(pool, pool->size);
+    freeThreadPool(pool);
+}
+
+uint32_t threadPoolSize(const ThreadPool *pool) {
+    return pool->size;
+}
+
+bool submitTask(ThreadPool *pool, TaskFn fn, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    Worker *worker = current_worker;
+    if (worker == NULL || worker->pool != pool) {
+        worker = &pool->workers[pool->next_worker++ % pool->size];
+    }
+    // Counted before it becomes visible, a worker may take it as soon as it's pushed
+    ++pool->queued;
+    ++pool->unfinished;
+    pthread_mutex_unlock(&pool->lock);
+
+    bool pushed = pushBottom(&worker->deque, (Task){ fn, arg });
+
+    pthread_mutex_lock(&pool->lock);
+    if (pushed) {
+        pthread_cond_signal(&pool->work_available);
+    } else {
+        --pool->queued;
+        if (--pool->unfinished == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return pushed;
+}
+
+void waitThreadPool(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->unfinished > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,31 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fixed set of worker threads with a task deque each. A worker runs its newest task
+// first and, once its own deque is empty, steals the oldest task of another worker,
+// so a few slow tasks don't leave the other threads idle.
+
+typedef void (*TaskFn)(void *arg);
+typedef struct ThreadPool ThreadPool;
+
+// Number of logical processors, at least 1
+uint32_t cpuCount(void);
+
+// Starts the workers, 0 threads - one per logical processor. Returns NULL on failure.
+ThreadPool *createThreadPool(uint32_t threads);
+// Waits for the queued tasks and stops the workers
+void destroyThreadPool(ThreadPool *pool);
+
+uint32_t threadPoolSize(const ThreadPool *pool);
+
+// Queues fn(arg), returns false if out of memory.
+// Tasks submitted by a worker go to its own deque, the others are spread round-robin.
+bool submitTask(ThreadPool *pool, TaskFn fn, void *arg);
+
+// Blocks until every submitted task has finished, mustn't be called from a task
+void waitThreadPool(ThreadPool *pool);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "chip8.h"
+
+// Interface of a translation unit generated by rom2c.
+// Every basic block reachable from PROGRAM_START is a C function, the rest
+// (BNNN targets, code built at runtime, modified code) goes through stepOneСycle.
+
+extern const char aot_rom_name[];
+
+// Loads the embedded ROM like loadROM() and starts watching writes to its compiled code
+bool loadRecompiledROM(Chip8 *chip);
+
+// Executes the given number of instructions
+void runRecompiled(Chip8 *chip, uint32_t cycles);
+
+#endif
@@ -0,0 +1,68 @@
+// Headless runner for a ROM translated by rom2c.
+// Usage: <executable> [instructions] [-s]
+// -s turns on SUPER-CHIP quirks. Prints the speed and a hash of the final state.
+#include "aot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CYCLES_PER_TICK 12 // ~700 instructions per second at TIMER_SPEED
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t hashBytes(const uint8_t *bytes, size_t count, uint64_t hash) {
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL; // FNV-1a
+    }
+    return hash;
+}
+
+int main(int argc, char **argv) {
+    uint64_t cycles = 10000000;
+    bool superchip_quirks = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0) {
+            superchip_quirks = true;
+        } else {
+            cycles = strtoull(argv[i], NULL, 10);
+        }
+    }
+
+    Chip8 *chip = createChip8();
+    if (chip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    resetState(chip, 2);
+    setQuirks(chip, superchip_quirks);
+    if (!loadRecompiledROM(chip)) {
+        fprintf(stderr, "%s\n", chip->message);
+        return 1;
+    }
+
+    double start = now();
+    for (uint64_t done = 0; done < cycles; done += CYCLES_PER_TICK) {
+        runRecompiled(chip, CYCLES_PER_TICK);
+        tickTimers(chip);
+    }
+    double seconds = now() - start;
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint8_t y = 0; y < chip->screen_h; ++y) {
+        for (uint8_t x = 0; x < chip->screen_w; ++x) {
+            uint8_t pixel = getPixel(chip, x, y);
+            hash = hashBytes(&pixel, 1, hash);
+        }
+    }
+    hash = hashBytes(chip->V, sizeof(chip->V), hash);
+    hash = hashBytes(chip->memory, addressSpace(chip), hash);
+    printf("%s: %llu instructions in %.3f s (%.1f MIPS), PC %03X, state %016llx\n",
+        aot_rom_name, (unsigned long long)cycles, seconds, cycles / seconds / 1e6, chip->PC, (unsigned long long)hash);
+    destroyChip8(chip);
+    return 0;
+}
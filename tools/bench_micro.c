@@ -0,0 +1,384 @@
+// Times the core on generated micro-ROMs that each stress one path, next to a set of real games.
+// Usage: bench_micro [-n instructions] [-r runs] [-w warmup_runs] [-c interpreter|decoded|jit]
+//                    [-o text|csv|json] [-s] [rom...]
+// Games default to ROMs/superchip8-roms/*.ch8 (with SUPER-CHIP quirks), -s leaves them out.
+// Every core is measured unless -c picks one. Results go to stdout, so two builds can be compared
+// by diffing or loading their csv/json output.
+#define _DEFAULT_SOURCE // glob()
+#include "chip8.h"
+#include "jit.h"
+#include <glob.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CYCLES_PER_TICK 1200 // Same timer rate as bench_roms
+
+typedef struct
+{
+    uint8_t bytes[MEMORY_SIZE - PROGRAM_START];
+    uint16_t size;
+} RomBuilder;
+
+typedef struct
+{
+    const char *name;
+    uint8_t *data;
+    size_t size;
+    bool superchip_quirks;
+} Workload;
+
+typedef struct
+{
+    const char *name;
+    bool decode_cache;
+    bool jit;
+} Core;
+
+static const Core cores[] = {
+    { "interpreter", false, false },
+    { "decoded", true, false },
+    { "jit", true, true },
+};
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t here(const RomBuilder *rom) {
+    return PROGRAM_START + rom->size;
+}
+
+static void op(RomBuilder *rom, uint16_t opcode) {
+    rom->bytes[rom->size++] = opcode >> 8;
+    rom->bytes[rom->size++] = opcode & 0xFF;
+}
+
+// Distinct values in V0-VE, VF is left to the flags
+static void setRegisters(RomBuilder *rom) {
+    for (uint8_t x = 0; x < 15; ++x) {
+        op(rom, 0x6000 | x << 8 | ((x * 37 + 11) & 0xFF));
+    }
+}
+
+// 8XY0-8XYE over all register pairs
+static void buildAlu(RomBuilder *rom) {
+    static const uint8_t alu_ops[9] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    setRegisters(rom);
+    uint16_t loop = here(rom);
+    for (uint8_t i = 0; i < 63; ++i) {
+        op(rom, 0x8000 | (i % 15) << 8 | ((i * 7 + 3) % 15) << 4 | alu_ops[i % 9]);
+    }
+    op(rom, 0x1000 | loop);
+}
+
+// Taken and not taken 3XNN/4XNN/5XY0, 1NNN to the next instruction, 2NNN/00EE
+static void buildBranches(RomBuilder *rom) {
+    op(rom, 0x6000);
+    op(rom, 0x6100);
+    uint16_t loop = here(rom);
+    uint16_t subroutine = loop + 16 * 14 + 2;
+    for (uint8_t i = 0; i < 16; ++i) {
+        op(rom, 0x3000); // Taken
+        op(rom, 0x1000 | loop);
+        op(rom, 0x4000); // Not taken
+        op(rom, 0x1000 | (here(rom) + 2));
+        op(rom, 0x5010); // Taken
+        op(rom, 0x1000 | loop);
+        op(rom, 0x2000 | subroutine);
+    }
+    op(rom, 0x1000 | loop);
+    op(rom, 0x00EE);
+}
+
+// DXYN at unaligned positions, all heights
+static void buildDrawLores(RomBuilder *rom) {
+    setRegisters(rom);
+    op(rom, 0xA000);
+    uint16_t loop = here(rom);
+    for (uint8_t i = 0; i < 32; ++i) {
+        op(rom, 0xD000 | (i % 15) << 8 | ((i * 4 + 1) % 15) << 4 | (1 + i % 15));
+    }
+    op(rom, 0x1000 | loop);
+}
+
+// DXY0 16x16 sprites on the 128x64 screen
+static void buildDrawHires(RomBuilder *rom) {
+    op(rom, 0x00FF);
+    setRegisters(rom);
+    op(rom, 0xA000);
+    uint16_t loop = here(rom);
+    for (uint8_t i = 0; i < 32; ++i) {
+        op(rom, 0xD000 | (i % 15) << 8 | ((i * 4 + 1) % 15) << 4);
+    }
+    op(rom, 0x1000 | loop);
+}
+
+// 00CN/00FB/00FC on a 128x64 screen with something on it
+static void buildScroll(RomBuilder *rom) {
+    op(rom, 0x00FF);
+    setRegisters(rom);
+    op(rom, 0xA000);
+    for (uint8_t i = 0; i < 15; ++i) {
+        op(rom, 0xD000 | i << 8 | ((i + 5) % 15) << 4);
+    }
+    uint16_t loop = here(rom);
+    for (uint8_t i = 0; i < 32; ++i) {
+        switch (i % 3) {
+            case 0: op(rom, 0x00C1 + i % 4); break;
+            case 1: op(rom, 0x00FB); break;
+            default: op(rom, 0x00FC); break;
+        }
+    }
+    op(rom, 0x1000 | loop);
+}
+
+// FX55/FX65 of all 16 registers
+static void buildBlockMoves(RomBuilder *rom) {
+    setRegisters(rom);
+    uint16_t loop = here(rom);
+    for (uint8_t i = 0; i < 16; ++i) {
+        op(rom, 0xA400);
+        op(rom, 0xFF55);
+        op(rom, 0xA400);
+        op(rom, 0xFF65);
+    }
+    op(rom, 0x1000 | loop);
+}
+
+// Polls the delay timer until it runs out, then sets it again
+static void buildTimerWait(RomBuilder *rom) {
+    uint16_t start = here(rom);
+    op(rom, 0x6005);
+    op(rom, 0xF015);
+    uint16_t wait = here(rom);
+    op(rom, 0xF107);
+    op(rom, 0x3100);
+    op(rom, 0x1000 | wait);
+    op(rom, 0x1000 | start);
+}
+
+// FX0A with no key ever pressed
+static void buildKeyWait(RomBuilder *rom) {
+    op(rom, 0xF00A);
+    op(rom, 0x1200);
+}
+
+static const struct
+{
+    const char *name;
+    void (*build)(RomBuilder *rom);
+} micro_roms[] = {
+    { "alu", buildAlu },
+    { "branches", buildBranches },
+    { "draw_lores", buildDrawLores },
+    { "draw_hires", buildDrawHires },
+    { "scroll", buildScroll },
+    { "block_moves", buildBlockMoves },
+    { "timer_wait", buildTimerWait },
+    { "key_wait", buildKeyWait },
+};
+
+static bool addGame(Workload *workloads, size_t *count, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return false;
+    }
+    uint8_t *data = malloc(MEMORY_SIZE - PROGRAM_START);
+    size_t size = data ? fread(data, 1, MEMORY_SIZE - PROGRAM_START, file) : 0;
+    fclose(file);
+    if (size == 0) {
+        free(data);
+        return false;
+    }
+    const char *name = strrchr(path, '/');
+    workloads[(*count)++] = (Workload){ strdup(name ? name + 1 : path), data, size, true };
+    return true;
+}
+
+typedef struct
+{
+    uint32_t runs;
+    double mean_ns; // Per instruction
+    double stddev_ns;
+    double min_ns;
+    bool halted; // Stopped by 00FD before the instruction count was reached
+} Measurement;
+
+static Measurement measure(Chip8 *chip, const Workload *workload, uint64_t instructions, uint32_t warmup_runs, uint32_t runs) {
+    Measurement result = { 0, 0, 0, 0, false };
+    double sum = 0;
+    double sum_squares = 0;
+    for (uint32_t run = 0; run < warmup_runs + runs; ++run) {
+        resetState(chip, 2);
+        setQuirks(chip, workload->superchip_quirks);
+        loadROMFromMemory(chip, workload->data, workload->size);
+
+        double start = now();
+        for (uint64_t done = 0; done < instructions && !chip->halted; done += CYCLES_PER_TICK) {
+            uint64_t left = instructions - done;
+            runCycles(chip, left < CYCLES_PER_TICK ? (uint32_t)left : CYCLES_PER_TICK);
+            tickTimers(chip);
+        }
+        double ns = (now() - start) * 1e9 / instructions;
+        if (chip->halted) {
+            result.halted = true;
+            return result;
+        }
+        if (run < warmup_runs) {
+            continue;
+        }
+        sum += ns;
+        sum_squares += ns * ns;
+        if (result.runs == 0 || ns < result.min_ns) {
+            result.min_ns = ns;
+        }
+        ++result.runs;
+    }
+    result.mean_ns = sum / runs;
+    double variance = sum_squares / runs - result.mean_ns * result.mean_ns;
+    result.stddev_ns = variance > 0 ? sqrt(variance) : 0;
+    return result;
+}
+
+static void printJsonString(const char *text) {
+    putchar('"');
+    for (; *text; ++text) {
+        if (*text == '"' || *text == '\\') {
+            putchar('\\');
+        }
+        putchar(*text);
+    }
+    putchar('"');
+}
+
+int main(int argc, char **argv) {
+    uint64_t instructions = 5000000;
+    uint32_t runs = 5;
+    uint32_t warmup_runs = 1;
+    const char *only_core = NULL;
+    const char *format = "text";
+    bool synthetic_only = false;
+    int first_rom = 1;
+    for (; first_rom < argc && argv[first_rom][0] == '-'; ++first_rom) {
+        const char *option = argv[first_rom];
+        if (strcmp(option, "-s") == 0) {
+            synthetic_only = true;
+            continue;
+        }
+        if (first_rom + 1 >= argc) {
+            break;
+        }
+        const char *value = argv[++first_rom];
+        if (strcmp(option, "-n") == 0) {
+            instructions = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "-r") == 0) {
+            runs = strtoul(value, NULL, 10);
+        } else if (strcmp(option, "-w") == 0) {
+            warmup_runs = strtoul(value, NULL, 10);
+        } else if (strcmp(option, "-c") == 0) {
+            only_core = value;
+        } else if (strcmp(option, "-o") == 0) {
+            format = value;
+        }
+    }
+    if (first_rom < argc && argv[first_rom][0] == '-') {
+        fprintf(stderr, "Usage: %s [-n instructions] [-r runs] [-w warmup_runs] [-c interpreter|decoded|jit]\n"
+            "       [-o text|csv|json] [-s] [rom...]\n", argv[0]);
+        return 1;
+    }
+    if (instructions == 0 || runs == 0) {
+        fprintf(stderr, "Nothing to measure\n");
+        return 1;
+    }
+
+    size_t micro_count = sizeof(micro_roms) / sizeof(micro_roms[0]);
+    glob_t games = {0};
+    if (!synthetic_only && first_rom == argc) {
+        glob("ROMs/superchip8-roms/*.ch8", 0, NULL, &games);
+    }
+    size_t max_workloads = micro_count + games.gl_pathc + (argc - first_rom);
+    Workload *workloads = calloc(max_workloads, sizeof(Workload));
+    RomBuilder *rom = calloc(1, sizeof(RomBuilder));
+    Chip8 *chip = createChip8();
+    if (workloads == NULL || rom == NULL || chip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < micro_count; ++i) {
+        rom->size = 0;
+        micro_roms[i].build(rom);
+        uint8_t *data = malloc(rom->size);
+        memcpy(data, rom->bytes, rom->size);
+        workloads[count++] = (Workload){ strdup(micro_roms[i].name), data, rom->size, false };
+    }
+    for (size_t i = 0; i < games.gl_pathc; ++i) {
+        addGame(workloads, &count, games.gl_pathv[i]);
+    }
+    for (int i = first_rom; i < argc && !synthetic_only; ++i) {
+        addGame(workloads, &count, argv[i]);
+    }
+    globfree(&games);
+
+    bool json = strcmp(format, "json") == 0;
+    bool csv = strcmp(format, "csv") == 0;
+    if (csv) {
+        printf("workload,core,instructions,runs,mean_ns,stddev_ns,min_ns,mips,halted\n");
+    } else if (json) {
+        printf("[");
+    } else {
+        printf("%-44s %-12s %9s %9s %7s %9s\n", "workload", "core", "ns/instr", "MIPS", "stddev", "min ns");
+    }
+    bool first_result = true;
+    for (size_t c = 0; c < sizeof(cores) / sizeof(cores[0]); ++c) {
+        const Core *core = &cores[c];
+        if (only_core && strcmp(only_core, core->name) != 0) {
+            continue;
+        }
+        setDecodeCache(chip, core->decode_cache);
+        if (!setJit(chip, core->jit)) {
+            fprintf(stderr, "%s isn't supported on this platform\n", core->name);
+            continue;
+        }
+        for (size_t w = 0; w < count; ++w) {
+            Measurement m = measure(chip, &workloads[w], instructions, warmup_runs, runs);
+            double mips = m.mean_ns > 0 ? 1e3 / m.mean_ns : 0;
+            if (csv) {
+                printf("\"%s\",%s,%llu,%u,%.4f,%.4f,%.4f,%.2f,%d\n", workloads[w].name, core->name, (unsigned long long)instructions,
+                    m.runs, m.mean_ns, m.stddev_ns, m.min_ns, mips, m.halted);
+            } else if (json) {
+                printf("%s\n  {\"workload\": ", first_result ? "" : ",");
+                printJsonString(workloads[w].name);
+                printf(", \"core\": \"%s\", \"instructions\": %llu, \"runs\": %u, \"mean_ns\": %.4f, \"stddev_ns\": %.4f, "
+                    "\"min_ns\": %.4f, \"mips\": %.2f, \"halted\": %s}", core->name, (unsigned long long)instructions,
+                    m.runs, m.mean_ns, m.stddev_ns, m.min_ns, mips, m.halted ? "true" : "false");
+            } else if (m.halted) {
+                printf("%-44.44s %-12s %9s\n", workloads[w].name, core->name, "halted");
+            } else {
+                printf("%-44.44s %-12s %9.3f %9.1f %6.1f%% %9.3f\n", workloads[w].name, core->name, m.mean_ns, mips,
+                    100 * m.stddev_ns / m.mean_ns, m.min_ns);
+            }
+            first_result = false;
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+
+    setJit(chip, false);
+    setDecodeCache(chip, false);
+    destroyChip8(chip);
+    for (size_t w = 0; w < count; ++w) {
+        free((char *)workloads[w].name);
+        free(workloads[w].data);
+    }
+    free(workloads);
+    free(rom);
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Runs ROMs headless and reports how fast the core executes them.
+// Usage: bench_roms [-n instructions] [-r repeats] [-c interpreter|decoded|jit] rom...
+// ROMs under a superchip8 directory run with SUPER-CHIP quirks.
+#include "chip8.h"
+#include "jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CYCLES_PER_TICK 1200 // Timers tick as if the machine ran at 72000 instructions per second
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Hash of the visible screen, so runs with different cores or builds can be compared
+static uint64_t screenHash(const Chip8 *chip) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint8_t y = 0; y < chip->screen_h; ++y) {
+        for (uint8_t x = 0; x < chip->screen_w; ++x) {
+            hash = (hash ^ getPixel(chip, x, y)) * 1099511628211ULL; // FNV-1a
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char **argv) {
+    uint64_t cycles = 20000000;
+    uint32_t repeats = 3;
+    const char *core = "decoded";
+    int first_rom = 1;
+    for (; first_rom < argc - 1 && argv[first_rom][0] == '-'; first_rom += 2) {
+        if (strcmp(argv[first_rom], "-n") == 0) {
+            cycles = strtoull(argv[first_rom + 1], NULL, 10);
+        } else if (strcmp(argv[first_rom], "-r") == 0) {
+            repeats = strtoul(argv[first_rom + 1], NULL, 10);
+        } else if (strcmp(argv[first_rom], "-c") == 0) {
+            core = argv[first_rom + 1];
+        }
+    }
+    if (first_rom >= argc) {
+        fprintf(stderr, "Usage: %s [-n instructions] [-r repeats] [-c interpreter|decoded|jit] rom...\n", argv[0]);
+        return 1;
+    }
+
+    Chip8 *chip = createChip8();
+    if (chip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (strcmp(core, "interpreter") != 0) {
+        setDecodeCache(chip, true);
+    }
+    if (strcmp(core, "jit") == 0 && !setJit(chip, true)) {
+        fprintf(stderr, "JIT isn't supported on this platform\n");
+        return 1;
+    }
+
+    double total_seconds = 0;
+    for (int rom = first_rom; rom < argc; ++rom) {
+        double best = 0;
+        uint64_t hash = 0;
+        for (uint32_t run = 0; run < repeats; ++run) {
+            resetState(chip, 2);
+            if (strstr(argv[rom], "superchip8")) {
+                setQuirks(chip, 1);
+            }
+            if (!loadROM(chip, argv[rom])) {
+                fprintf(stderr, "%s: %s\n", argv[rom], chip->message);
+                break;
+            }
+            double start = now();
+            for (uint64_t done = 0; done < cycles; done += CYCLES_PER_TICK) {
+                runCycles(chip, CYCLES_PER_TICK);
+                tickTimers(chip);
+            }
+            double seconds = now() - start;
+            if (run == 0 || seconds < best) {
+                best = seconds;
+            }
+            hash = screenHash(chip);
+        }
+        total_seconds += best;
+        const char *name = strrchr(argv[rom], '/');
+        printf("%8.1f ms %8.1f MIPS  %016llx  %s\n", best * 1e3, cycles / best / 1e6,
+            (unsigned long long)hash, name ? name + 1 : argv[rom]);
+    }
+    printf("%8.1f ms total (%s)\n", total_seconds * 1e3, core);
+    destroyChip8(chip);
+    return 0;
+}
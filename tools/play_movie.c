@@ -0,0 +1,106 @@
+// Plays input movies headless as fast as possible and checks that they end where the recording did.
+// Usage: play_movie [-c interpreter|decoded|jit] [-r repeats] [-p profile.folded] movie...
+// -p profiles all the runs (on the decode cache) and writes their call paths for flame graph tools.
+// Exits with 1 if any movie couldn't be read or desynced.
+#include "chip8.h"
+#include "jit.h"
+#include "movie.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    const char *core = "decoded";
+    uint32_t repeats = 1;
+    const char *profile_path = NULL;
+    int first_movie = 1;
+    for (; first_movie < argc - 1 && argv[first_movie][0] == '-'; first_movie += 2) {
+        if (strcmp(argv[first_movie], "-c") == 0) {
+            core = argv[first_movie + 1];
+        } else if (strcmp(argv[first_movie], "-r") == 0) {
+            repeats = strtoul(argv[first_movie + 1], NULL, 10);
+        } else if (strcmp(argv[first_movie], "-p") == 0) {
+            profile_path = argv[first_movie + 1];
+        }
+    }
+    if (first_movie >= argc || repeats == 0) {
+        fprintf(stderr, "Usage: %s [-c interpreter|decoded|jit] [-r repeats] [-p profile.folded] movie...\n", argv[0]);
+        return 1;
+    }
+
+    Chip8 *chip = createChip8();
+    if (chip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (strcmp(core, "interpreter") != 0) {
+        setDecodeCache(chip, true);
+    }
+    if (strcmp(core, "jit") == 0 && !setJit(chip, true)) {
+        fprintf(stderr, "JIT isn't supported on this platform\n");
+        return 1;
+    }
+    if (profile_path != NULL && (chip->profiler = createProfiler()) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = first_movie; i < argc; ++i) {
+        double best = 0;
+        uint64_t instructions = 0;
+        uint64_t idle = 0;
+        MovieStatus status = MOVIE_NONE;
+        uint32_t frames = 0;
+        for (uint32_t repeat = 0; repeat < repeats; ++repeat) {
+            resetState(chip, 2);
+            Movie *movie = startMoviePlayback(chip, argv[i], NULL);
+            if (movie == NULL) {
+                fprintf(stderr, "%s: %s\n", argv[i], chip->message);
+                result = 1;
+                break;
+            }
+            instructions = 0;
+            double start = now();
+            uint32_t cpu_speed = 0;
+            while (movieFrame(movie, chip, &cpu_speed)) {
+                instructions += runFrame(chip, cpu_speed);
+            }
+            double seconds = now() - start;
+            if (repeat == 0 || seconds < best) {
+                best = seconds;
+            }
+            idle = chip->idle_cycles;
+            status = movieStatus(movie);
+            frames = movieLength(movie);
+            destroyMovie(movie);
+        }
+        if (status == MOVIE_NONE) {
+            continue;
+        }
+        printf("%s: %u frames, %llu instructions (%.0f%% idle) in %.3f s (%.1f MIPS, %.0fx real time), %s\n",
+            argv[i], frames, (unsigned long long)instructions, instructions ? 100.0 * idle / instructions : 0.0,
+            best, instructions / best / 1e6,
+            frames / (double)TIMER_SPEED / best, status == MOVIE_FINISHED ? "same end state" : "DESYNCED");
+        if (status != MOVIE_FINISHED) {
+            result = 1;
+        }
+    }
+    if (chip->profiler != NULL) {
+        if (!saveCollapsedStacks(chip->profiler, profile_path)) {
+            fprintf(stderr, "Couldn't write %s\n", profile_path);
+            result = 1;
+        }
+        destroyProfiler(chip->profiler);
+    }
+    destroyChip8(chip);
+    return result;
+}
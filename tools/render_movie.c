@@ -0,0 +1,97 @@
+// Plays an input movie headless and writes every emulated frame through the same post-processing as
+// the window, as a stream of binary PPM images on stdout (ffmpeg reads it with -f image2pipe).
+// Usage: render_movie [-p off|or|decay] [-n frames] [-s 1|2|3] movie > frames.ppm
+// -n is how long erased pixels stay lit (or) or take to fade to half (decay), -s picks Scale2x or Scale3x.
+#include "chip8.h"
+#include "movie.h"
+#include "postfx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// White on black for CHIP-8 and SUPER-CHIP, the other plane combinations in distinct colours
+static const uint8_t palette_rgba[1 << SCREEN_PLANES][4] = {
+    { 0, 0, 0, 0 }, { 255, 255, 255, 255 }, { 255, 80, 80, 255 }, { 80, 255, 80, 255 },
+    { 80, 80, 255, 255 }, { 255, 255, 80, 255 }, { 80, 255, 255, 255 }, { 255, 80, 255, 255 },
+    { 160, 160, 160, 255 }, { 160, 40, 40, 255 }, { 40, 160, 40, 255 }, { 40, 40, 160, 255 },
+    { 160, 160, 40, 255 }, { 40, 160, 160, 255 }, { 160, 40, 160, 255 }, { 255, 160, 40, 255 }
+};
+
+static void writeFrame(const uint32_t *pixels, uint16_t width, uint16_t height, uint8_t *rgb) {
+    for (uint16_t y = 0; y < height; ++y) {
+        for (uint16_t x = 0; x < width; ++x) {
+            uint8_t rgba[4];
+            memcpy(rgba, &pixels[y * POSTFX_MAX_W + x], 4);
+            for (uint8_t i = 0; i < 3; ++i) {
+                rgb[(y * width + x) * 3 + i] = rgba[i] * rgba[3] / 255; // Over black
+            }
+        }
+    }
+    printf("P6\n%u %u\n255\n", width, height);
+    fwrite(rgb, 3, (size_t)width * height, stdout);
+}
+
+int main(int argc, char **argv) {
+    PostFxSettings settings = { PERSISTENCE_OFF, 3, 1 };
+    int arg = 1;
+    for (; arg < argc - 1 && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "-p") == 0) {
+            settings.persistence = strcmp(argv[arg + 1], "or") == 0 ? PERSISTENCE_OR
+                : strcmp(argv[arg + 1], "decay") == 0 ? PERSISTENCE_DECAY : PERSISTENCE_OFF;
+        } else if (strcmp(argv[arg], "-n") == 0) {
+            settings.frames = (uint8_t)strtoul(argv[arg + 1], NULL, 10);
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            settings.scale = (uint8_t)strtoul(argv[arg + 1], NULL, 10);
+        }
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "Usage: %s [-p off|or|decay] [-n frames] [-s 1|2|3] movie > frames.ppm\n", argv[0]);
+        return 1;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    Chip8 *chip = createChip8();
+    PostFx *fx = createPostFx();
+    uint8_t *rgb = malloc(POSTFX_MAX_W * POSTFX_MAX_H * 3);
+    if (chip == NULL || fx == NULL || rgb == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    uint32_t palette[1 << SCREEN_PLANES];
+    memcpy(palette, palette_rgba, sizeof(palette));
+    setPostFxPalette(fx, palette);
+    setPostFxSettings(fx, settings);
+    setDecodeCache(chip, true);
+    resetState(chip, 2);
+
+    Movie *movie = startMoviePlayback(chip, argv[arg], NULL);
+    if (movie == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[arg], chip->message);
+        return 1;
+    }
+    uint32_t cpu_speed = 0;
+    chip->dirty_rows = UINT64_MAX;
+    while (movieFrame(movie, chip, &cpu_speed)) {
+        runFrame(chip, cpu_speed);
+        runPostFx(fx, chip, chip->dirty_rows, 1);
+        chip->dirty_rows = 0;
+        uint16_t width, height;
+        const uint32_t *pixels = postFxPixels(fx, &width, &height);
+        writeFrame(pixels, width, height, rgb);
+    }
+    int result = movieStatus(movie) == MOVIE_FINISHED ? 0 : 1;
+    if (result != 0) {
+        fprintf(stderr, "%s desynced\n", argv[arg]);
+    }
+    destroyMovie(movie);
+    free(rgb);
+    destroyPostFx(fx);
+    destroyChip8(chip);
+    return result;
+}
@@ -0,0 +1,393 @@
+// Static recompiler: translates a ROM into a C file implementing tools/aot.h.
+// Usage: rom2c <rom.ch8> <output.c>
+//
+// Basic blocks are found by recursive traversal from PROGRAM_START: jumps, calls,
+// both sides of skips and return addresses of calls are followed, BNNN targets
+// and 00EE are left to the runtime. Every instruction is emitted as a call to the
+// core opcode helper, so quirks keep working the same way as in stepOneСycle.
+// Only CHIP-8 and SUPER-CHIP ROMs (up to 4 KB) are compiled, XO-CHIP stays with the interpreter.
+#include "chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint8_t memory[MEMORY_SIZE];
+uint16_t rom_end; // First address after the ROM
+bool leader[MEMORY_SIZE]; // Start of a basic block
+bool code[MEMORY_SIZE]; // Byte belongs to a compiled instruction
+uint16_t worklist[MEMORY_SIZE];
+uint16_t worklist_size;
+
+static uint16_t opcodeAt(uint16_t addr) {
+    return (memory[addr] << 8) | memory[addr + 1];
+}
+
+static bool isHiresInit(uint16_t addr) {
+    return addr == PROGRAM_START && opcodeAt(addr) == 0x1260;
+}
+
+static bool isCompilable(uint16_t addr) {
+    return addr >= PROGRAM_START && addr + 1 < rom_end && addr < LEGACY_MEMORY_SIZE - 2 && !isHiresInit(addr);
+}
+
+static void addLeader(uint16_t addr) {
+    if (isHiresInit(addr)) {
+        addr = 0x2C0; // stepOneСycle switches to 64x64 and jumps there
+    }
+    if (!isCompilable(addr) || leader[addr]) {
+        return;
+    }
+    leader[addr] = true;
+    worklist[worklist_size++] = addr;
+}
+
+// Returns true if the instruction at addr ends a basic block, adds its static successors
+static bool endsBlock(uint16_t addr, bool follow) {
+    uint16_t opcode = opcodeAt(addr);
+    uint16_t next = addr + 2;
+    uint8_t n = opcode & 0xF;
+    uint8_t nn = opcode & 0xFF;
+    bool ends = false;
+    uint16_t targets[2];
+    uint8_t targets_count = 0;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00EE) {
+                ends = true;
+            } else if (opcode == 0x00FD) {
+                ends = true;
+                targets[targets_count++] = next;
+            }
+            break;
+        case 0x1:
+            ends = true;
+            targets[targets_count++] = opcode & 0xFFF;
+            break;
+        case 0x2:
+            ends = true;
+            targets[targets_count++] = opcode & 0xFFF;
+            targets[targets_count++] = next;
+            break;
+        case 0x5:
+        case 0x9:
+            if (n != 0) {
+                break;
+            }
+            // fallthrough
+        case 0x3:
+        case 0x4:
+            ends = true;
+            targets[targets_count++] = next;
+            targets[targets_count++] = next + 2;
+            break;
+        case 0xB:
+            ends = true; // Indirect, resolved by the runtime
+            break;
+        case 0xE:
+            if (nn == 0x9E || nn == 0xA1) {
+                ends = true;
+                targets[targets_count++] = next;
+                targets[targets_count++] = next + 2;
+            }
+            break;
+        case 0xF:
+            // FX0A may repeat itself, the rest write to memory and may change code
+            if (nn == 0x0A || nn == 0x29 || nn == 0x30 || nn == 0x33 || nn == 0x55) {
+                ends = true;
+                targets[targets_count++] = next;
+            }
+            break;
+    }
+    if (follow) {
+        for (uint8_t i = 0; i < targets_count; ++i) {
+            addLeader(targets[i]);
+        }
+    }
+    return ends;
+}
+
+static void findBlocks(void) {
+    addLeader(PROGRAM_START);
+    while (worklist_size > 0) {
+        uint16_t addr = worklist[--worklist_size];
+        while (isCompilable(addr)) {
+            code[addr] = true;
+            code[addr + 1] = true;
+            if (endsBlock(addr, true)) {
+                break;
+            }
+            addr += 2;
+            if (leader[addr]) {
+                break;
+            }
+        }
+    }
+}
+
+static void writeInstruction(FILE *out, uint16_t addr) {
+    uint16_t opcode = opcodeAt(addr);
+    uint8_t x = (opcode >> 8) & 0xF;
+    uint8_t y = (opcode >> 4) & 0xF;
+    uint8_t n = opcode & 0xF;
+    uint8_t nn = opcode & 0xFF;
+    uint16_t nnn = opcode & 0xFFF;
+    uint16_t next = addr + 2;
+
+    fprintf(out, "    // 0x%03X: %04X\n", addr, opcode);
+    switch (opcode >> 12) {
+        case 0x0:
+            switch (opcode) {
+                case 0x00E0: fprintf(out, "    clearScreen(chip);\n"); return;
+                case 0x00EE: fprintf(out, "    returnFromSubRoutine(chip);\n"); return;
+                case 0x00FB: fprintf(out, "    if (chip->superchip_instructions_set) scrollDisplayRight(chip);\n"); return;
+                case 0x00FC: fprintf(out, "    if (chip->superchip_instructions_set) scrollDisplayLeft(chip);\n"); return;
+                case 0x00FD:
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    fprintf(out, "    if (chip->superchip_instructions_set) chip->halted = true;\n");
+                    return;
+                case 0x00FE: fprintf(out, "    if (chip->superchip_instructions_set) setScreenMode(chip, 0);\n"); return;
+                case 0x00FF: fprintf(out, "    if (chip->superchip_instructions_set) setScreenMode(chip, 2);\n"); return;
+            }
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                fprintf(out, "    if (chip->superchip_instructions_set) scrollDisplayDownN(chip, %u);\n", n);
+            }
+            return;
+        case 0x1:
+            fprintf(out, "    jump(chip, 0x%03X);\n", nnn);
+            return;
+        case 0x2:
+            fprintf(out, "    chip->PC = 0x%03X;\n", next);
+            fprintf(out, "    execSubroutine(chip, 0x%03X);\n", nnn);
+            return;
+        case 0x3:
+            fprintf(out, "    chip->PC = 0x%03X;\n", next);
+            fprintf(out, "    skipIfVxEqNN(chip, %u, 0x%02X);\n", x, nn);
+            return;
+        case 0x4:
+            fprintf(out, "    chip->PC = 0x%03X;\n", next);
+            fprintf(out, "    skipIfVxNotEqNN(chip, %u, 0x%02X);\n", x, nn);
+            return;
+        case 0x5:
+            if (n == 0) {
+                fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                fprintf(out, "    skipIfVxEqVy(chip, %u, %u);\n", x, y);
+            }
+            return;
+        case 0x6:
+            fprintf(out, "    setVXNN(chip, %u, 0x%02X);\n", x, nn);
+            return;
+        case 0x7:
+            fprintf(out, "    addNNToVX(chip, %u, 0x%02X);\n", x, nn);
+            return;
+        case 0x8: {
+            static const char *helpers[16] = {
+                "setVxVy", "orVxVy", "andVxVy", "xorVxVy", "addVxVy", "subtractVxVy", "shiftVxRight", "subtractVyVx",
+                NULL, NULL, NULL, NULL, NULL, NULL, "shiftVxLeft", NULL
+            };
+            if (helpers[n] != NULL) {
+                fprintf(out, "    %s(chip, %u, %u);\n", helpers[n], x, y);
+            }
+            return;
+        }
+        case 0x9:
+            if (n == 0) {
+                fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                fprintf(out, "    skipIfVXNotEqVy(chip, %u, %u);\n", x, y);
+            }
+            return;
+        case 0xA:
+            fprintf(out, "    setINNN(chip, 0x%03X);\n", nnn);
+            return;
+        case 0xB:
+            fprintf(out, "    if (chip->superchip_offset_jump) offsetJumpSC(chip, %u, 0x%02X);\n", x, nn);
+            fprintf(out, "    else offsetJump(chip, 0x%03X);\n", nnn);
+            return;
+        case 0xC:
+            fprintf(out, "    randomNNToVx(chip, %u, 0x%02X);\n", x, nn);
+            return;
+        case 0xD:
+            if (n == 0) {
+                fprintf(out, "    if (chip->superchip_instructions_set) drawHighRes(chip, %u, %u);\n", x, y);
+                fprintf(out, "    else draw(chip, %u, %u, 0);\n", x, y);
+            } else {
+                fprintf(out, "    draw(chip, %u, %u, %u);\n", x, y, n);
+            }
+            return;
+        case 0xE:
+            if (nn == 0x9E || nn == 0xA1) {
+                fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                fprintf(out, "    %s(chip, %u);\n", nn == 0x9E ? "skipIfKeyPressed" : "skipIfKeyNotPressed", x);
+            }
+            return;
+        case 0xF:
+            switch (nn) {
+                case 0x07: fprintf(out, "    setVxToDTimer(chip, %u);\n", x); return;
+                case 0x0A:
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    fprintf(out, "    getKey(chip, %u);\n", x);
+                    return;
+                case 0x15: fprintf(out, "    setDTimerToVx(chip, %u);\n", x); return;
+                case 0x18: fprintf(out, "    setSTimerToVx(chip, %u);\n", x); return;
+                case 0x1E: fprintf(out, "    addToI(chip, %u);\n", x); return;
+                case 0x29:
+                    fprintf(out, "    if (chip->currently_loaded_font_type != 0) setFontType(chip, 0);\n");
+                    fprintf(out, "    setIToLowResFontChar(chip, %u);\n", x);
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    return;
+                case 0x30:
+                    fprintf(out, "    if (chip->superchip_instructions_set) {\n");
+                    fprintf(out, "        if (chip->currently_loaded_font_type == 0) setFontType(chip, 1);\n");
+                    fprintf(out, "        setIToHighResFontChar(chip, %u);\n", x);
+                    fprintf(out, "    }\n");
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    return;
+                case 0x33:
+                    fprintf(out, "    binCodedDecimalConversion(chip, %u);\n", x);
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    return;
+                case 0x55:
+                    fprintf(out, "    storeRegistersInMemory(chip, %u);\n", x);
+                    fprintf(out, "    chip->PC = 0x%03X;\n", next);
+                    return;
+                case 0x65: fprintf(out, "    loadRegistersFromMemory(chip, %u);\n", x); return;
+                case 0x75: fprintf(out, "    if (chip->superchip_instructions_set) saveRegStateToLocalStorage(chip, %u);\n", x); return;
+                case 0x85: fprintf(out, "    if (chip->superchip_instructions_set) loadRegStateFromLocalStorage(chip, %u);\n", x); return;
+            }
+            return;
+    }
+}
+
+// Writes the function of the block starting at addr, returns its length in instructions
+static uint16_t writeBlock(FILE *out, uint16_t addr) {
+    uint16_t length = 0;
+    fprintf(out, "static void block_0x%03X(Chip8 *chip) {\n", addr);
+    while (true) {
+        writeInstruction(out, addr);
+        ++length;
+        bool ends = endsBlock(addr, false);
+        addr += 2;
+        if (ends) {
+            break;
+        }
+        if (leader[addr] || !isCompilable(addr)) {
+            fprintf(out, "    chip->PC = 0x%03X;\n", addr);
+            break;
+        }
+    }
+    fprintf(out, "}\n\n");
+    return length;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <rom.ch8> <output.c>\n", argv[0]);
+        return 1;
+    }
+    FILE *rom = fopen(argv[1], "rb");
+    if (rom == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", argv[1]);
+        return 1;
+    }
+    size_t rom_size = fread(memory + PROGRAM_START, 1, LEGACY_MEMORY_SIZE - PROGRAM_START, rom);
+    bool too_big = fgetc(rom) != EOF;
+    fclose(rom);
+    if (too_big) {
+        fprintf(stderr, "ROM is too big.\n");
+        return 1;
+    }
+    rom_end = PROGRAM_START + rom_size;
+
+    findBlocks();
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        fprintf(stderr, "Couldn't create %s\n", argv[2]);
+        return 1;
+    }
+
+    const char *name = strrchr(argv[1], '/');
+    name = name ? name + 1 : argv[1];
+    fprintf(out, "// Generated by rom2c from %s, don't edit\n", name);
+    fprintf(out, "#include \"aot.h\"\n#include <string.h>\n\n");
+    fprintf(out, "const char aot_rom_name[] = \"");
+    for (const char *c = name; *c; ++c) {
+        if (*c == '"' || *c == '\\') fputc('\\', out);
+        fputc(*c, out);
+    }
+    fprintf(out, "\";\n\n");
+
+    fprintf(out, "static const uint8_t rom[%zu] = {", rom_size ? rom_size : 1);
+    for (size_t i = 0; i < rom_size; ++i) {
+        fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", memory[PROGRAM_START + i]);
+    }
+    if (rom_size == 0) {
+        fprintf(out, " 0");
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint8_t code_map[MEMORY_SIZE] = {");
+    uint16_t mapped = 0;
+    for (uint32_t i = 0; i < LEGACY_MEMORY_SIZE; ++i) {
+        if (code[i]) {
+            fprintf(out, "%s[0x%03X] = 1,", mapped++ % 8 ? " " : "\n    ", i);
+        }
+    }
+    if (mapped == 0) {
+        fprintf(out, " 0");
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "typedef struct\n{\n    void (*fn)(Chip8 *chip);\n    uint16_t length; // Instructions\n} AotBlock;\n\n");
+    static uint16_t lengths[MEMORY_SIZE];
+    uint16_t blocks_count = 0;
+    for (uint16_t addr = PROGRAM_START; addr < rom_end; ++addr) {
+        if (leader[addr]) {
+            lengths[addr] = writeBlock(out, addr);
+            ++blocks_count;
+        }
+    }
+
+    fprintf(out, "static const AotBlock blocks[LEGACY_MEMORY_SIZE] = {\n");
+    if (blocks_count == 0) {
+        fprintf(out, "    { NULL, 0 }\n");
+    }
+    for (uint16_t addr = PROGRAM_START; addr < rom_end; ++addr) {
+        if (leader[addr]) {
+            fprintf(out, "    [0x%03X] = { block_0x%03X, %u },\n", addr, addr, lengths[addr]);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out,
+        "bool loadRecompiledROM(Chip8 *chip) {\n"
+        "    if (!loadROMFromMemory(chip, rom, %zu)) {\n"
+        "        return false;\n"
+        "    }\n"
+        "    chip->code_map = code_map;\n"
+        "    chip->code_modified = false;\n"
+        "    return true;\n"
+        "}\n\n", rom_size);
+
+    fprintf(out,
+        "// Compiled blocks run only while their bytes match the ROM, once code was\n"
+        "// written to they're compared before every use\n"
+        "void runRecompiled(Chip8 *chip, uint32_t cycles) {\n"
+        "    while (cycles > 0 && !chip->halted) {\n"
+        "        uint16_t pc = chip->PC;\n"
+        "        const AotBlock *block = pc < LEGACY_MEMORY_SIZE ? &blocks[pc] : NULL;\n"
+        "        if (block == NULL || block->fn == NULL || block->length > cycles\n"
+        "            || (chip->code_modified && memcmp(chip->memory + pc, rom + (pc - PROGRAM_START), 2 * block->length) != 0)) {\n"
+        "            stepOneСycle(chip);\n"
+        "            --cycles;\n"
+        "            continue;\n"
+        "        }\n"
+        "        block->fn(chip);\n"
+        "        cycles -= block->length;\n"
+        "    }\n"
+        "}\n");
+    fclose(out);
+
+    printf("%s: %u blocks, %u of %zu bytes compiled\n", name, blocks_count, mapped, rom_size);
+    return 0;
+}
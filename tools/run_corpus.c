@@ -0,0 +1,432 @@
+// Runs a set of ROMs headless on all cores and reports, per ROM, how fast it ran,
+// a hash of the final screen, how it ended and which instructions it executed.
+// Usage: run_corpus [-f frames | -n instructions] [-i instructions_per_frame] [-j threads]
+//                   [-c interpreter|decoded|jit] [-w stall_frames] [-t seconds] [-H] [rom|dir|glob]...
+// Directories are searched recursively (ROMs by default). Each ROM runs with the instructions and
+// quirks of the platform detectRomPlatform() finds. The opcode histogram isn't collected by the JIT.
+#define _DEFAULT_SOURCE // glob(), strdup(), nanosleep()
+#include "chip8.h"
+#include "jit.h"
+#include "romlibrary.h"
+#include "threadpool.h"
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+typedef enum { ROM_QUEUED, ROM_RUNNING, ROM_DONE } RomState;
+
+// One ROM of the corpus, the watchdog reads the atomic fields while a worker runs it
+typedef struct
+{
+    const char *path;
+    _Atomic int state; // RomState
+    _Atomic uint64_t frames_done;
+    _Atomic bool timed_out;
+    _Atomic double started; // Wall time the worker picked it up
+
+    // Results
+    const char *status; // ok, halted, waiting, stalled, timeout, error
+    const char *message; // Message the core raised, if any
+    uint64_t instructions;
+    double seconds;
+    uint64_t screen_hash;
+    uint32_t opcode_counts[OPCODE_KINDS];
+} RomRun;
+
+typedef struct
+{
+    uint64_t frames;
+    uint32_t instructions_per_frame;
+    uint32_t stall_frames; // Identical machine state for this many frames counts as no progress
+    double timeout_seconds;
+    const char *core;
+} RunConfig;
+
+static RunConfig config = { 3600, 12, 120, 10.0, "decoded" };
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t hashBytes(const void *data, size_t count, uint64_t hash) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL; // FNV-1a
+    }
+    return hash;
+}
+
+static uint64_t screenHash(const Chip8 *chip) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint8_t y = 0; y < chip->screen_h; ++y) {
+        for (uint8_t x = 0; x < chip->screen_w; ++x) {
+            uint8_t pixel = getPixel(chip, x, y);
+            hash = hashBytes(&pixel, 1, hash);
+        }
+    }
+    return hash;
+}
+
+// Everything an instruction can change apart from memory and the screen
+static uint64_t registersHash(const Chip8 *chip) {
+    uint64_t hash = hashBytes(chip->V, sizeof(chip->V), 14695981039346656037ULL);
+    hash = hashBytes(&chip->I, sizeof(chip->I), hash);
+    hash = hashBytes(&chip->PC, sizeof(chip->PC), hash);
+    hash = hashBytes(&chip->sp, sizeof(chip->sp), hash);
+    hash = hashBytes(chip->stack, sizeof(chip->stack), hash);
+    hash = hashBytes(&chip->delay_timer, sizeof(chip->delay_timer), hash);
+    return hashBytes(&chip->sound_timer, sizeof(chip->sound_timer), hash);
+}
+
+static void runRom(void *arg) {
+    RomRun *run = arg;
+    atomic_store(&run->started, now());
+    atomic_store(&run->state, ROM_RUNNING);
+    run->status = "ok";
+
+    Chip8 *chip = createChip8();
+    if (chip == NULL) {
+        run->status = "error";
+        run->message = "Out of memory";
+        atomic_store(&run->state, ROM_DONE);
+        return;
+    }
+    if (strcmp(config.core, "interpreter") != 0) {
+        setDecodeCache(chip, true);
+    }
+    if (strcmp(config.core, "jit") == 0) {
+        setJit(chip, true);
+    } else {
+        chip->opcode_counts = run->opcode_counts;
+    }
+    resetState(chip, 2);
+
+    // Read here rather than by loadROM(), the platform has to be set up before loading
+    uint8_t *rom = malloc(MEMORY_SIZE - PROGRAM_START + 1);
+    FILE *file = rom != NULL ? fopen(run->path, "rb") : NULL;
+    size_t size = file != NULL ? fread(rom, 1, MEMORY_SIZE - PROGRAM_START + 1, file) : 0;
+    if (file != NULL) {
+        fclose(file);
+        RomPlatform platform = detectRomPlatform(rom, size, run->path);
+        setQuirks(chip, platform); // setQuirks() types follow the platforms
+        setInstructions(chip, platform == PLATFORM_XOCHIP ? 2 : 1);
+    }
+
+    if (file == NULL) {
+        run->status = "error";
+        run->message = rom != NULL ? "Couldn't open the file" : "Out of memory";
+    } else if (!loadROMFromMemory(chip, rom, size)) {
+        run->status = "error";
+        run->message = chip->message;
+    } else {
+        uint64_t last_state = 0;
+        uint32_t same_state_frames = 0;
+        double start = now();
+        for (uint64_t frame = 0; frame < config.frames; ++frame) {
+            runCycles(chip, config.instructions_per_frame);
+            tickTimers(chip);
+            atomic_store(&run->frames_done, frame + 1);
+
+            if (chip->message != NULL) {
+                // Messages would open a box in the GUI, here they only flag this ROM
+                if (run->message == NULL) {
+                    run->message = chip->message;
+                }
+                bool fatal = strcmp(chip->message_title, "ERROR") == 0;
+                chip->message_title = NULL;
+                chip->message = NULL;
+                if (fatal) {
+                    run->status = "error";
+                    break;
+                }
+            }
+            if (chip->halted) {
+                run->status = "halted";
+                break;
+            }
+            if (atomic_load(&run->timed_out)) {
+                run->status = "timeout";
+                break;
+            }
+
+            uint64_t state = registersHash(chip);
+            if (state == last_state && chip->dirty_rows == 0) {
+                if (++same_state_frames >= config.stall_frames) {
+                    run->status = chip->waiting_for_key ? "waiting" : "stalled";
+                    break;
+                }
+            } else {
+                same_state_frames = 0;
+            }
+            last_state = state;
+            chip->dirty_rows = 0;
+        }
+        run->seconds = now() - start;
+    }
+
+    run->instructions = 0;
+    for (uint8_t i = 0; i < OPCODE_KINDS; ++i) {
+        run->instructions += run->opcode_counts[i];
+    }
+    if (chip->opcode_counts == NULL) {
+        run->instructions = atomic_load(&run->frames_done) * config.instructions_per_frame;
+    }
+    run->screen_hash = screenHash(chip);
+    free(rom);
+    destroyChip8(chip);
+    atomic_store(&run->state, ROM_DONE);
+}
+
+typedef struct
+{
+    RomRun *runs;
+    size_t count;
+    _Atomic bool finished;
+} Watchdog;
+
+// Flags ROMs that run longer than the timeout, the worker stops them after the current frame.
+// A ROM that doesn't even finish a frame in twice that time means the core itself hangs,
+// so the process gives up instead of waiting forever.
+static void *watchdogMain(void *arg) {
+    Watchdog *watchdog = arg;
+    while (!atomic_load(&watchdog->finished)) {
+        nanosleep(&(struct timespec){ .tv_nsec = 100000000 }, NULL);
+        double time = now();
+        for (size_t i = 0; i < watchdog->count; ++i) {
+            RomRun *run = &watchdog->runs[i];
+            if (atomic_load(&run->state) != ROM_RUNNING) {
+                continue;
+            }
+            double running = time - atomic_load(&run->started);
+            if (running > config.timeout_seconds) {
+                atomic_store(&run->timed_out, true);
+            }
+            if (running > 2 * config.timeout_seconds && atomic_load(&run->frames_done) == 0) {
+                fprintf(stderr, "%s: no frame finished in %.0f s, aborting\n", run->path, running);
+                fflush(stdout);
+                _Exit(2);
+            }
+        }
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static void addPath(PathList *list, const char *path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->paths = realloc(list->paths, list->capacity * sizeof(char *));
+        if (list->paths == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    list->paths[list->count++] = strdup(path);
+}
+
+static void addDirectory(PathList *list, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        struct stat info;
+        if (stat(path, &info) != 0) {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+            addDirectory(list, path);
+        } else if (looksLikeRom(path)) {
+            addPath(list, path);
+        }
+    }
+    closedir(dir);
+}
+
+static void addArgument(PathList *list, const char *argument) {
+    struct stat info;
+    if (stat(argument, &info) == 0) {
+        if (S_ISDIR(info.st_mode)) {
+            addDirectory(list, argument);
+        } else {
+            addPath(list, argument);
+        }
+        return;
+    }
+    glob_t matches;
+    if (glob(argument, 0, NULL, &matches) != 0) {
+        fprintf(stderr, "%s: no such file\n", argument);
+        return;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        addArgument(list, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+}
+
+static int comparePaths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void printHistogram(const RomRun *run) {
+    uint8_t order[OPCODE_KINDS];
+    for (uint8_t i = 0; i < OPCODE_KINDS; ++i) {
+        order[i] = i;
+    }
+    for (uint8_t i = 1; i < OPCODE_KINDS; ++i) { // Insertion sort, most executed first
+        for (uint8_t j = i; j > 0 && run->opcode_counts[order[j]] > run->opcode_counts[order[j - 1]]; --j) {
+            uint8_t swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+    }
+    printf("   ");
+    for (uint8_t i = 0; i < OPCODE_KINDS && run->opcode_counts[order[i]] > 0; ++i) {
+        printf(" %s:%u", opcodeKindName(order[i]), run->opcode_counts[order[i]]);
+    }
+    printf("\n");
+}
+
+static int printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [-f frames | -n instructions] [-i instructions_per_frame] [-j threads]\n"
+        "       [-c interpreter|decoded|jit] [-w stall_frames] [-t seconds] [-H] [rom|dir|glob]...\n", program);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    uint32_t threads = 0;
+    bool show_histograms = false;
+    uint64_t instructions = 0;
+    int first_path = 1;
+    for (; first_path < argc && argv[first_path][0] == '-'; ++first_path) {
+        const char *option = argv[first_path];
+        if (strcmp(option, "-H") == 0) {
+            show_histograms = true;
+            continue;
+        }
+        // Every other option takes a value, a missing one is an error rather than a ROM path
+        if (strlen(option) != 2 || strchr("fnijcwt", option[1]) == NULL || first_path + 1 >= argc) {
+            return printUsage(argv[0]);
+        }
+        const char *value = argv[++first_path];
+        if (strcmp(option, "-f") == 0) {
+            config.frames = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "-n") == 0) {
+            instructions = strtoull(value, NULL, 10);
+        } else if (strcmp(option, "-i") == 0) {
+            config.instructions_per_frame = strtoul(value, NULL, 10);
+        } else if (strcmp(option, "-j") == 0) {
+            threads = strtoul(value, NULL, 10);
+        } else if (strcmp(option, "-c") == 0) {
+            config.core = value;
+        } else if (strcmp(option, "-w") == 0) {
+            config.stall_frames = strtoul(value, NULL, 10);
+        } else {
+            config.timeout_seconds = strtod(value, NULL);
+        }
+    }
+    if (config.instructions_per_frame == 0) {
+        config.instructions_per_frame = 1;
+    }
+    if (instructions > 0) {
+        config.frames = (instructions + config.instructions_per_frame - 1) / config.instructions_per_frame;
+    }
+    if (config.stall_frames == 0) {
+        config.stall_frames = UINT32_MAX;
+    }
+
+    PathList list = {0};
+    if (first_path == argc) {
+        addArgument(&list, "ROMs");
+    }
+    for (int i = first_path; i < argc; ++i) {
+        addArgument(&list, argv[i]);
+    }
+    if (list.count == 0) {
+        fprintf(stderr, "No ROMs found\n");
+        return 1;
+    }
+    qsort(list.paths, list.count, sizeof(char *), comparePaths);
+
+    RomRun *runs = calloc(list.count, sizeof(RomRun));
+    ThreadPool *pool = createThreadPool(threads);
+    if (runs == NULL || pool == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    Watchdog watchdog = { runs, list.count, false };
+    pthread_t watchdog_thread;
+    if (pthread_create(&watchdog_thread, NULL, watchdogMain, &watchdog) != 0) {
+        fprintf(stderr, "Couldn't start the watchdog\n");
+        return 1;
+    }
+
+    double start = now();
+    for (size_t i = 0; i < list.count; ++i) {
+        runs[i].path = list.paths[i];
+        if (!submitTask(pool, runRom, &runs[i])) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    waitThreadPool(pool);
+    double seconds = now() - start;
+    atomic_store(&watchdog.finished, true);
+    pthread_join(watchdog_thread, NULL);
+
+    uint32_t by_status[6] = {0};
+    const char *statuses[6] = { "ok", "halted", "waiting", "stalled", "timeout", "error" };
+    uint64_t total_instructions = 0;
+    for (size_t i = 0; i < list.count; ++i) {
+        RomRun *run = &runs[i];
+        printf("%-7s %8.1f MIPS %11llu  %016llx  %s", run->status, run->seconds > 0 ? run->instructions / run->seconds / 1e6 : 0,
+            (unsigned long long)run->instructions, (unsigned long long)run->screen_hash, run->path);
+        if (run->message) {
+            printf("  (%s)", run->message);
+        }
+        printf("\n");
+        if (show_histograms) {
+            printHistogram(run);
+        }
+        for (uint8_t s = 0; s < 6; ++s) {
+            by_status[s] += strcmp(run->status, statuses[s]) == 0;
+        }
+        total_instructions += run->instructions;
+    }
+    printf("%zu ROMs in %.2f s on %u threads (%s), %.1f MIPS total:", list.count, seconds, threadPoolSize(pool),
+        config.core, total_instructions / seconds / 1e6);
+    for (uint8_t s = 0; s < 6; ++s) {
+        if (by_status[s] > 0) {
+            printf(" %u %s", by_status[s], statuses[s]);
+        }
+    }
+    printf("\n");
+
+    destroyThreadPool(pool);
+    for (size_t i = 0; i < list.count; ++i) {
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    free(runs);
+    return by_status[5] > 0 ? 1 : 0;
+}